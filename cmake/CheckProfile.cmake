@@ -0,0 +1,13 @@
+#
+# Checks that the profiler wrote a non-empty file.
+#
+#  PROFILE_OUTPUT - the file given with -X wslua2.profile
+#
+
+if(NOT EXISTS "${PROFILE_OUTPUT}")
+	message(FATAL_ERROR "The profiler did not write ${PROFILE_OUTPUT}")
+endif()
+file(SIZE "${PROFILE_OUTPUT}" _size)
+if(_size EQUAL 0)
+	message(FATAL_ERROR "The profiler wrote an empty ${PROFILE_OUTPUT}")
+endif()
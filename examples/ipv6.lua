@@ -96,8 +96,7 @@ local function dissect_ipv6(tvb, pinfo, tree, cinfo)
         pi:append_text(string.format(", Src: %s, Dst: %s", src, dst))
     end
 
-    ws.dissector_try_uint("ip.proto", nxt,
-                            tvb:new_subset_remaining(offset), pinfo, tree)
+    ipv6.ip_proto:try_uint(nxt, tvb:new_subset_remaining(offset), pinfo, tree)
 
     log:debug("Finished dissecting %d bytes", tvb:captured_length())
 
@@ -126,6 +125,7 @@ end
 
 local function handoff_ipv6()
     ws.dissector_add_uint("ethertype", 0x86DD, ipv6.handle)
+    ipv6.ip_proto = ws.DissectorTable.get("ip.proto")
 end
 
 local M = {}
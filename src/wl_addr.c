@@ -51,10 +51,54 @@ void luaW_push_ipv6(lua_State *L, const struct e_in6_addr *ip6)
     memcpy(ptr, ip6, sizeof(struct e_in6_addr));
 }
 
-void luaW_push_addr(lua_State *L, address *addr)
+/* Weak table of interned addresses */
+#define ADDR_INTERN "wslua2.addresses"
+
+/* Addresses longer than this are not interned */
+#define ADDR_INTERN_MAX 64
+
+/*
+ * Addresses are immutable and stored inline, with the bytes following the
+ * address struct in the same userdata, so they need no finalizer. Equal
+ * addresses are interned to the same object while it is alive, so they
+ * can be used as table keys.
+ */
+void luaW_push_addr(lua_State *L, const address *addr)
 {
-    address *ptr = NEWUSERDATA(L, address, "wslua.Address");
-    copy_address(ptr, addr);
+    char key[sizeof(int) + ADDR_INTERN_MAX];
+    size_t key_len = 0;
+    address *ptr;
+
+    if (addr->len <= ADDR_INTERN_MAX) {
+        memcpy(key, &addr->type, sizeof(int));
+        if (addr->len > 0)
+            memcpy(key + sizeof(int), addr->data, addr->len);
+        key_len = sizeof(int) + addr->len;
+        luaL_getsubtable(L, LUA_REGISTRYINDEX, ADDR_INTERN);
+        lua_pushlstring(L, key, key_len);
+        if (lua_rawget(L, -2) == LUA_TUSERDATA) {
+            lua_remove(L, -2);
+            return;
+        }
+        lua_pop(L, 1);
+    }
+
+    ptr = luaW_newuserdata(L, sizeof(address) + addr->len, "wslua.Address");
+    ptr->type = addr->type;
+    ptr->len = addr->len;
+    ptr->data = NULL;
+    ptr->priv = NULL;
+    if (addr->len > 0) {
+        memcpy(ptr + 1, addr->data, addr->len);
+        ptr->data = ptr + 1;
+    }
+
+    if (key_len > 0) {
+        lua_pushlstring(L, key, key_len);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
+        lua_remove(L, -2);
+    }
 }
 
 address_type ftenum_to_addr_type(enum ftenum ft)
@@ -134,6 +178,10 @@ static int wl_addr_ipv6(lua_State *L)
 
 /***
  * Generic address class.
+ *
+ * Addresses are immutable. Equal addresses are the same object while it is
+ * referenced, so they can be used as table keys, and they can be compared
+ * with the relational operators.
  * @type Address
  */
 
@@ -146,11 +194,29 @@ static int wl_addr_tostring(lua_State *L)
     return 1;
 }
 
-static int wl_addr_gc(lua_State *L)
+/* Also called when only one operand is an Address, e.g. addr == ipv4 */
+static int wl_addr_eq(lua_State *L)
 {
-    address *addr = luaW_check_addr(L, 1);
-    free_address(addr);
-    return 0;
+    address *addr1 = luaL_testudata(L, 1, "wslua.Address");
+    address *addr2 = luaL_testudata(L, 2, "wslua.Address");
+    lua_pushboolean(L, addr1 != NULL && addr2 != NULL && addresses_equal(addr1, addr2));
+    return 1;
+}
+
+static int wl_addr_lt(lua_State *L)
+{
+    address *addr1 = luaW_check_addr(L, 1);
+    address *addr2 = luaW_check_addr(L, 2);
+    lua_pushboolean(L, cmp_address(addr1, addr2) < 0);
+    return 1;
+}
+
+static int wl_addr_le(lua_State *L)
+{
+    address *addr1 = luaW_check_addr(L, 1);
+    address *addr2 = luaW_check_addr(L, 2);
+    lua_pushboolean(L, cmp_address(addr1, addr2) <= 0);
+    return 1;
 }
 
 /***
@@ -167,7 +233,7 @@ static int wl_addr_new(lua_State *L)
         uint32_t ip4;
         struct e_in6_addr ip6;
     } addr_data;
-    address *addr;
+    address addr;
 
     /* first see if we were passed the tuple (AT_type, "string address")
      * and convert that to an address */
@@ -204,9 +270,8 @@ static int wl_addr_new(lua_State *L)
         return luaL_error(L, "Unknown address value %s", badarg);
     }
 
-    addr = wmem_new(NULL, address);
-    alloc_address_wmem(NULL, addr, addr_type, addr_size, &addr_data);
-    luaW_push_addr(L, addr);
+    set_address(&addr, addr_type, (int)addr_size, &addr_data);
+    luaW_push_addr(L, &addr);
     return 1;
 }
 
@@ -235,7 +300,9 @@ static const struct luaL_Reg wl_ipv6_m[] = {
 static const struct luaL_Reg wl_addr_m[] = {
     { "pack", wl_addr_pack },
     { "__tostring", wl_addr_tostring },
-    { "__gc", wl_addr_gc },
+    { "__eq", wl_addr_eq },
+    { "__lt", wl_addr_lt },
+    { "__le", wl_addr_le },
     { NULL, NULL }
 };
 
@@ -252,6 +319,13 @@ void wl_open_addr(lua_State *L)
     luaW_newmetatable(L, "wslua.IPv4", wl_ipv4_m);
     luaW_newmetatable(L, "wslua.IPv6", wl_ipv6_m);
     luaW_newmetatable(L, "wslua.Address", wl_addr_m);
+
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, ADDR_INTERN);
     luaL_newlib(L, wl_addr_f);
     lua_setfield(L, -2, "Address");
 }
@@ -33,7 +33,7 @@ void luaW_push_ipv4(lua_State *L, uint32_t ip4);
 
 void luaW_push_ipv6(lua_State *L, const struct e_in6_addr *ip6);
 
-void luaW_push_addr(lua_State *L, address *addr);
+void luaW_push_addr(lua_State *L, const address *addr);
 
 address_type ftenum_to_addr_type(enum ftenum ft);
 
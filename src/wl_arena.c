@@ -0,0 +1,170 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <limits.h>
+
+/*
+ * A handle is a light userdata that encodes a marker bit and a sequence
+ * number, counting every handle ever created:
+ *
+ *   | 1 | sequence number |
+ *
+ * The handles of the packets being dissected are the numbers from
+ * 'first' to 'first + count', and the index into the handle table is
+ * the distance from 'first'. Creating one does not allocate Lua memory,
+ * so the collector never sees it. When the last open packet is done the
+ * table is emptied and 'first' moves past its handles, which invalidates
+ * every handle at once. Using a stale handle always raises an error,
+ * instead of reading a tree or a tvb that Wireshark has freed. The table
+ * is kept for the next packet, so a stale handle never points to freed
+ * memory.
+ *
+ * All the bits below the marker are used by the sequence number, so a
+ * stale handle could only be taken for a live one after 2^31 handles on
+ * 32-bit targets and 2^63 on 64-bit targets, not after a fixed number of
+ * packets.
+ *
+ * All light userdata share one metatable. Its __index finds the type of
+ * the handle and looks the key up in the metatable of that type.
+ */
+
+#define HANDLE_BITS         (sizeof(uintptr_t) * CHAR_BIT)
+#define HANDLE_MARK         ((uintptr_t)1 << (HANDLE_BITS - 1))
+#define HANDLE_SEQ_MASK     (HANDLE_MARK - 1)
+
+struct wl_handle_entry {
+    void *ptr;
+    enum wl_handle_type type;
+};
+
+static const char *const handle_meta[WL_HANDLE_NTYPES] = {
+    [WL_HANDLE_TVBUFF] = "wslua.TVBuff",
+    [WL_HANDLE_PROTO_ITEM] = "wslua.ProtoItem",
+    [WL_HANDLE_PROTO_TREE] = "wslua.ProtoTree",
+    [WL_HANDLE_COLUMN_INFO] = "wslua.ColumnInfo",
+};
+
+static struct {
+    struct wl_handle_entry *entries;
+    size_t count;
+    size_t alloc;
+    uintptr_t first;            /* sequence number of entries[0] */
+    unsigned packets;           /* being dissected */
+} arena;
+
+/* Returns the entry of a handle, NULL if 'h' is not a handle */
+static struct wl_handle_entry *l_handle_entry(lua_State *L, uintptr_t h)
+{
+    if (!(h & HANDLE_MARK))
+        return NULL;
+    uintptr_t index = (h - arena.first) & HANDLE_SEQ_MASK;
+    if (index >= arena.count)
+        luaL_error(L, "object used after the end of its packet");
+    return &arena.entries[index];
+}
+
+void luaW_push_handle(lua_State *L, enum wl_handle_type type, void *ptr)
+{
+    if (arena.packets == 0) {
+        void **ud = NEWUSERDATA(L, void *, handle_meta[type]);
+        *ud = ptr;
+        return;
+    }
+    luaW_gc_check(L);
+    if (arena.count == arena.alloc) {
+        arena.alloc = arena.alloc ? arena.alloc * 2 : 256;
+        arena.entries = xrealloc(arena.entries, arena.alloc * sizeof(struct wl_handle_entry));
+    }
+    arena.entries[arena.count].ptr = ptr;
+    arena.entries[arena.count].type = type;
+    uintptr_t h = HANDLE_MARK | ((arena.first + arena.count++) & HANDLE_SEQ_MASK);
+    lua_pushlightuserdata(L, (void *)h);
+}
+
+void *luaW_check_handle(lua_State *L, int arg, enum wl_handle_type type)
+{
+    if (lua_islightuserdata(L, arg)) {
+        struct wl_handle_entry *e = l_handle_entry(L, (uintptr_t)lua_touserdata(L, arg));
+        if (e != NULL && e->type == type)
+            return e->ptr;
+        luaL_typeerror(L, arg, handle_meta[type] + sizeof("wslua.") - 1);
+    }
+    void **ud = luaL_checkudata(L, arg, handle_meta[type]);
+    return *ud;
+}
+
+bool luaW_test_handle(lua_State *L, int arg, enum wl_handle_type type)
+{
+    if (lua_islightuserdata(L, arg)) {
+        struct wl_handle_entry *e = l_handle_entry(L, (uintptr_t)lua_touserdata(L, arg));
+        return e != NULL && e->type == type;
+    }
+    return luaL_testudata(L, arg, handle_meta[type]) != NULL;
+}
+
+void luaW_arena_packet_begin(lua_State *L _U_)
+{
+    arena.packets++;
+}
+
+void luaW_arena_packet_end(lua_State *L _U_)
+{
+    if (arena.packets == 0 || --arena.packets != 0)
+        return;
+    arena.first = (arena.first + arena.count) & HANDLE_SEQ_MASK;
+    arena.count = 0;
+}
+
+/* The metatables of the handle types are the upvalues */
+static int l_handle_index(lua_State *L)
+{
+    struct wl_handle_entry *e = l_handle_entry(L, (uintptr_t)lua_touserdata(L, 1));
+    if (e == NULL)
+        return luaL_error(L, "attempt to index a light userdata value");
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(e->type + 1));
+    return 1;
+}
+
+static int l_handle_tostring(lua_State *L)
+{
+    uintptr_t h = (uintptr_t)lua_touserdata(L, 1);
+    if (!(h & HANDLE_MARK)) {
+        lua_pushfstring(L, "userdata: %p", (void *)h);
+        return 1;
+    }
+    struct wl_handle_entry *e = l_handle_entry(L, h);
+    lua_pushfstring(L, "%s: %p", handle_meta[e->type] + sizeof("wslua.") - 1, e->ptr);
+    return 1;
+}
+
+/* Receives module on the stack */
+void wl_open_arena(lua_State *L)
+{
+    lua_pushlightuserdata(L, NULL);
+    lua_createtable(L, 0, 2);
+    for (int i = 0; i < WL_HANDLE_NTYPES; i++)
+        luaL_getmetatable(L, handle_meta[i]);
+    lua_pushcclosure(L, l_handle_index, WL_HANDLE_NTYPES);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, l_handle_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+}
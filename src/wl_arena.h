@@ -0,0 +1,51 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_ARENA_H_
+#define _WL_ARENA_H_
+
+#include <stdbool.h>
+
+/*
+ * Handles for binding objects that only live for one packet. While a
+ * packet is dissected they are light userdata indexing a per-packet
+ * table; outside of packets they are ordinary userdata.
+ */
+
+enum wl_handle_type {
+    WL_HANDLE_TVBUFF,
+    WL_HANDLE_PROTO_ITEM,
+    WL_HANDLE_PROTO_TREE,
+    WL_HANDLE_COLUMN_INFO,
+    WL_HANDLE_NTYPES
+};
+
+void luaW_push_handle(lua_State *L, enum wl_handle_type type, void *ptr);
+
+/* Raises an error if the handle is from a packet that has been dissected */
+void *luaW_check_handle(lua_State *L, int arg, enum wl_handle_type type);
+
+bool luaW_test_handle(lua_State *L, int arg, enum wl_handle_type type);
+
+void luaW_arena_packet_begin(lua_State *L);
+
+void luaW_arena_packet_end(lua_State *L);
+
+/* Must be called after the metatables of the handle types are created */
+void wl_open_arena(lua_State *L);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+static struct {
+    unsigned threshold;         /* consecutive errors, 0 disables the breaker */
+    unsigned retry_frames;      /* 0 never retries */
+} breaker_prefs = {
+    .threshold = 0,
+    .retry_frames = 0,
+};
+
+/* Drops the state of the previous capture file */
+static void l_breaker_sync(struct wl_breaker *b)
+{
+    unsigned file = luaW_file_generation();
+    if (b->file == file)
+        return;
+    b->file = file;
+    b->errors = 0;
+    b->count = 0;
+    b->skipped = 0;
+    b->logged = false;
+}
+
+bool wl_breaker_is_open(struct wl_breaker *b, packet_info *pinfo)
+{
+    if (b->count == 0 && breaker_prefs.threshold == 0)
+        return false;
+    l_breaker_sync(b);
+
+    /* Binary search, the last interval in the first pass */
+    size_t lo = 0, hi = b->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->open[mid].last < pinfo->num)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < b->count && b->open[lo].first <= pinfo->num) {
+        b->skipped++;
+        return true;
+    }
+    return false;
+}
+
+void wl_breaker_record(struct wl_breaker *b, packet_info *pinfo, bool failed, const char *name)
+{
+    if (breaker_prefs.threshold == 0 || PINFO_FD_VISITED(pinfo))
+        return;
+    l_breaker_sync(b);
+    if (!failed) {
+        b->errors = 0;
+        return;
+    }
+    if (++b->errors < breaker_prefs.threshold)
+        return;
+
+    /* The frame that tripped the breaker is dissected in every pass */
+    if (b->count == b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 8;
+        b->open = xrealloc(b->open, b->alloc * sizeof(struct wl_breaker_interval));
+    }
+    struct wl_breaker_interval *iv = &b->open[b->count++];
+    iv->first = pinfo->num + 1;
+    if (breaker_prefs.retry_frames > 0 && pinfo->num < UINT32_MAX - breaker_prefs.retry_frames)
+        iv->last = pinfo->num + breaker_prefs.retry_frames;
+    else
+        iv->last = UINT32_MAX;
+    b->errors = 0;
+
+    if (!b->logged) {
+        ws_warning("Lua dissector %s skipped after %u consecutive errors in frame %u",
+                        name, breaker_prefs.threshold, pinfo->num);
+        b->logged = true;
+    }
+}
+
+void wl_breaker_register(module_t *module)
+{
+    prefs_register_uint_preference(module, "error_threshold", "Disable after errors",
+                "Skip a Lua dissector after this number of consecutive errors, 0 to never skip it. "
+                "Packets are passed to the data dissector instead",
+                10, &breaker_prefs.threshold);
+    prefs_register_uint_preference(module, "error_retry_frames", "Retry after frames",
+                "Call a skipped Lua dissector again after this number of frames, 0 to never retry",
+                10, &breaker_prefs.retry_frames);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_BREAKER_H_
+#define _WL_BREAKER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Circuit breaker for failing dissectors. After a number of consecutive
+ * errors the dissector is skipped, for good or for a number of frames.
+ * The frames that were skipped in the first pass are recorded, so later
+ * passes skip the same frames.
+ */
+
+struct wl_breaker_interval {
+    uint32_t first;
+    uint32_t last;
+};
+
+struct wl_breaker {
+    unsigned file;              /* luaW_file_generation() of the state */
+    unsigned errors;            /* consecutive */
+    struct wl_breaker_interval *open;   /* frames skipped, in order */
+    size_t count;
+    size_t alloc;
+    uint64_t skipped;
+    bool logged;
+};
+
+void wl_breaker_register(module_t *module);
+
+/* Returns true if the dissector must be skipped for this packet */
+bool wl_breaker_is_open(struct wl_breaker *b, packet_info *pinfo);
+
+/* Records the result of a call that was not skipped */
+void wl_breaker_record(struct wl_breaker *b, packet_info *pinfo, bool failed, const char *name);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <limits.h>
+
+/*
+ * The budget is enforced with a count hook, which makes the interpreter
+ * check every instruction, so it is disabled by default. The hook that was
+ * set before a call is restored after it, so Lua dissectors called by other
+ * Lua dissectors each get their own budget.
+ *
+ * While the profiler runs, the budget is counted in steps of at most
+ * BUDGET_PROFILE_STEP instructions and each step takes the pending sample.
+ *
+ * Hooks are per thread and a new thread copies the hook of its creator,
+ * so threads resumed from C get the hook of the current call, or trade a
+ * hook left from an earlier one for the profiler hook, with
+ * luaW_budget_resume().
+ *
+ * A dissector disabled after timeouts keeps dissecting the frames up to
+ * the one that disabled it, so a second pass sees the same frames as the
+ * first. The state is reset with the capture file.
+ */
+
+#define BUDGET_PROFILE_STEP     1000
+
+static struct {
+    unsigned kinstructions;     /* per call, 0 disables the budget */
+    unsigned disable_after;     /* consecutive timeouts, 0 never disables */
+} budget_prefs = {
+    .kinstructions = 0,
+    .disable_after = 10,
+};
+
+static expert_field ei_cpu_budget = { -1, -1 };
+
+struct wl_budget_call {
+    struct wl_budget_call *prev;
+    int count;
+    int remaining;
+    int step;                   /* count of the hook */
+    bool exceeded;
+};
+
+/* The innermost call with a budget */
+static struct wl_budget_call *budget_call = NULL;
+
+static void l_budget_hook(lua_State *L, lua_Debug *ar _U_)
+{
+    struct wl_budget_call *call = budget_call;
+
+    if (call == NULL) {
+        /* A thread created during a call that is resumed after it */
+        luaW_profile_set_hook(L);
+        return;
+    }
+    /*
+     * The dissector may catch the error with pcall(). Raise it again at
+     * every instruction, so it reaches the outermost function.
+     */
+    if (!call->exceeded) {
+        luaW_profile_poll(L);
+        call->remaining -= call->step;
+        if (call->remaining > 0) {
+            if (call->remaining < call->step) {
+                call->step = call->remaining;
+                lua_sethook(L, l_budget_hook, LUA_MASKCOUNT, call->step);
+            }
+            return;
+        }
+        call->exceeded = true;
+        lua_sethook(L, l_budget_hook, LUA_MASKCOUNT, 1);
+    }
+    luaL_where(L, 0);
+    lua_pushfstring(L, "CPU budget of %d instructions exceeded", call->count);
+    lua_concat(L, 2);
+    lua_error(L);
+}
+
+void luaW_budget_resume(lua_State *co)
+{
+    if (budget_call != NULL)
+        lua_sethook(co, l_budget_hook, LUA_MASKCOUNT, budget_call->step);
+    else if (lua_gethook(co) == l_budget_hook)
+        luaW_profile_set_hook(co);
+}
+
+static void l_budget_sync(struct wl_budget *budget)
+{
+    unsigned file = luaW_file_generation();
+    if (budget->file == file)
+        return;
+    budget->file = file;
+    budget->consecutive = 0;
+    budget->disabled = false;
+    budget->disabled_frame = 0;
+}
+
+bool wl_budget_is_disabled(struct wl_budget *budget, packet_info *pinfo)
+{
+    if (!budget->disabled)
+        return false;
+    l_budget_sync(budget);
+    return budget->disabled && pinfo->num > budget->disabled_frame;
+}
+
+int luaW_budget_pcall_dissector(lua_State *L, int ref, struct wl_budget *budget, const char *name,
+                                tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
+{
+    if (budget_prefs.kinstructions == 0)
+        return luaW_pcall_dissector_ref(L, ref, tvb, pinfo, tree);
+
+    lua_Hook prev_hook = lua_gethook(L);
+    int prev_mask = lua_gethookmask(L);
+    int prev_count = lua_gethookcount(L);
+    struct wl_budget_call call = {
+        .prev = budget_call,
+        .count = budget_prefs.kinstructions < INT_MAX / 1000 ?
+                        (int)budget_prefs.kinstructions * 1000 : INT_MAX,
+        .exceeded = false,
+    };
+    call.remaining = call.count;
+    call.step = call.count;
+    if (luaW_profile_running() && call.step > BUDGET_PROFILE_STEP)
+        call.step = BUDGET_PROFILE_STEP;
+
+    volatile int status = LUA_OK;
+    budget_call = &call;
+    lua_sethook(L, l_budget_hook, LUA_MASKCOUNT, call.step);
+    TRY {
+        status = luaW_pcall_dissector_ref(L, ref, tvb, pinfo, tree);
+    }
+    FINALLY {
+        /* 'call' goes out of scope if an exception escapes */
+        lua_sethook(L, prev_hook, prev_mask, prev_count);
+        budget_call = call.prev;
+    }
+    ENDTRY;
+
+    if (!call.exceeded) {
+        budget->consecutive = 0;
+        return status;
+    }
+    if (status == LUA_OK) {
+        /* The dissector caught the error */
+        lua_pop(L, 1);
+        lua_pushfstring(L, "CPU budget of %d instructions exceeded", call.count);
+        status = LUA_ERRRUN;
+    }
+    l_budget_sync(budget);
+    budget->timeouts++;
+    proto_tree_add_expert_format(tree, pinfo, &ei_cpu_budget, tvb, 0, 0,
+                    "Lua dissector %s exceeded its CPU budget of %d instructions", name, call.count);
+    if (budget_prefs.disable_after > 0 && ++budget->consecutive >= budget_prefs.disable_after &&
+                    !budget->disabled) {
+        budget->disabled = true;
+        budget->disabled_frame = pinfo->num;
+        ws_warning("Lua dissector %s disabled after %u consecutive timeouts in frame %u",
+                        name, budget->consecutive, pinfo->num);
+    }
+    return status;
+}
+
+void wl_budget_register(int proto, module_t *module)
+{
+    static ei_register_info ei[] = {
+        { &ei_cpu_budget, { "wslua2.cpu_budget", PI_UNDECODED, PI_ERROR,
+                            "Lua dissector exceeded its CPU budget", EXPFILL } },
+    };
+
+    expert_register_field_array(expert_register_protocol(proto), ei, G_N_ELEMENTS(ei));
+
+    prefs_register_uint_preference(module, "cpu_budget", "CPU budget (thousands of instructions)",
+                "Maximum number of Lua instructions of one dissector call, 0 for no limit. "
+                "Counting instructions slows down the Lua code",
+                10, &budget_prefs.kinstructions);
+    prefs_register_uint_preference(module, "cpu_budget_disable_after", "Disable after timeouts",
+                "Disable a Lua dissector after this number of consecutive calls run out of budget, "
+                "0 to never disable it",
+                10, &budget_prefs.disable_after);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_BUDGET_H_
+#define _WL_BUDGET_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * CPU budget of dissector calls, counted in Lua instructions. A call that
+ * runs out of budget fails with an error and the dissector is disabled
+ * after a number of consecutive timeouts.
+ */
+
+struct wl_budget {
+    uint64_t timeouts;
+    unsigned consecutive;       /* timeouts since the last call that finished */
+    bool disabled;
+    uint32_t disabled_frame;    /* the frame with the last timeout */
+    unsigned file;              /* luaW_file_generation() of the state */
+};
+
+void wl_budget_register(int proto, module_t *module);
+
+/* Returns true if the frame is after the one that disabled the dissector */
+bool wl_budget_is_disabled(struct wl_budget *budget, packet_info *pinfo);
+
+/* Sets or clears the budget hook of a thread resumed from C */
+void luaW_budget_resume(lua_State *co);
+
+/*
+ * Like luaW_pcall_dissector_ref(), with the budget of the call enforced.
+ * 'name' is used in the expert info and the log.
+ */
+int luaW_budget_pcall_dissector(lua_State *L, int ref, struct wl_budget *budget, const char *name,
+                                tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree);
+
+#endif
@@ -0,0 +1,308 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wl_codec.h"
+
+/*
+ * Decoding tables map an input character to its value. Values with the
+ * two high bits set are never data, so the fast paths can validate a whole
+ * quantum with a single test. The base64 table accepts both the standard
+ * and the URL-safe alphabets, the base32 table is case-insensitive.
+ */
+#define DEC_SPACE   0x40
+#define DEC_PAD     0x41
+#define DEC_INVALID 0xff
+#define DEC_NONDATA 0xc0
+
+static const uint8_t hex_dec[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x40, 0x40, 0xff, 0xff, 0x40, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x40, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t base64_dec[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x40, 0x40, 0xff, 0xff, 0x40, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x40, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0x3e, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0x41, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0x3f,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t base32_dec[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x40, 0x40, 0xff, 0xff, 0x40, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x40, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xff, 0x41, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static const char hex_enc_lower[] = "0123456789abcdef";
+static const char hex_enc_upper[] = "0123456789ABCDEF";
+
+static const char base64_enc[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char base32_enc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+/* Write the whole bytes in the low 'bits' bits of 'acc', discarding the rest. */
+static uint8_t *flush_bits(uint8_t *out, uint64_t acc, unsigned bits)
+{
+    unsigned nbytes = bits / 8;
+
+    acc >>= bits - nbytes * 8;
+    while (nbytes-- > 0)
+        *out++ = (uint8_t)(acc >> (nbytes * 8));
+    return out;
+}
+
+ptrdiff_t wl_hex_decode(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    const uint8_t *end = src + len;
+    uint8_t *out = dst;
+    unsigned n = 0;
+    uint8_t acc = 0;
+    uint8_t v;
+
+    while (src < end) {
+        /* Fast path: two digits per byte, eight digits per iteration. */
+        while (end - src >= 8) {
+            uint8_t d0 = hex_dec[src[0]], d1 = hex_dec[src[1]];
+            uint8_t d2 = hex_dec[src[2]], d3 = hex_dec[src[3]];
+            uint8_t d4 = hex_dec[src[4]], d5 = hex_dec[src[5]];
+            uint8_t d6 = hex_dec[src[6]], d7 = hex_dec[src[7]];
+            if ((d0 | d1 | d2 | d3 | d4 | d5 | d6 | d7) & DEC_NONDATA)
+                break;
+            out[0] = d0 << 4 | d1;
+            out[1] = d2 << 4 | d3;
+            out[2] = d4 << 4 | d5;
+            out[3] = d6 << 4 | d7;
+            out += 4;
+            src += 8;
+        }
+        /* Slow path: one character at a time until a byte completes. */
+        while (src < end) {
+            v = hex_dec[*src++];
+            if (v == DEC_SPACE)
+                continue;
+            if (v & DEC_NONDATA)
+                return -1;
+            acc = acc << 4 | v;
+            if (++n == 2) {
+                *out++ = acc;
+                n = 0;
+                acc = 0;
+                break;
+            }
+        }
+    }
+    if (n != 0)
+        return -1;
+    return out - dst;
+}
+
+size_t wl_hex_encode(char *dst, const uint8_t *src, size_t len, bool upper)
+{
+    const char *digits = upper ? hex_enc_upper : hex_enc_lower;
+
+    for (size_t i = 0; i < len; i++) {
+        dst[2*i] = digits[src[i] >> 4];
+        dst[2*i+1] = digits[src[i] & 0x0f];
+    }
+    return WL_HEX_ENCODED_LEN(len);
+}
+
+ptrdiff_t wl_base64_decode(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    const uint8_t *end = src + len;
+    uint8_t *out = dst;
+    unsigned n = 0, pad = 0;
+    uint32_t acc = 0;
+    uint8_t v;
+
+    while (src < end) {
+        /* Fast path: whole quanta of four characters. */
+        while (pad == 0 && end - src >= 4) {
+            uint8_t a = base64_dec[src[0]], b = base64_dec[src[1]];
+            uint8_t c = base64_dec[src[2]], d = base64_dec[src[3]];
+            if ((a | b | c | d) & DEC_NONDATA)
+                break;
+            uint32_t q = (uint32_t)a << 18 | (uint32_t)b << 12 | c << 6 | d;
+            out[0] = q >> 16;
+            out[1] = q >> 8;
+            out[2] = q;
+            out += 3;
+            src += 4;
+        }
+        /* Slow path: whitespace, padding and partial quanta. */
+        while (src < end) {
+            v = base64_dec[*src++];
+            if (v == DEC_SPACE)
+                continue;
+            if (v == DEC_PAD) {
+                if (n < 2 || n + ++pad > 4)
+                    return -1;
+                continue;
+            }
+            if ((v & DEC_NONDATA) || pad > 0)
+                return -1;
+            acc = acc << 6 | v;
+            if (++n == 4) {
+                out = flush_bits(out, acc, 24);
+                n = 0;
+                acc = 0;
+                break;
+            }
+        }
+    }
+    /* Padding is optional, a single trailing character is not. */
+    if (n == 1)
+        return -1;
+    out = flush_bits(out, acc, n * 6);
+    return out - dst;
+}
+
+size_t wl_base64_encode(char *dst, const uint8_t *src, size_t len)
+{
+    char *out = dst;
+    size_t i;
+
+    for (i = 0; i + 3 <= len; i += 3) {
+        uint32_t q = (uint32_t)src[i] << 16 | src[i+1] << 8 | src[i+2];
+        out[0] = base64_enc[q >> 18];
+        out[1] = base64_enc[(q >> 12) & 0x3f];
+        out[2] = base64_enc[(q >> 6) & 0x3f];
+        out[3] = base64_enc[q & 0x3f];
+        out += 4;
+    }
+    if (i < len) {
+        uint32_t q = (uint32_t)src[i] << 16;
+        if (i + 1 < len)
+            q |= src[i+1] << 8;
+        out[0] = base64_enc[q >> 18];
+        out[1] = base64_enc[(q >> 12) & 0x3f];
+        out[2] = i + 1 < len ? base64_enc[(q >> 6) & 0x3f] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+    return out - dst;
+}
+
+ptrdiff_t wl_base32_decode(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    const uint8_t *end = src + len;
+    uint8_t *out = dst;
+    unsigned n = 0, pad = 0;
+    uint64_t acc = 0;
+    uint8_t v;
+
+    while (src < end) {
+        /* Fast path: whole quanta of eight characters. */
+        while (pad == 0 && end - src >= 8) {
+            uint8_t c0 = base32_dec[src[0]], c1 = base32_dec[src[1]];
+            uint8_t c2 = base32_dec[src[2]], c3 = base32_dec[src[3]];
+            uint8_t c4 = base32_dec[src[4]], c5 = base32_dec[src[5]];
+            uint8_t c6 = base32_dec[src[6]], c7 = base32_dec[src[7]];
+            if ((c0 | c1 | c2 | c3 | c4 | c5 | c6 | c7) & DEC_NONDATA)
+                break;
+            uint64_t q = (uint64_t)c0 << 35 | (uint64_t)c1 << 30 |
+                         (uint64_t)c2 << 25 | (uint64_t)c3 << 20 |
+                         (uint64_t)c4 << 15 | (uint64_t)c5 << 10 |
+                         (uint64_t)c6 << 5 | c7;
+            out = flush_bits(out, q, 40);
+            src += 8;
+        }
+        /* Slow path: whitespace, padding and partial quanta. */
+        while (src < end) {
+            v = base32_dec[*src++];
+            if (v == DEC_SPACE)
+                continue;
+            if (v == DEC_PAD) {
+                if (n < 2 || n + ++pad > 8)
+                    return -1;
+                continue;
+            }
+            if ((v & DEC_NONDATA) || pad > 0)
+                return -1;
+            acc = acc << 5 | v;
+            if (++n == 8) {
+                out = flush_bits(out, acc, 40);
+                n = 0;
+                acc = 0;
+                break;
+            }
+        }
+    }
+    /* Only 2, 4, 5 and 7 trailing characters encode whole bytes. */
+    if (n == 1 || n == 3 || n == 6)
+        return -1;
+    out = flush_bits(out, acc, n * 5);
+    return out - dst;
+}
+
+size_t wl_base32_encode(char *dst, const uint8_t *src, size_t len)
+{
+    char *out = dst;
+    size_t i;
+
+    for (i = 0; i < len; i += 5) {
+        size_t chunk = len - i < 5 ? len - i : 5;
+        uint64_t q = 0;
+        for (size_t j = 0; j < 5; j++)
+            q = q << 8 | (j < chunk ? src[i+j] : 0);
+        /* Number of characters carrying data for a 1-5 byte chunk. */
+        size_t nchars = (chunk * 8 + 4) / 5;
+        for (size_t j = 0; j < 8; j++)
+            out[j] = j < nchars ? base32_enc[(q >> (35 - j * 5)) & 0x1f] : '=';
+        out += 8;
+    }
+    return out - dst;
+}
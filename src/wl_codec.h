@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_CODEC_H_
+#define _WL_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Text to binary codecs. Decoders return the number of bytes written to
+ * 'dst' or -1 if the input is not valid. Whitespace in the input is ignored.
+ * The destination buffer must have room for WL_*_DECODED_MAX(len) bytes.
+ * Encoders write exactly WL_*_ENCODED_LEN(len) bytes and return that length.
+ */
+
+#define WL_HEX_DECODED_MAX(len)     ((len) / 2)
+#define WL_HEX_ENCODED_LEN(len)     ((len) * 2)
+
+#define WL_BASE64_DECODED_MAX(len)  (((len) / 4 + 1) * 3)
+#define WL_BASE64_ENCODED_LEN(len)  (((len) + 2) / 3 * 4)
+
+#define WL_BASE32_DECODED_MAX(len)  (((len) / 8 + 1) * 5)
+#define WL_BASE32_ENCODED_LEN(len)  (((len) + 4) / 5 * 8)
+
+ptrdiff_t wl_hex_decode(uint8_t *dst, const uint8_t *src, size_t len);
+
+size_t wl_hex_encode(char *dst, const uint8_t *src, size_t len, bool upper);
+
+ptrdiff_t wl_base64_decode(uint8_t *dst, const uint8_t *src, size_t len);
+
+size_t wl_base64_encode(char *dst, const uint8_t *src, size_t len);
+
+ptrdiff_t wl_base32_decode(uint8_t *dst, const uint8_t *src, size_t len);
+
+size_t wl_base32_encode(char *dst, const uint8_t *src, size_t len);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <epan/conversation.h>
+
+/***
+ * @module wireshark
+ */
+
+/*
+ * Lua values attached to a conversation are kept in a per-file table and
+ * the conversation only stores their reference, so everything is released
+ * together with the file scope.
+ */
+#define CONV_DATA "conversations"
+
+/* The conversation is freed with the file scope, 'file' detects stale objects */
+struct wl_conversation {
+    conversation_t *conv;
+    unsigned file;
+};
+
+static conversation_t *luaW_check_conversation(lua_State *L, int arg)
+{
+    struct wl_conversation *ptr = luaL_checkudata(L, arg, "wslua.Conversation");
+    if (ptr->file != luaW_file_generation())
+        luaL_error(L, "conversation used after the capture file was closed");
+    return ptr->conv;
+}
+
+static void luaW_push_conversation(lua_State *L, conversation_t *conv)
+{
+    if (conv == NULL) {
+        lua_pushnil(L);
+        return;
+    }
+    struct wl_conversation *ptr = NEWUSERDATA(L, struct wl_conversation, "wslua.Conversation");
+    ptr->conv = conv;
+    ptr->file = luaW_file_generation();
+}
+
+/* Pushes the table holding the conversation data references */
+static void l_push_conv_data(lua_State *L)
+{
+    luaW_push_file_table(L);
+    if (lua_getfield(L, -1, CONV_DATA) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, CONV_DATA);
+    }
+    lua_remove(L, -2);
+}
+
+/***
+ * Conversation class.
+ *
+ * Conversations are only valid until the capture file is closed, using one
+ * afterwards raises an error.
+ * @type Conversation
+ */
+
+/***
+ * Find the conversation of a packet
+ * @function Conversation.find
+ * @tparam PacketInfo pinfo a packet info
+ * @treturn Conversation|nil the conversation or nil if there is none
+ */
+static int wl_conversation_find(lua_State *L)
+{
+    packet_info *pinfo = luaW_check_pinfo(L, 1);
+    luaW_push_conversation(L, find_conversation_pinfo(pinfo, 0));
+    return 1;
+}
+
+/***
+ * Find the conversation of a packet, creating it if it doesn't exist
+ * @function Conversation.get
+ * @tparam PacketInfo pinfo a packet info
+ * @treturn Conversation the conversation
+ */
+static int wl_conversation_get(lua_State *L)
+{
+    packet_info *pinfo = luaW_check_pinfo(L, 1);
+    luaW_push_conversation(L, find_or_create_conversation(pinfo));
+    return 1;
+}
+
+/***
+ * Get the conversation index
+ * @function id
+ * @treturn int an integer that identifies the conversation in the capture file
+ */
+static int wl_conversation_id(lua_State *L)
+{
+    conversation_t *conv = luaW_check_conversation(L, 1);
+    lua_pushinteger(L, conv->conv_index);
+    return 1;
+}
+
+/***
+ * Get the data attached to the conversation by a protocol
+ * @function get_data
+ * @tparam Protocol proto the protocol
+ * @return the value stored with set_data() or nil
+ */
+static int wl_conversation_get_data(lua_State *L)
+{
+    conversation_t *conv = luaW_check_conversation(L, 1);
+    int proto = luaW_check_protocol(L, 2);
+
+    int ref = (int)(intptr_t)conversation_get_proto_data(conv, proto);
+    if (ref == 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    l_push_conv_data(L);
+    lua_rawgeti(L, -1, ref);
+    return 1;
+}
+
+/***
+ * Attach data to the conversation for a protocol
+ * @function set_data
+ * @tparam Protocol proto the protocol
+ * @param value any Lua value, nil removes the data
+ */
+static int wl_conversation_set_data(lua_State *L)
+{
+    conversation_t *conv = luaW_check_conversation(L, 1);
+    int proto = luaW_check_protocol(L, 2);
+    luaL_checkany(L, 3);
+    lua_settop(L, 3);
+
+    l_push_conv_data(L);
+    int ref = (int)(intptr_t)conversation_get_proto_data(conv, proto);
+    if (ref != 0) {
+        if (!lua_isnil(L, 3)) {
+            lua_pushvalue(L, 3);
+            lua_rawseti(L, 4, ref);
+            return 0;
+        }
+        luaL_unref(L, 4, ref);
+        conversation_delete_proto_data(conv, proto);
+        return 0;
+    }
+    if (lua_isnil(L, 3))
+        return 0;
+    lua_pushvalue(L, 3);
+    ref = luaL_ref(L, 4);
+    conversation_add_proto_data(conv, proto, (void *)(intptr_t)ref);
+    return 0;
+}
+
+/***
+ * Set the dissector for the rest of the conversation
+ * @function set_dissector
+ * @tparam DissectorHandle handle the dissector handle
+ */
+static int wl_conversation_set_dissector(lua_State *L)
+{
+    conversation_t *conv = luaW_check_conversation(L, 1);
+    dissector_handle_t handle = luaW_check_dissector_handle(L, 2);
+    conversation_set_dissector(conv, handle);
+    return 0;
+}
+
+static int wl_conversation_eq(lua_State *L)
+{
+    conversation_t *conv1 = luaW_check_conversation(L, 1);
+    conversation_t *conv2 = luaW_check_conversation(L, 2);
+    lua_pushboolean(L, conv1 == conv2);
+    return 1;
+}
+
+static int wl_conversation_tostring(lua_State *L)
+{
+    conversation_t *conv = luaW_check_conversation(L, 1);
+    lua_pushfstring(L, "Conversation: %d", (int)conv->conv_index);
+    return 1;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_conversation_m[] = {
+    { "id", wl_conversation_id },
+    { "get_data", wl_conversation_get_data },
+    { "set_data", wl_conversation_set_data },
+    { "set_dissector", wl_conversation_set_dissector },
+    { "__eq", wl_conversation_eq },
+    { "__tostring", wl_conversation_tostring },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_conversation_f[] = {
+    { "find", wl_conversation_find },
+    { "get", wl_conversation_get },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_conversation(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.Conversation", wl_conversation_m);
+    luaL_newlib(L, wl_conversation_f);
+    lua_setfield(L, -2, "Conversation");
+}
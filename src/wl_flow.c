@@ -0,0 +1,763 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+/***
+ * @module wireshark
+ */
+
+/*
+ * A bounded flow table with LRU eviction. Entries are kept in a fixed array
+ * and never move, so an entry index (the "slot") stays valid until the flow
+ * is evicted or removed. Lookups go through an open addressing index with
+ * linear probing that is at most half full. Each entry stores a fixed set
+ * of numeric fields inline and optionally a reference to a Lua value.
+ */
+
+#define FLOW_NONE           UINT32_MAX
+#define FLOW_CAPACITY_MAX   (1U << 26)
+#define FLOW_ADDR_MAX       16
+
+/* Addresses longer than FLOW_ADDR_MAX are folded into a prefix and a hash */
+#define FLOW_ADDR_FOLDED    0xff
+
+struct wl_flow_key {
+    int32_t src_type;
+    int32_t dst_type;
+    uint32_t src_port;
+    uint32_t dst_port;
+    uint8_t src[FLOW_ADDR_MAX];
+    uint8_t dst[FLOW_ADDR_MAX];
+    uint8_t src_len;
+    uint8_t dst_len;
+    uint8_t ptype;
+    uint8_t pad;
+};
+
+union wl_flow_value {
+    lua_Integer i;
+    lua_Number n;
+};
+
+struct wl_flow_entry {
+    struct wl_flow_key key;
+    uint32_t hash;
+    uint32_t prev;      /* towards the most recently used */
+    uint32_t next;      /* towards the least recently used */
+    int ref;
+    bool live;
+    union wl_flow_value values[];
+};
+
+struct wl_flow_cell {
+    uint32_t hash;
+    uint32_t entry;
+};
+
+struct wl_flow_table {
+    uint32_t capacity;
+    uint32_t mask;
+    uint32_t count;
+    uint32_t used;      /* entries ever allocated */
+    uint32_t free;      /* list of removed entries */
+    uint32_t head;
+    uint32_t tail;
+    uint32_t nfields;
+    size_t stride;
+    bool bidirectional;
+    struct wl_flow_cell *index;
+    uint8_t *entries;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t evictions;
+};
+
+#define ENTRY(ft, e) ((struct wl_flow_entry *)((ft)->entries + (size_t)(e) * (ft)->stride))
+
+/* Field codes in the uservalue table */
+#define FIELD_NUMBER    1
+#define FIELD_INDEX(c)  ((c) >> 1)
+
+static struct wl_flow_table *luaW_check_flow_table(lua_State *L, int arg)
+{
+    struct wl_flow_table *ptr = luaL_checkudata(L, arg, "wslua.FlowTable");
+    return ptr;
+}
+
+static void l_flow_key_addr(uint8_t *dst, uint8_t *dst_len, const address *addr)
+{
+    if (addr->len <= FLOW_ADDR_MAX) {
+        if (addr->len > 0)
+            memcpy(dst, addr->data, addr->len);
+        *dst_len = (uint8_t)addr->len;
+    }
+    else {
+        uint64_t h = wl_xxh3_64(addr->data, addr->len, 0);
+        memcpy(dst, addr->data, 8);
+        memcpy(dst + 8, &h, 8);
+        *dst_len = FLOW_ADDR_FOLDED;
+    }
+}
+
+/* Returns the direction, 1 if the endpoints were swapped */
+static int l_flow_key_init(struct wl_flow_key *key, const packet_info *pinfo, bool bidirectional)
+{
+    memset(key, 0, sizeof(*key));
+    key->src_type = pinfo->src.type;
+    key->dst_type = pinfo->dst.type;
+    key->src_port = pinfo->srcport;
+    key->dst_port = pinfo->destport;
+    key->ptype = (uint8_t)pinfo->ptype;
+    l_flow_key_addr(key->src, &key->src_len, &pinfo->src);
+    l_flow_key_addr(key->dst, &key->dst_len, &pinfo->dst);
+
+    if (!bidirectional)
+        return 0;
+
+    int cmp = key->src_type - key->dst_type;
+    if (cmp == 0)
+        cmp = key->src_len - key->dst_len;
+    if (cmp == 0)
+        cmp = memcmp(key->src, key->dst, FLOW_ADDR_MAX);
+    if (cmp == 0)
+        cmp = (key->src_port > key->dst_port) - (key->src_port < key->dst_port);
+    if (cmp <= 0)
+        return 0;
+
+    struct wl_flow_key swapped = *key;
+    key->src_type = swapped.dst_type;
+    key->dst_type = swapped.src_type;
+    key->src_port = swapped.dst_port;
+    key->dst_port = swapped.src_port;
+    memcpy(key->src, swapped.dst, FLOW_ADDR_MAX);
+    memcpy(key->dst, swapped.src, FLOW_ADDR_MAX);
+    key->src_len = swapped.dst_len;
+    key->dst_len = swapped.src_len;
+    return 1;
+}
+
+/* Returns the entry for 'key' or FLOW_NONE, and the index position where
+ * the key is or would be stored */
+static uint32_t l_flow_probe(struct wl_flow_table *ft, const struct wl_flow_key *key,
+                                uint32_t hash, uint32_t *pos)
+{
+    uint32_t i = hash & ft->mask;
+
+    for (;;) {
+        struct wl_flow_cell *cell = &ft->index[i];
+        if (cell->entry == FLOW_NONE)
+            break;
+        if (cell->hash == hash &&
+                memcmp(&ENTRY(ft, cell->entry)->key, key, sizeof(*key)) == 0)
+            break;
+        i = (i + 1) & ft->mask;
+    }
+    *pos = i;
+    return ft->index[i].entry;
+}
+
+/* Removes the index cell of entry 'e', shifting back the following cells */
+static void l_flow_index_remove(struct wl_flow_table *ft, uint32_t e)
+{
+    uint32_t i = ENTRY(ft, e)->hash & ft->mask;
+    uint32_t j, home;
+
+    while (ft->index[i].entry != e)
+        i = (i + 1) & ft->mask;
+
+    j = i;
+    for (;;) {
+        j = (j + 1) & ft->mask;
+        if (ft->index[j].entry == FLOW_NONE)
+            break;
+        home = ft->index[j].hash & ft->mask;
+        /* The cell can move to 'i' if its home is not in (i, j] */
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            ft->index[i] = ft->index[j];
+            i = j;
+        }
+    }
+    ft->index[i].entry = FLOW_NONE;
+}
+
+static void l_flow_unlink(struct wl_flow_table *ft, uint32_t e)
+{
+    struct wl_flow_entry *entry = ENTRY(ft, e);
+
+    if (entry->prev != FLOW_NONE)
+        ENTRY(ft, entry->prev)->next = entry->next;
+    else
+        ft->head = entry->next;
+    if (entry->next != FLOW_NONE)
+        ENTRY(ft, entry->next)->prev = entry->prev;
+    else
+        ft->tail = entry->prev;
+}
+
+static void l_flow_push_front(struct wl_flow_table *ft, uint32_t e)
+{
+    struct wl_flow_entry *entry = ENTRY(ft, e);
+
+    entry->prev = FLOW_NONE;
+    entry->next = ft->head;
+    if (ft->head != FLOW_NONE)
+        ENTRY(ft, ft->head)->prev = e;
+    else
+        ft->tail = e;
+    ft->head = e;
+}
+
+static void l_flow_touch(struct wl_flow_table *ft, uint32_t e)
+{
+    if (ft->head != e) {
+        l_flow_unlink(ft, e);
+        l_flow_push_front(ft, e);
+    }
+}
+
+/* Releases entry 'e'. The FlowTable must be at 'arg'. */
+static void l_flow_release(lua_State *L, int arg, struct wl_flow_table *ft, uint32_t e)
+{
+    struct wl_flow_entry *entry = ENTRY(ft, e);
+
+    l_flow_index_remove(ft, e);
+    l_flow_unlink(ft, e);
+    if (entry->ref != LUA_NOREF) {
+        lua_getiuservalue(L, arg, 1);
+        luaL_unref(L, -1, entry->ref);
+        lua_pop(L, 1);
+        entry->ref = LUA_NOREF;
+    }
+    entry->live = false;
+    ft->count--;
+}
+
+static uint32_t l_flow_check_slot(lua_State *L, struct wl_flow_table *ft, int arg)
+{
+    lua_Integer slot = luaL_checkinteger(L, arg);
+    luaL_argcheck(L, slot >= 0 && slot < ft->used && ENTRY(ft, slot)->live, arg,
+                    "invalid flow slot");
+    return (uint32_t)slot;
+}
+
+/* Returns the value of a field of the FlowTable at 1 */
+static union wl_flow_value *l_flow_check_field(lua_State *L, struct wl_flow_table *ft,
+                                    uint32_t e, int arg, bool *is_number)
+{
+    lua_getiuservalue(L, 1, 1);
+    if (lua_getfield(L, -1, luaL_checkstring(L, arg)) != LUA_TNUMBER)
+        luaL_argerror(L, arg, "unknown field");
+    lua_Integer code = lua_tointeger(L, -1);
+    lua_pop(L, 2);
+    *is_number = code & FIELD_NUMBER;
+    return &ENTRY(ft, e)->values[FIELD_INDEX(code)];
+}
+
+static void l_flow_push_field(lua_State *L, const union wl_flow_value *v, bool is_number)
+{
+    if (is_number)
+        lua_pushnumber(L, v->n);
+    else
+        lua_pushinteger(L, v->i);
+}
+
+/***
+ * Bounded flow table class.
+ * @type FlowTable
+ */
+
+/***
+ * Create a flow table
+ *
+ * The spec table has the fields:
+ *
+ *  - capacity: the maximum number of flows, the least recently used flow
+ *    is evicted to make room for a new one
+ *  - fields: map of field names to "integer" or "number", the numeric
+ *    fields stored for each flow
+ *  - bidirectional: both directions of a flow share an entry (default true)
+ *
+ * @function FlowTable.new
+ * @tparam table spec the table specification
+ * @treturn FlowTable
+ */
+static int wl_flow_table_new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+
+    lua_getfield(L, 1, "capacity");
+    lua_Integer capacity = luaL_checkinteger(L, -1);
+    if (capacity < 1 || capacity > FLOW_CAPACITY_MAX)
+        return luaL_error(L, "FlowTable: capacity must be between 1 and %d", FLOW_CAPACITY_MAX);
+    lua_getfield(L, 1, "bidirectional");
+    bool bidirectional = lua_isnil(L, -1) || lua_toboolean(L, -1);
+    lua_pop(L, 2);
+
+    /* Field name -> code */
+    lua_newtable(L);    /* 2 */
+    uint32_t nfields = 0;
+    if (lua_getfield(L, 1, "fields") == LUA_TTABLE) {
+        lua_pushnil(L);
+        while (lua_next(L, 3) != 0) {
+            luaL_checktype(L, -2, LUA_TSTRING);
+            const char *type = luaL_checkstring(L, -1);
+            lua_Integer code = (lua_Integer)nfields << 1;
+            if (strcmp(type, "number") == 0)
+                code |= FIELD_NUMBER;
+            else if (strcmp(type, "integer") != 0)
+                return luaL_error(L, "FlowTable: field type must be \"integer\" or \"number\"");
+            lua_pop(L, 1);
+            lua_pushvalue(L, -1);
+            lua_pushinteger(L, code);
+            lua_rawset(L, 2);
+            nfields++;
+        }
+    }
+    lua_pop(L, 1);
+
+    struct wl_flow_table *ft = NEWUSERDATA(L, struct wl_flow_table, "wslua.FlowTable");
+    memset(ft, 0, sizeof(*ft));
+    ft->capacity = (uint32_t)capacity;
+    ft->nfields = nfields;
+    ft->stride = sizeof(struct wl_flow_entry) + nfields * sizeof(union wl_flow_value);
+    ft->bidirectional = bidirectional;
+    ft->head = ft->tail = ft->free = FLOW_NONE;
+
+    uint32_t size = 2;
+    while (size < 2 * ft->capacity)
+        size *= 2;
+    ft->mask = size - 1;
+    ft->index = xmalloc(size * sizeof(struct wl_flow_cell));
+    memset(ft->index, 0xff, size * sizeof(struct wl_flow_cell));
+    ft->entries = xmalloc(ft->capacity * ft->stride);
+
+    lua_insert(L, 2);
+    lua_setiuservalue(L, 2, 1);
+    return 1;
+}
+
+/***
+ * Find the flow of a packet
+ * @function find
+ * @tparam PacketInfo pinfo a packet info
+ * @treturn int|nil the slot of the flow, or nil if it is not in the table
+ * @treturn int the direction, 1 if the packet goes from the flow's destination to its source
+ */
+static int wl_flow_table_find(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    packet_info *pinfo = luaW_check_pinfo(L, 2);
+    struct wl_flow_key key;
+    uint32_t pos;
+
+    int dir = l_flow_key_init(&key, pinfo, ft->bidirectional);
+    uint32_t hash = (uint32_t)wl_xxh3_64(&key, sizeof(key), 0);
+    ft->lookups++;
+    uint32_t e = l_flow_probe(ft, &key, hash, &pos);
+    if (e == FLOW_NONE) {
+        lua_pushnil(L);
+        return 1;
+    }
+    ft->hits++;
+    l_flow_touch(ft, e);
+    lua_pushinteger(L, e);
+    lua_pushinteger(L, dir);
+    return 2;
+}
+
+/***
+ * Find the flow of a packet, adding it if it is not in the table
+ *
+ * Adding a flow to a full table evicts the least recently used flow.
+ * @function insert
+ * @tparam PacketInfo pinfo a packet info
+ * @treturn int the slot of the flow
+ * @treturn bool true if the flow was added
+ * @treturn int the direction, 1 if the packet goes from the flow's destination to its source
+ */
+static int wl_flow_table_insert(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    packet_info *pinfo = luaW_check_pinfo(L, 2);
+    struct wl_flow_key key;
+    uint32_t pos;
+
+    int dir = l_flow_key_init(&key, pinfo, ft->bidirectional);
+    uint32_t hash = (uint32_t)wl_xxh3_64(&key, sizeof(key), 0);
+    ft->lookups++;
+    uint32_t e = l_flow_probe(ft, &key, hash, &pos);
+    if (e != FLOW_NONE) {
+        ft->hits++;
+        l_flow_touch(ft, e);
+        lua_pushinteger(L, e);
+        lua_pushboolean(L, false);
+        lua_pushinteger(L, dir);
+        return 3;
+    }
+
+    if (ft->free != FLOW_NONE) {
+        e = ft->free;
+        ft->free = ENTRY(ft, e)->next;
+    }
+    else if (ft->used < ft->capacity) {
+        e = ft->used++;
+    }
+    else {
+        e = ft->tail;
+        l_flow_release(L, 1, ft, e);
+        ft->evictions++;
+        /* The index may have shifted */
+        l_flow_probe(ft, &key, hash, &pos);
+    }
+
+    struct wl_flow_entry *entry = ENTRY(ft, e);
+    entry->key = key;
+    entry->hash = hash;
+    entry->ref = LUA_NOREF;
+    entry->live = true;
+    memset(entry->values, 0, ft->nfields * sizeof(union wl_flow_value));
+    ft->index[pos].hash = hash;
+    ft->index[pos].entry = e;
+    l_flow_push_front(ft, e);
+    ft->count++;
+    ft->inserts++;
+
+    lua_pushinteger(L, e);
+    lua_pushboolean(L, true);
+    lua_pushinteger(L, dir);
+    return 3;
+}
+
+/***
+ * Remove a flow
+ * @function remove
+ * @int slot the slot of the flow
+ */
+static int wl_flow_table_remove(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e = l_flow_check_slot(L, ft, 2);
+
+    l_flow_release(L, 1, ft, e);
+    ENTRY(ft, e)->next = ft->free;
+    ft->free = e;
+    return 0;
+}
+
+/***
+ * Get a numeric field of a flow
+ * @function get
+ * @int slot the slot of the flow
+ * @string field the field name
+ * @treturn number the value
+ */
+static int wl_flow_table_get(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e = l_flow_check_slot(L, ft, 2);
+    bool is_number;
+
+    union wl_flow_value *v = l_flow_check_field(L, ft, e, 3, &is_number);
+    l_flow_push_field(L, v, is_number);
+    return 1;
+}
+
+/***
+ * Set a numeric field of a flow
+ * @function set
+ * @int slot the slot of the flow
+ * @string field the field name
+ * @number value the value
+ */
+static int wl_flow_table_set(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e = l_flow_check_slot(L, ft, 2);
+    bool is_number;
+
+    union wl_flow_value *v = l_flow_check_field(L, ft, e, 3, &is_number);
+    if (is_number)
+        v->n = luaL_checknumber(L, 4);
+    else
+        v->i = luaL_checkinteger(L, 4);
+    return 0;
+}
+
+/***
+ * Add to numeric fields of a flow
+ * @function add
+ * @int slot the slot of the flow
+ * @string field the field name
+ * @number delta the value to add
+ * @param ... more field names and values
+ * @treturn number the new value of the first field
+ */
+static int wl_flow_table_add(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e = l_flow_check_slot(L, ft, 2);
+    int top = lua_gettop(L);
+    union wl_flow_value *first = NULL;
+    bool first_is_number = false;
+    bool is_number;
+
+    for (int arg = 3; arg <= top || arg == 3; arg += 2) {
+        union wl_flow_value *v = l_flow_check_field(L, ft, e, arg, &is_number);
+        if (is_number)
+            v->n += luaL_checknumber(L, arg + 1);
+        else
+            v->i += luaL_checkinteger(L, arg + 1);
+        if (first == NULL) {
+            first = v;
+            first_is_number = is_number;
+        }
+    }
+    l_flow_push_field(L, first, first_is_number);
+    return 1;
+}
+
+/***
+ * Get the Lua value stored with a flow
+ * @function get_value
+ * @int slot the slot of the flow
+ * @return the value or nil
+ */
+static int wl_flow_table_get_value(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e = l_flow_check_slot(L, ft, 2);
+    struct wl_flow_entry *entry = ENTRY(ft, e);
+
+    if (entry->ref == LUA_NOREF) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_getiuservalue(L, 1, 1);
+    lua_rawgeti(L, -1, entry->ref);
+    return 1;
+}
+
+/***
+ * Store a Lua value with a flow
+ *
+ * The value is released when the flow is evicted or removed.
+ * @function set_value
+ * @int slot the slot of the flow
+ * @param value any Lua value, nil removes the value
+ */
+static int wl_flow_table_set_value(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e = l_flow_check_slot(L, ft, 2);
+    struct wl_flow_entry *entry = ENTRY(ft, e);
+    luaL_checkany(L, 3);
+    lua_settop(L, 3);
+
+    lua_getiuservalue(L, 1, 1);
+    if (entry->ref != LUA_NOREF) {
+        if (!lua_isnil(L, 3)) {
+            lua_pushvalue(L, 3);
+            lua_rawseti(L, 4, entry->ref);
+            return 0;
+        }
+        luaL_unref(L, 4, entry->ref);
+        entry->ref = LUA_NOREF;
+        return 0;
+    }
+    if (!lua_isnil(L, 3)) {
+        lua_pushvalue(L, 3);
+        entry->ref = luaL_ref(L, 4);
+    }
+    return 0;
+}
+
+static void l_flow_push_addr(lua_State *L, int type, const uint8_t *data, uint8_t len)
+{
+    address addr;
+
+    if (len == FLOW_ADDR_FOLDED) {
+        lua_pushnil(L);
+        return;
+    }
+    set_address(&addr, type, len, data);
+    luaW_push_addr(L, &addr);
+}
+
+/***
+ * Get the key of a flow
+ *
+ * Addresses longer than 16 bytes are not stored and are returned as nil.
+ * @function key
+ * @int slot the slot of the flow
+ * @treturn Address the source address
+ * @treturn Address the destination address
+ * @treturn int the source port
+ * @treturn int the destination port
+ * @treturn int the port type
+ */
+static int wl_flow_table_key(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e = l_flow_check_slot(L, ft, 2);
+    const struct wl_flow_key *key = &ENTRY(ft, e)->key;
+
+    l_flow_push_addr(L, key->src_type, key->src, key->src_len);
+    l_flow_push_addr(L, key->dst_type, key->dst, key->dst_len);
+    lua_pushinteger(L, key->src_port);
+    lua_pushinteger(L, key->dst_port);
+    lua_pushinteger(L, key->ptype);
+    return 5;
+}
+
+static int l_flow_table_next(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    uint32_t e;
+
+    if (lua_isnil(L, 2))
+        e = ft->head;
+    else
+        e = ENTRY(ft, l_flow_check_slot(L, ft, 2))->next;
+    if (e == FLOW_NONE)
+        lua_pushnil(L);
+    else
+        lua_pushinteger(L, e);
+    return 1;
+}
+
+/***
+ * Iterate over the flows, most recently used first
+ *
+ * The table must not be modified during the iteration.
+ * @function flows
+ * @return an iterator returning the slot of each flow
+ */
+static int wl_flow_table_flows(lua_State *L)
+{
+    luaW_check_flow_table(L, 1);
+    lua_pushcfunction(L, l_flow_table_next);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+/***
+ * Remove all flows
+ * @function clear
+ */
+static int wl_flow_table_clear(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+
+    memset(ft->index, 0xff, ((size_t)ft->mask + 1) * sizeof(struct wl_flow_cell));
+    ft->count = ft->used = 0;
+    ft->head = ft->tail = ft->free = FLOW_NONE;
+
+    /* Drop the Lua values, keep the field codes */
+    lua_getiuservalue(L, 1, 1);
+    lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, i);
+    }
+    return 0;
+}
+
+/***
+ * Get the table statistics
+ * @function stats
+ * @treturn table the fields count, capacity, slots (index size),
+ *      occupancy (count / capacity), lookups, hits, inserts and evictions
+ */
+static int wl_flow_table_stats(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, ft->count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, ft->capacity);
+    lua_setfield(L, -2, "capacity");
+    lua_pushinteger(L, (lua_Integer)ft->mask + 1);
+    lua_setfield(L, -2, "slots");
+    lua_pushnumber(L, (lua_Number)ft->count / ft->capacity);
+    lua_setfield(L, -2, "occupancy");
+    lua_pushinteger(L, (lua_Integer)ft->lookups);
+    lua_setfield(L, -2, "lookups");
+    lua_pushinteger(L, (lua_Integer)ft->hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, (lua_Integer)ft->inserts);
+    lua_setfield(L, -2, "inserts");
+    lua_pushinteger(L, (lua_Integer)ft->evictions);
+    lua_setfield(L, -2, "evictions");
+    return 1;
+}
+
+static int wl_flow_table_len(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    lua_pushinteger(L, ft->count);
+    return 1;
+}
+
+static int wl_flow_table_gc(lua_State *L)
+{
+    struct wl_flow_table *ft = luaW_check_flow_table(L, 1);
+    free(ft->index);
+    free(ft->entries);
+    ft->index = NULL;
+    ft->entries = NULL;
+    return 0;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_flow_table_m[] = {
+    { "find", wl_flow_table_find },
+    { "insert", wl_flow_table_insert },
+    { "remove", wl_flow_table_remove },
+    { "get", wl_flow_table_get },
+    { "set", wl_flow_table_set },
+    { "add", wl_flow_table_add },
+    { "get_value", wl_flow_table_get_value },
+    { "set_value", wl_flow_table_set_value },
+    { "key", wl_flow_table_key },
+    { "flows", wl_flow_table_flows },
+    { "clear", wl_flow_table_clear },
+    { "stats", wl_flow_table_stats },
+    { "__len", wl_flow_table_len },
+    { "__gc", wl_flow_table_gc },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_flow_table_f[] = {
+    { "new", wl_flow_table_new },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_flow(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.FlowTable", wl_flow_table_m);
+    luaL_newlib(L, wl_flow_table_f);
+    lua_setfield(L, -2, "FlowTable");
+}
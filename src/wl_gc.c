@@ -0,0 +1,260 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+/*
+ * While any packet is being dissected the collector is stopped, so Lua
+ * never pauses in the middle of a dissector. When the last packet is
+ * done the collector is restarted and, once memory has grown past the
+ * pacing threshold, one bounded unit of work is done: a single
+ * collection in generational mode (minor, or major when Lua decides so)
+ * or a step of 'step_size' KB in incremental mode. The threshold follows
+ * the Lua pacing parameters, so the amount of work is about the same as
+ * with automatic collection, only at other times.
+ *
+ * A packet that allocates a lot must not grow memory without bound while
+ * the collector is stopped: once memory use doubles (by at least
+ * GC_STOPPED_GROWTH) the same bounded unit of work is done at the next
+ * check, after a Lua dissector call or when a per-packet object is pushed.
+ */
+
+enum {
+    GC_MODE_GENERATIONAL,
+    GC_MODE_INCREMENTAL,
+};
+
+static const enum_val_t gc_mode_vals[] = {
+    { "generational", "Generational", GC_MODE_GENERATIONAL },
+    { "incremental", "Incremental", GC_MODE_INCREMENTAL },
+    { NULL, NULL, 0 }
+};
+
+/* Defaults from luaconf.h and lgc.h */
+static struct {
+    int mode;
+    unsigned minor_multiplier;
+    unsigned major_multiplier;
+    unsigned pause;
+    unsigned step_multiplier;
+    bool packet_steps;
+    unsigned step_size;         /* KB of incremental work between packets */
+    bool collect_on_close;
+} gc_prefs = {
+    .mode = GC_MODE_GENERATIONAL,
+    .minor_multiplier = 20,
+    .major_multiplier = 100,
+    .pause = 200,
+    .step_multiplier = 100,
+    .packet_steps = true,
+    .step_size = 64,
+    .collect_on_close = true,
+};
+
+#define GC_MIN_GROWTH   (64 * 1024)
+#define GC_MIN_STEP     4       /* KB, more than the debt Lua keeps when stopped */
+#define GC_STOPPED_GROWTH (4 * 1024 * 1024)
+
+struct wl_gc_pauses {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+
+static struct {
+    unsigned packets;           /* being dissected */
+    size_t next_step;           /* in bytes */
+    size_t ceiling;             /* in bytes, forces a step while stopped */
+    bool stopped;
+    bool cycle_done;
+    bool collect_pending;       /* a capture file was closed */
+    struct wl_gc_pauses steps;
+    struct wl_gc_pauses full;
+} gc_state;
+
+static size_t l_gc_count(lua_State *L)
+{
+    return (size_t)lua_gc(L, LUA_GCCOUNT) * 1024 + (size_t)lua_gc(L, LUA_GCCOUNTB);
+}
+
+static void l_gc_record(struct wl_gc_pauses *p, int64_t start)
+{
+    uint64_t us = (uint64_t)(g_get_monotonic_time() - start);
+    p->count++;
+    p->total_us += us;
+    if (us > p->max_us)
+        p->max_us = us;
+}
+
+static void l_gc_set_next_step(lua_State *L)
+{
+    size_t count = l_gc_count(L);
+    size_t growth;
+
+    if (gc_prefs.mode == GC_MODE_GENERATIONAL)
+        growth = count / 100 * gc_prefs.minor_multiplier;
+    else if (!gc_state.cycle_done)
+        growth = 0;     /* keep stepping until the cycle is done */
+    else
+        growth = count / 100 * (gc_prefs.pause > 100 ? gc_prefs.pause - 100 : 0);
+    if (growth != 0 && growth < GC_MIN_GROWTH)
+        growth = GC_MIN_GROWTH;
+    gc_state.next_step = count + growth;
+}
+
+static void l_gc_set_ceiling(lua_State *L)
+{
+    size_t count = l_gc_count(L);
+    gc_state.ceiling = count + (count > GC_STOPPED_GROWTH ? count : GC_STOPPED_GROWTH);
+}
+
+static void l_gc_step(lua_State *L)
+{
+    /*
+     * The step must add a positive debt: in generational mode Lua only
+     * considers a major collection when the debt is positive.
+     */
+    int kb = gc_prefs.step_size > GC_MIN_STEP ? (int)gc_prefs.step_size : GC_MIN_STEP;
+    int64_t start = g_get_monotonic_time();
+    gc_state.cycle_done = lua_gc(L, LUA_GCSTEP, kb);
+    l_gc_record(&gc_state.steps, start);
+    l_gc_set_next_step(L);
+}
+
+static void l_gc_set_mode(lua_State *L)
+{
+    if (gc_prefs.mode == GC_MODE_GENERATIONAL)
+        lua_gc(L, LUA_GCGEN, (int)gc_prefs.minor_multiplier, (int)gc_prefs.major_multiplier);
+    else
+        lua_gc(L, LUA_GCINC, (int)gc_prefs.pause, (int)gc_prefs.step_multiplier, 0);
+    gc_state.cycle_done = true;
+    l_gc_set_next_step(L);
+}
+
+void luaW_gc_init(lua_State *L)
+{
+    memset(&gc_state, 0, sizeof(gc_state));
+    l_gc_set_mode(L);
+}
+
+void wl_gc_prefs_apply(void)
+{
+    if (g_lua != NULL)
+        l_gc_set_mode(g_lua);
+}
+
+void wl_gc_register_prefs(module_t *module)
+{
+    prefs_register_enum_preference(module, "gc_mode", "Garbage collector mode",
+                "Generational collection does less work for the short-lived "
+                "objects created for each packet",
+                &gc_prefs.mode, gc_mode_vals, false);
+    prefs_register_uint_preference(module, "gc_minor_multiplier", "Minor collection multiplier",
+                "Generational mode: memory growth (in percent) between minor collections",
+                10, &gc_prefs.minor_multiplier);
+    prefs_register_uint_preference(module, "gc_major_multiplier", "Major collection multiplier",
+                "Generational mode: memory growth (in percent) before a major collection",
+                10, &gc_prefs.major_multiplier);
+    prefs_register_uint_preference(module, "gc_pause", "Collector pause",
+                "Incremental mode: memory use (in percent) that starts a new cycle",
+                10, &gc_prefs.pause);
+    prefs_register_uint_preference(module, "gc_step_multiplier", "Collector step multiplier",
+                "Incremental mode: speed of the collector relative to allocation",
+                10, &gc_prefs.step_multiplier);
+    prefs_register_bool_preference(module, "gc_packet_steps", "Collect between packets",
+                "Stop the collector while packets are dissected and do the work between packets",
+                &gc_prefs.packet_steps);
+    prefs_register_uint_preference(module, "gc_step_size", "Step size (KB)",
+                "Incremental mode: collector work done between two packets",
+                10, &gc_prefs.step_size);
+    prefs_register_bool_preference(module, "gc_collect_on_close", "Full collection at file close",
+                "Run a full collection before the first packet after a capture file is closed",
+                &gc_prefs.collect_on_close);
+}
+
+/*
+ * Runs inside the wmem callback of the file scope, where finalizers must
+ * not run: they could use file scope memory that is being freed. The
+ * collection is done before the next packet instead.
+ */
+void luaW_gc_file_closed(lua_State *L _U_)
+{
+    if (gc_prefs.collect_on_close)
+        gc_state.collect_pending = true;
+}
+
+void luaW_gc_packet_begin(lua_State *L)
+{
+    if (gc_state.collect_pending && gc_state.packets == 0) {
+        int64_t start = g_get_monotonic_time();
+        gc_state.collect_pending = false;
+        lua_gc(L, LUA_GCCOLLECT);
+        l_gc_record(&gc_state.full, start);
+        gc_state.cycle_done = true;
+        l_gc_set_next_step(L);
+    }
+    /* Makes sure luaW_gc_file_closed() is called at the end of the file */
+    luaW_file_generation();
+    if (gc_state.packets++ == 0 && gc_prefs.packet_steps) {
+        lua_gc(L, LUA_GCSTOP);
+        gc_state.stopped = true;
+        l_gc_set_ceiling(L);
+    }
+}
+
+void luaW_gc_check(lua_State *L)
+{
+    if (!gc_state.stopped || l_gc_count(L) < gc_state.ceiling)
+        return;
+    l_gc_step(L);
+    l_gc_set_ceiling(L);
+}
+
+void luaW_gc_packet_end(lua_State *L)
+{
+    if (gc_state.packets == 0 || --gc_state.packets != 0 || !gc_state.stopped)
+        return;
+    lua_gc(L, LUA_GCRESTART);
+    gc_state.stopped = false;
+
+    if (l_gc_count(L) < gc_state.next_step)
+        return;
+    l_gc_step(L);
+}
+
+static void l_push_pauses(lua_State *L, const struct wl_gc_pauses *p, const char *name)
+{
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, (lua_Integer)p->count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, (lua_Integer)p->total_us);
+    lua_setfield(L, -2, "total_us");
+    lua_pushinteger(L, (lua_Integer)p->max_us);
+    lua_setfield(L, -2, "max_us");
+    lua_setfield(L, -2, name);
+}
+
+void luaW_gc_push_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 4);
+    lua_pushstring(L, gc_mode_vals[gc_prefs.mode].name);
+    lua_setfield(L, -2, "mode");
+    lua_pushboolean(L, gc_prefs.packet_steps);
+    lua_setfield(L, -2, "packet_steps");
+    l_push_pauses(L, &gc_state.steps, "steps");
+    l_push_pauses(L, &gc_state.full, "full");
+}
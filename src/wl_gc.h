@@ -0,0 +1,47 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_GC_H_
+#define _WL_GC_H_
+
+/*
+ * Garbage collector scheduling. The collector is stopped while packets
+ * are dissected and the work is done between packets.
+ */
+
+/* Sets the collector mode of a new state */
+void luaW_gc_init(lua_State *L);
+
+/* Registers the preferences of the collector */
+void wl_gc_register_prefs(module_t *module);
+
+void wl_gc_prefs_apply(void);
+
+void luaW_gc_packet_begin(lua_State *L);
+
+void luaW_gc_packet_end(lua_State *L);
+
+/* Called when the capture file scope is freed, schedules a full collection */
+void luaW_gc_file_closed(lua_State *L);
+
+/* Does a bounded step if memory grew too much while the collector is stopped */
+void luaW_gc_check(lua_State *L);
+
+/* Pushes a table with the collector statistics */
+void luaW_gc_push_stats(lua_State *L);
+
+#endif
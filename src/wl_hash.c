@@ -0,0 +1,677 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+/***
+ * @module wireshark.hash
+ */
+
+/*
+ * XXH3 64 and 128 bit, scalar implementation of the xxHash 0.8 algorithm
+ * using the default secret. See https://github.com/Cyan4973/xxHash.
+ */
+
+#define PRIME32_1   0x9E3779B1U
+#define PRIME32_2   0x85EBCA77U
+#define PRIME32_3   0xC2B2AE3DU
+#define PRIME64_1   0x9E3779B185EBCA87ULL
+#define PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3   0x165667B19E3779F9ULL
+#define PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define PRIME64_5   0x27D4EB2F165667C5ULL
+#define PRIME_MX1   0x165667919E3779F9ULL
+#define PRIME_MX2   0x9FB21C651E98DF25ULL
+
+#define SECRET_SIZE         192
+#define SECRET_SIZE_MIN     136
+#define STRIPE_LEN          64
+#define SECRET_CONSUME_RATE 8
+#define ACC_NB              (STRIPE_LEN / 8)
+#define MIDSIZE_MAX         240
+#define MIDSIZE_STARTOFFSET 3
+#define MIDSIZE_LASTOFFSET  17
+#define SECRET_LASTACC_START    7
+#define SECRET_MERGEACCS_START  11
+
+static const uint8_t xxh3_secret[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint32_t read_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t read_le64(const uint8_t *p)
+{
+    return (uint64_t)read_le32(p) | (uint64_t)read_le32(p + 4) << 32;
+}
+
+static inline void write_le64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (i * 8));
+}
+
+static inline uint32_t swap32(uint32_t x)
+{
+    return (x << 24) | ((x << 8) & 0x00ff0000) | ((x >> 8) & 0x0000ff00) | (x >> 24);
+}
+
+static inline uint64_t swap64(uint64_t x)
+{
+    return (uint64_t)swap32((uint32_t)x) << 32 | swap32((uint32_t)(x >> 32));
+}
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline struct wl_hash128 mult64to128(uint64_t lhs, uint64_t rhs)
+{
+    struct wl_hash128 r;
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)lhs * rhs;
+    r.low = (uint64_t)product;
+    r.high = (uint64_t)(product >> 64);
+#else
+    uint64_t lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+    uint64_t hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+    uint64_t lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+    uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    r.high = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    r.low = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+    return r;
+}
+
+static inline uint64_t mul128_fold64(uint64_t lhs, uint64_t rhs)
+{
+    struct wl_hash128 product = mult64to128(lhs, rhs);
+    return product.low ^ product.high;
+}
+
+static inline uint64_t xorshift64(uint64_t v, int shift)
+{
+    return v ^ (v >> shift);
+}
+
+static uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t xxh3_avalanche(uint64_t h)
+{
+    h = xorshift64(h, 37);
+    h *= PRIME_MX1;
+    h = xorshift64(h, 32);
+    return h;
+}
+
+static uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    return xorshift64(h, 28);
+}
+
+static inline uint64_t mix16b(const uint8_t *input, const uint8_t *secret, uint64_t seed)
+{
+    uint64_t input_lo = read_le64(input);
+    uint64_t input_hi = read_le64(input + 8);
+    return mul128_fold64(input_lo ^ (read_le64(secret) + seed),
+                            input_hi ^ (read_le64(secret + 8) - seed));
+}
+
+static struct wl_hash128 mix32b(struct wl_hash128 acc, const uint8_t *input_1,
+                                    const uint8_t *input_2, const uint8_t *secret,
+                                    uint64_t seed)
+{
+    acc.low += mix16b(input_1, secret, seed);
+    acc.low ^= read_le64(input_2) + read_le64(input_2 + 8);
+    acc.high += mix16b(input_2, secret + 16, seed);
+    acc.high ^= read_le64(input_1) + read_le64(input_1 + 8);
+    return acc;
+}
+
+/* Long inputs (more than 240 bytes) */
+
+static void accumulate_512(uint64_t *acc, const uint8_t *input, const uint8_t *secret)
+{
+    for (size_t i = 0; i < ACC_NB; i++) {
+        uint64_t data_val = read_le64(input + i * 8);
+        uint64_t data_key = data_val ^ read_le64(secret + i * 8);
+        acc[i ^ 1] += data_val;
+        acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+    }
+}
+
+static void scramble_acc(uint64_t *acc, const uint8_t *secret)
+{
+    for (size_t i = 0; i < ACC_NB; i++) {
+        uint64_t acc64 = xorshift64(acc[i], 47);
+        acc64 ^= read_le64(secret + i * 8);
+        acc[i] = acc64 * PRIME32_1;
+    }
+}
+
+static void hash_long_loop(uint64_t *acc, const uint8_t *input, size_t len, const uint8_t *secret)
+{
+    size_t stripes_per_block = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE;
+    size_t block_len = STRIPE_LEN * stripes_per_block;
+    size_t nb_blocks = (len - 1) / block_len;
+    size_t n, s;
+
+    for (n = 0; n < nb_blocks; n++) {
+        for (s = 0; s < stripes_per_block; s++)
+            accumulate_512(acc, input + n * block_len + s * STRIPE_LEN, secret + s * SECRET_CONSUME_RATE);
+        scramble_acc(acc, secret + SECRET_SIZE - STRIPE_LEN);
+    }
+    size_t nb_stripes = ((len - 1) - block_len * nb_blocks) / STRIPE_LEN;
+    for (s = 0; s < nb_stripes; s++)
+        accumulate_512(acc, input + nb_blocks * block_len + s * STRIPE_LEN, secret + s * SECRET_CONSUME_RATE);
+    /* last stripe */
+    accumulate_512(acc, input + len - STRIPE_LEN, secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START);
+}
+
+static uint64_t merge_accs(const uint64_t *acc, const uint8_t *secret, uint64_t start)
+{
+    uint64_t result = start;
+
+    for (size_t i = 0; i < 4; i++) {
+        result += mul128_fold64(acc[2*i] ^ read_le64(secret + 16*i),
+                                    acc[2*i+1] ^ read_le64(secret + 16*i + 8));
+    }
+    return xxh3_avalanche(result);
+}
+
+static const uint8_t *custom_secret(uint8_t *buf, uint64_t seed)
+{
+    if (seed == 0)
+        return xxh3_secret;
+    for (size_t i = 0; i < SECRET_SIZE / 16; i++) {
+        write_le64(buf + 16*i, read_le64(xxh3_secret + 16*i) + seed);
+        write_le64(buf + 16*i + 8, read_le64(xxh3_secret + 16*i + 8) - seed);
+    }
+    return buf;
+}
+
+#define INIT_ACC { PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, \
+                    PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 }
+
+uint64_t wl_xxh3_64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *input = data;
+    const uint8_t *secret = xxh3_secret;
+    uint64_t acc;
+
+    if (len == 0) {
+        return xxh64_avalanche(seed ^ (read_le64(secret + 56) ^ read_le64(secret + 64)));
+    }
+    if (len <= 3) {
+        uint32_t combined = (uint32_t)input[0] << 16 | (uint32_t)input[len >> 1] << 24 |
+                            (uint32_t)input[len - 1] | (uint32_t)len << 8;
+        uint64_t bitflip = (read_le32(secret) ^ read_le32(secret + 4)) + seed;
+        return xxh64_avalanche((uint64_t)combined ^ bitflip);
+    }
+    if (len <= 8) {
+        seed ^= (uint64_t)swap32((uint32_t)seed) << 32;
+        uint32_t input1 = read_le32(input);
+        uint32_t input2 = read_le32(input + len - 4);
+        uint64_t bitflip = (read_le64(secret + 8) ^ read_le64(secret + 16)) - seed;
+        uint64_t input64 = input2 + ((uint64_t)input1 << 32);
+        return xxh3_rrmxmx(input64 ^ bitflip, len);
+    }
+    if (len <= 16) {
+        uint64_t bitflip1 = (read_le64(secret + 24) ^ read_le64(secret + 32)) + seed;
+        uint64_t bitflip2 = (read_le64(secret + 40) ^ read_le64(secret + 48)) - seed;
+        uint64_t input_lo = read_le64(input) ^ bitflip1;
+        uint64_t input_hi = read_le64(input + len - 8) ^ bitflip2;
+        acc = len + swap64(input_lo) + input_hi + mul128_fold64(input_lo, input_hi);
+        return xxh3_avalanche(acc);
+    }
+    if (len <= 128) {
+        acc = len * PRIME64_1;
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += mix16b(input + 48, secret + 96, seed);
+                    acc += mix16b(input + len - 64, secret + 112, seed);
+                }
+                acc += mix16b(input + 32, secret + 64, seed);
+                acc += mix16b(input + len - 48, secret + 80, seed);
+            }
+            acc += mix16b(input + 16, secret + 32, seed);
+            acc += mix16b(input + len - 32, secret + 48, seed);
+        }
+        acc += mix16b(input, secret, seed);
+        acc += mix16b(input + len - 16, secret + 16, seed);
+        return xxh3_avalanche(acc);
+    }
+    if (len <= MIDSIZE_MAX) {
+        unsigned nb_rounds = (unsigned)len / 16;
+        uint64_t acc_end;
+        unsigned i;
+
+        acc = len * PRIME64_1;
+        for (i = 0; i < 8; i++)
+            acc += mix16b(input + 16*i, secret + 16*i, seed);
+        acc_end = mix16b(input + len - 16, secret + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET, seed);
+        acc = xxh3_avalanche(acc);
+        for (i = 8; i < nb_rounds; i++)
+            acc_end += mix16b(input + 16*i, secret + 16*(i-8) + MIDSIZE_STARTOFFSET, seed);
+        return xxh3_avalanche(acc + acc_end);
+    }
+
+    uint8_t buf[SECRET_SIZE];
+    uint64_t accs[ACC_NB] = INIT_ACC;
+    secret = custom_secret(buf, seed);
+    hash_long_loop(accs, input, len, secret);
+    return merge_accs(accs, secret + SECRET_MERGEACCS_START, (uint64_t)len * PRIME64_1);
+}
+
+struct wl_hash128 wl_xxh3_128(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *input = data;
+    const uint8_t *secret = xxh3_secret;
+    struct wl_hash128 h, acc;
+
+    if (len == 0) {
+        h.low = xxh64_avalanche(seed ^ read_le64(secret + 64) ^ read_le64(secret + 72));
+        h.high = xxh64_avalanche(seed ^ read_le64(secret + 80) ^ read_le64(secret + 88));
+        return h;
+    }
+    if (len <= 3) {
+        uint32_t combinedl = (uint32_t)input[0] << 16 | (uint32_t)input[len >> 1] << 24 |
+                            (uint32_t)input[len - 1] | (uint32_t)len << 8;
+        uint32_t combinedh = rotl32(swap32(combinedl), 13);
+        uint64_t bitflipl = (read_le32(secret) ^ read_le32(secret + 4)) + seed;
+        uint64_t bitfliph = (read_le32(secret + 8) ^ read_le32(secret + 12)) - seed;
+        h.low = xxh64_avalanche((uint64_t)combinedl ^ bitflipl);
+        h.high = xxh64_avalanche((uint64_t)combinedh ^ bitfliph);
+        return h;
+    }
+    if (len <= 8) {
+        seed ^= (uint64_t)swap32((uint32_t)seed) << 32;
+        uint32_t input_lo = read_le32(input);
+        uint32_t input_hi = read_le32(input + len - 4);
+        uint64_t input_64 = input_lo + ((uint64_t)input_hi << 32);
+        uint64_t bitflip = (read_le64(secret + 16) ^ read_le64(secret + 24)) + seed;
+        h = mult64to128(input_64 ^ bitflip, PRIME64_1 + (len << 2));
+        h.high += h.low << 1;
+        h.low ^= h.high >> 3;
+        h.low = xorshift64(h.low, 35);
+        h.low *= PRIME_MX2;
+        h.low = xorshift64(h.low, 28);
+        h.high = xxh3_avalanche(h.high);
+        return h;
+    }
+    if (len <= 16) {
+        uint64_t bitflipl = (read_le64(secret + 32) ^ read_le64(secret + 40)) - seed;
+        uint64_t bitfliph = (read_le64(secret + 48) ^ read_le64(secret + 56)) + seed;
+        uint64_t input_lo = read_le64(input);
+        uint64_t input_hi = read_le64(input + len - 8);
+        struct wl_hash128 m = mult64to128(input_lo ^ input_hi ^ bitflipl, PRIME64_1);
+        m.low += (uint64_t)(len - 1) << 54;
+        input_hi ^= bitfliph;
+        m.high += input_hi + (input_hi & 0xFFFFFFFF) * (PRIME32_2 - 1);
+        m.low ^= swap64(m.high);
+        h = mult64to128(m.low, PRIME64_2);
+        h.high += m.high * PRIME64_2;
+        h.low = xxh3_avalanche(h.low);
+        h.high = xxh3_avalanche(h.high);
+        return h;
+    }
+    if (len <= MIDSIZE_MAX) {
+        acc.low = len * PRIME64_1;
+        acc.high = 0;
+        if (len <= 128) {
+            if (len > 32) {
+                if (len > 64) {
+                    if (len > 96)
+                        acc = mix32b(acc, input + 48, input + len - 64, secret + 96, seed);
+                    acc = mix32b(acc, input + 32, input + len - 48, secret + 64, seed);
+                }
+                acc = mix32b(acc, input + 16, input + len - 32, secret + 32, seed);
+            }
+            acc = mix32b(acc, input, input + len - 16, secret, seed);
+        }
+        else {
+            unsigned i;
+            for (i = 32; i < 160; i += 32)
+                acc = mix32b(acc, input + i - 32, input + i - 16, secret + i - 32, seed);
+            acc.low = xxh3_avalanche(acc.low);
+            acc.high = xxh3_avalanche(acc.high);
+            for (i = 160; i <= len; i += 32)
+                acc = mix32b(acc, input + i - 32, input + i - 16,
+                                secret + MIDSIZE_STARTOFFSET + i - 160, seed);
+            acc = mix32b(acc, input + len - 16, input + len - 32,
+                            secret + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET - 16, 0 - seed);
+        }
+        h.low = acc.low + acc.high;
+        h.high = acc.low * PRIME64_1 + acc.high * PRIME64_4 + (len - seed) * PRIME64_2;
+        h.low = xxh3_avalanche(h.low);
+        h.high = 0 - xxh3_avalanche(h.high);
+        return h;
+    }
+
+    uint8_t buf[SECRET_SIZE];
+    uint64_t accs[ACC_NB] = INIT_ACC;
+    secret = custom_secret(buf, seed);
+    hash_long_loop(accs, input, len, secret);
+    h.low = merge_accs(accs, secret + SECRET_MERGEACCS_START, (uint64_t)len * PRIME64_1);
+    h.high = merge_accs(accs, secret + SECRET_SIZE - sizeof(accs) - SECRET_MERGEACCS_START,
+                            ~((uint64_t)len * PRIME64_2));
+    return h;
+}
+
+/*
+ * SipHash-2-4. See https://www.aumasson.jp/siphash/siphash.pdf.
+ */
+
+#define SIPROUND(v0, v1, v2, v3) \
+    do { \
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32); \
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32); \
+    } while (0)
+
+static inline void siphash_compress(struct wl_siphash *s, uint64_t m)
+{
+    s->v3 ^= m;
+    SIPROUND(s->v0, s->v1, s->v2, s->v3);
+    SIPROUND(s->v0, s->v1, s->v2, s->v3);
+    s->v0 ^= m;
+}
+
+void wl_siphash_init(struct wl_siphash *s, const uint8_t key[16])
+{
+    uint64_t k0 = read_le64(key);
+    uint64_t k1 = read_le64(key + 8);
+
+    s->v0 = k0 ^ 0x736f6d6570736575ULL;
+    s->v1 = k1 ^ 0x646f72616e646f6dULL;
+    s->v2 = k0 ^ 0x6c7967656e657261ULL;
+    s->v3 = k1 ^ 0x7465646279746573ULL;
+    s->tail = 0;
+    s->len = 0;
+}
+
+void wl_siphash_update(struct wl_siphash *s, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    unsigned ntail = s->len % 8;
+
+    s->len += len;
+    /* complete a pending word */
+    if (ntail > 0) {
+        while (ntail < 8 && p < end)
+            s->tail |= (uint64_t)*p++ << (8 * ntail++);
+        if (ntail < 8)
+            return;
+        siphash_compress(s, s->tail);
+        s->tail = 0;
+    }
+    for (; end - p >= 8; p += 8)
+        siphash_compress(s, read_le64(p));
+    for (ntail = 0; p < end; ntail++)
+        s->tail |= (uint64_t)*p++ << (8 * ntail);
+}
+
+uint64_t wl_siphash_final(const struct wl_siphash *state)
+{
+    struct wl_siphash s = *state;
+    uint64_t b = (uint64_t)s.len << 56 | s.tail;
+
+    siphash_compress(&s, b);
+    s.v2 ^= 0xff;
+    SIPROUND(s.v0, s.v1, s.v2, s.v3);
+    SIPROUND(s.v0, s.v1, s.v2, s.v3);
+    SIPROUND(s.v0, s.v1, s.v2, s.v3);
+    SIPROUND(s.v0, s.v1, s.v2, s.v3);
+    return s.v0 ^ s.v1 ^ s.v2 ^ s.v3;
+}
+
+/*
+ * Lua bindings. Each argument is a "piece" of the key: a string,
+ * an integer (8 bytes little-endian), a boolean (1 byte), an IPv4, IPv6
+ * or Address object, or a TVBuff followed by an offset and a length.
+ * Addresses are hashed as their address type (4 bytes little-endian)
+ * followed by their bytes, so an IPv4 hashes like the equivalent Address.
+ */
+
+typedef void (*l_hash_piece_cb)(const void *data, size_t len, void *user_data);
+
+static void l_hash_address(l_hash_piece_cb cb, int type, const void *data, size_t len, void *user_data)
+{
+    uint8_t buf[4];
+
+    buf[0] = type & 0xff;
+    buf[1] = (type >> 8) & 0xff;
+    buf[2] = (type >> 16) & 0xff;
+    buf[3] = (type >> 24) & 0xff;
+    cb(buf, sizeof(buf), user_data);
+    cb(data, len, user_data);
+}
+
+static int l_hash_pieces(lua_State *L, int arg, l_hash_piece_cb cb, void *user_data)
+{
+    int top = lua_gettop(L);
+    int count = 0;
+    uint8_t buf[8];
+
+    while (arg <= top) {
+        switch (lua_type(L, arg)) {
+            case LUA_TSTRING: {
+                size_t len;
+                const char *s = lua_tolstring(L, arg, &len);
+                cb(s, len, user_data);
+                break;
+            }
+            case LUA_TNUMBER: {
+                write_le64(buf, (uint64_t)luaL_checkinteger(L, arg));
+                cb(buf, 8, user_data);
+                break;
+            }
+            case LUA_TBOOLEAN: {
+                buf[0] = lua_toboolean(L, arg);
+                cb(buf, 1, user_data);
+                break;
+            }
+            case LUA_TLIGHTUSERDATA:
+            case LUA_TUSERDATA: {
+                void *ptr;
+                if (luaW_test_handle(L, arg, WL_HANDLE_TVBUFF)) {
+                    tvbuff_t *tvb = luaW_check_tvbuff(L, arg);
+                    lua_Integer offset = luaW_check_offset_toint(L, arg + 1);
+                    lua_Integer length = luaL_checkinteger(L, arg + 2);
+                    if (length == -1) {
+                        length = tvb_captured_length_remaining(tvb, offset);
+                    }
+                    else if (length < 0) {
+                        return luaL_error(L, "length must be positive or -1, was %I", length);
+                    }
+                    const uint8_t *data = NULL;
+                    LUAW_TRY(L, data = tvb_get_ptr(tvb, offset, length));
+                    cb(data, length, user_data);
+                    arg += 2;
+                }
+                else if ((ptr = luaL_testudata(L, arg, "wslua.IPv4")) != NULL) {
+                    l_hash_address(cb, AT_IPv4, ptr, sizeof(uint32_t), user_data);
+                }
+                else if ((ptr = luaL_testudata(L, arg, "wslua.IPv6")) != NULL) {
+                    l_hash_address(cb, AT_IPv6, ptr, sizeof(struct e_in6_addr), user_data);
+                }
+                else if ((ptr = luaL_testudata(L, arg, "wslua.Address")) != NULL) {
+                    address *addr = ptr;
+                    l_hash_address(cb, addr->type, addr->data, addr->len, user_data);
+                }
+                else {
+                    return luaL_typeerror(L, arg, "hashable value");
+                }
+                break;
+            }
+            default:
+                return luaL_typeerror(L, arg, "hashable value");
+        }
+        arg++;
+        count++;
+    }
+    return count;
+}
+
+static void l_xxh3_cb(const void *data, size_t len, void *user_data)
+{
+    uint64_t *h = user_data;
+    *h = wl_xxh3_64(data, len, *h);
+}
+
+static void l_xxh3_128_cb(const void *data, size_t len, void *user_data)
+{
+    struct wl_hash128 *h = user_data;
+    struct wl_hash128 r = wl_xxh3_128(data, len, h->low ^ h->high);
+    *h = r;
+}
+
+static void l_siphash_cb(const void *data, size_t len, void *user_data)
+{
+    wl_siphash_update(user_data, data, len);
+}
+
+/***
+ * Compute the 64 bit XXH3 hash of a key.
+ * With a single piece the result is the standard XXH3-64 of its bytes.
+ * Several pieces are chained, each one hashed with the previous result
+ * as seed, so that ws.hash.xxh3(a, b) == ws.hash.xxh3_seed(ws.hash.xxh3(a), b).
+ * @function xxh3
+ * @param ... the key pieces
+ * @treturn int the hash value
+ */
+static int wl_hash_xxh3(lua_State *L)
+{
+    uint64_t h = 0;
+
+    if (l_hash_pieces(L, 1, l_xxh3_cb, &h) == 0)
+        h = wl_xxh3_64(NULL, 0, 0);
+    lua_pushinteger(L, (lua_Integer)h);
+    return 1;
+}
+
+/***
+ * Compute the 64 bit XXH3 hash of a key with an explicit seed.
+ * Useful to combine a stored hash with further pieces.
+ * @function xxh3_seed
+ * @int seed the seed
+ * @param ... the key pieces
+ * @treturn int the hash value
+ */
+static int wl_hash_xxh3_seed(lua_State *L)
+{
+    uint64_t h = (uint64_t)luaL_checkinteger(L, 1);
+
+    if (l_hash_pieces(L, 2, l_xxh3_cb, &h) == 0)
+        h = wl_xxh3_64(NULL, 0, h);
+    lua_pushinteger(L, (lua_Integer)h);
+    return 1;
+}
+
+/***
+ * Compute the 128 bit XXH3 hash of a key.
+ * Several pieces are chained as for xxh3(), using the xor of both
+ * halves of the previous result as seed.
+ * @function xxh3_128
+ * @param ... the key pieces
+ * @treturn int the low 64 bits
+ * @treturn int the high 64 bits
+ */
+static int wl_hash_xxh3_128(lua_State *L)
+{
+    struct wl_hash128 h = { 0, 0 };
+
+    if (l_hash_pieces(L, 1, l_xxh3_128_cb, &h) == 0)
+        h = wl_xxh3_128(NULL, 0, 0);
+    lua_pushinteger(L, (lua_Integer)h.low);
+    lua_pushinteger(L, (lua_Integer)h.high);
+    return 2;
+}
+
+/***
+ * Compute the SipHash-2-4 of a key. Unlike xxh3() the pieces are
+ * concatenated, so the result depends only on the bytes hashed.
+ * SipHash is keyed and resistant to hash flooding; prefer it for tables
+ * indexed by attacker controlled data.
+ * @function siphash
+ * @string key a 16 byte key
+ * @param ... the key pieces
+ * @treturn int the hash value
+ */
+static int wl_hash_siphash(lua_State *L)
+{
+    struct wl_siphash state;
+    size_t key_len;
+    const char *key = luaL_checklstring(L, 1, &key_len);
+
+    luaL_argcheck(L, key_len == 16, 1, "key must be 16 bytes");
+    wl_siphash_init(&state, (const uint8_t *)key);
+    l_hash_pieces(L, 2, l_siphash_cb, &state);
+    lua_pushinteger(L, (lua_Integer)wl_siphash_final(&state));
+    return 1;
+}
+
+static const struct luaL_Reg wl_hash_f[] = {
+    { "xxh3", wl_hash_xxh3 },
+    { "xxh3_seed", wl_hash_xxh3_seed },
+    { "xxh3_128", wl_hash_xxh3_128 },
+    { "siphash", wl_hash_siphash },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_hash(lua_State *L)
+{
+    luaL_newlib(L, wl_hash_f);
+    lua_setfield(L, -2, "hash");
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_HASH_H_
+#define _WL_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct wl_hash128 {
+    uint64_t low;
+    uint64_t high;
+};
+
+struct wl_siphash {
+    uint64_t v0, v1, v2, v3;
+    uint64_t tail;
+    size_t len;
+};
+
+/* XXH3 (xxHash 0.8) with the default secret. */
+uint64_t wl_xxh3_64(const void *data, size_t len, uint64_t seed);
+
+struct wl_hash128 wl_xxh3_128(const void *data, size_t len, uint64_t seed);
+
+/* SipHash-2-4, incremental. */
+void wl_siphash_init(struct wl_siphash *state, const uint8_t key[16]);
+
+void wl_siphash_update(struct wl_siphash *state, const void *data, size_t len);
+
+uint64_t wl_siphash_final(const struct wl_siphash *state);
+
+void wl_open_hash(lua_State *L);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+/***
+ * @module wireshark.util
+ */
+
+/*
+ * Every block has a header with the id of the module it is charged to,
+ * so a block freed while another module runs (or by the collector) is
+ * still taken off its owner. A reallocated block is charged to the
+ * module that resized it.
+ *
+ * The soft limit can not run the collector from the allocator, so it
+ * only marks a collection as pending; it runs when the module returns.
+ * The hard limits make growing allocations fail. Lua then runs an
+ * emergency collection itself and, if that does not free enough,
+ * raises a memory error in the running dissector. They do not apply to
+ * the core (module 0): its allocations are made from C paths that are
+ * not protected and would abort, but they still count towards the
+ * memory in use.
+ */
+
+/* Keeps the alignment Lua expects of an allocation */
+union wl_memory_header {
+    uint32_t module;
+    lua_Number n;
+    lua_Integer i;
+    void *p;
+    long l;
+};
+
+#define MEMORY_HEADER   sizeof(union wl_memory_header)
+
+struct wl_memory_module {
+    char *name;
+    char *source;           /* chunk name, "@path" */
+    size_t live;
+    size_t peak;
+    size_t hard_limit;      /* 0 for none */
+    uint64_t limit_errors;
+};
+
+struct wl_memory {
+    lua_Alloc alloc;
+    void *ud;
+    struct wl_memory_module *modules;
+    int nmodules;
+    int current;
+    size_t live;
+    size_t peak;
+    size_t soft_limit;
+    size_t hard_limit;
+    size_t gc_threshold;    /* next emergency collection, 0 for none */
+    bool gc_pending;
+    uint64_t emergency_gcs;
+};
+
+static struct wl_memory *l_get_memory(lua_State *L)
+{
+    void *ud;
+    lua_Alloc f = lua_getallocf(L, &ud);
+    return f == wl_memory_alloc ? ud : NULL;
+}
+
+static int l_add_module(struct wl_memory *mem, const char *name, const char *source)
+{
+    mem->modules = xrealloc(mem->modules, (mem->nmodules + 1) * sizeof(struct wl_memory_module));
+    struct wl_memory_module *m = &mem->modules[mem->nmodules];
+    memset(m, 0, sizeof(*m));
+    m->name = xstrdup(name);
+    m->source = source ? xstrdup(source) : NULL;
+    return mem->nmodules++;
+}
+
+struct wl_memory *wl_memory_new(lua_Alloc alloc, void *ud)
+{
+    struct wl_memory *mem = xmalloc(sizeof(struct wl_memory));
+    memset(mem, 0, sizeof(*mem));
+    mem->alloc = alloc;
+    mem->ud = ud;
+    l_add_module(mem, "core", NULL);
+    return mem;
+}
+
+void wl_memory_destroy(struct wl_memory *mem)
+{
+    if (mem == NULL)
+        return;
+    for (int i = 0; i < mem->nmodules; i++) {
+        free(mem->modules[i].name);
+        free(mem->modules[i].source);
+    }
+    free(mem->modules);
+    free(mem);
+}
+
+static bool l_over_limit(struct wl_memory *mem, struct wl_memory_module *m, size_t grow)
+{
+    if (mem->current == 0)
+        return false;
+    if (mem->hard_limit != 0 && mem->live + grow > mem->hard_limit)
+        return true;
+    if (m->hard_limit != 0 && m->live + grow > m->hard_limit)
+        return true;
+    return false;
+}
+
+void *wl_memory_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    struct wl_memory *mem = ud;
+    struct wl_memory_module *cur = &mem->modules[mem->current];
+    union wl_memory_header *hdr = NULL;
+    size_t old = 0;
+
+    if (nsize == 0) {
+        if (ptr != NULL) {
+            hdr = (union wl_memory_header *)ptr - 1;
+            mem->modules[hdr->module].live -= osize;
+            mem->live -= osize;
+            mem->alloc(mem->ud, hdr, osize + MEMORY_HEADER, 0);
+        }
+        return NULL;
+    }
+
+    if (ptr != NULL) {
+        hdr = (union wl_memory_header *)ptr - 1;
+        old = osize;
+        osize += MEMORY_HEADER;
+        struct wl_memory_module *owner = &mem->modules[hdr->module];
+        /*
+         * Growing a block of another module charges all of it. Shrinking
+         * never fails, Lua would raise a memory error, it only moves the
+         * charge to the current module.
+         */
+        if (nsize > old && l_over_limit(mem, cur, owner == cur ? nsize - old : nsize)) {
+            cur->limit_errors++;
+            return NULL;
+        }
+    }
+    else if (l_over_limit(mem, cur, nsize)) {
+        cur->limit_errors++;
+        return NULL;
+    }
+
+    hdr = mem->alloc(mem->ud, hdr, osize, nsize + MEMORY_HEADER);
+    if (hdr == NULL)
+        return NULL;
+    if (ptr != NULL) {
+        mem->modules[hdr->module].live -= old;
+        mem->live -= old;
+    }
+    hdr->module = (uint32_t)mem->current;
+    cur->live += nsize;
+    if (cur->live > cur->peak)
+        cur->peak = cur->live;
+    mem->live += nsize;
+    if (mem->live > mem->peak)
+        mem->peak = mem->live;
+    if (mem->gc_threshold != 0 && mem->live > mem->gc_threshold)
+        mem->gc_pending = true;
+    return hdr + 1;
+}
+
+lua_Alloc luaW_memory_getallocf(lua_State *L, void **ud)
+{
+    struct wl_memory *mem = l_get_memory(L);
+    if (mem == NULL)
+        return lua_getallocf(L, ud);
+    *ud = mem->ud;
+    return mem->alloc;
+}
+
+int luaW_memory_add_module(lua_State *L, const char *name, const char *path)
+{
+    struct wl_memory *mem = l_get_memory(L);
+    if (mem == NULL)
+        return 0;
+
+    const char *source = lua_pushfstring(L, "@%s", path);
+    int id = l_add_module(mem, name, source);
+    lua_pop(L, 1);
+    return id;
+}
+
+int luaW_memory_module_of(lua_State *L, int idx)
+{
+    struct wl_memory *mem = l_get_memory(L);
+    lua_Debug ar;
+
+    if (mem == NULL)
+        return 0;
+    lua_pushvalue(L, idx);
+    if (lua_getinfo(L, ">S", &ar)) {
+        for (int i = 1; i < mem->nmodules; i++) {
+            if (strcmp(mem->modules[i].source, ar.source) == 0)
+                return i;
+        }
+    }
+    return mem->current;
+}
+
+int luaW_memory_enter(lua_State *L, int module)
+{
+    struct wl_memory *mem = l_get_memory(L);
+    if (mem == NULL)
+        return 0;
+    int prev = mem->current;
+    mem->current = module;
+    return prev;
+}
+
+static void l_emergency_gc(lua_State *L, struct wl_memory *mem)
+{
+    mem->gc_pending = false;
+    mem->emergency_gcs++;
+    lua_gc(L, LUA_GCCOLLECT);
+    /* Do not collect on every call while the live data stays above the limit */
+    if (mem->live > mem->soft_limit)
+        mem->gc_threshold = mem->live + mem->live / 4;
+    else
+        mem->gc_threshold = mem->soft_limit;
+}
+
+void luaW_memory_leave(lua_State *L, int prev)
+{
+    struct wl_memory *mem = l_get_memory(L);
+    if (mem == NULL)
+        return;
+    mem->current = prev;
+    if (mem->gc_pending)
+        l_emergency_gc(L, mem);
+}
+
+static size_t l_opt_limit(lua_State *L, int idx, const char *field)
+{
+    lua_getfield(L, idx, field);
+    lua_Number n = luaL_optnumber(L, -1, 0);
+    lua_pop(L, 1);
+    if (n < 0)
+        luaL_error(L, "%s limit must not be negative", field);
+    return n >= (lua_Number)SIZE_MAX ? SIZE_MAX : (size_t)n;
+}
+
+/***
+ * Set memory limits
+ *
+ * The soft limit runs a full garbage collection when the memory used by
+ * Lua goes over it. Above a hard limit allocations of scripts fail and
+ * the dissector that is running raises a memory error; the plugin's own
+ * allocations are not limited. A limit of 0 or nil removes it.
+ * @function set_memory_limits
+ * @tparam table limits a table with the fields:
+ *      soft and hard (limits for the whole Lua state, in bytes) or
+ *      module and hard (the hard limit of the module with that file name)
+ */
+static int wl_set_memory_limits(lua_State *L)
+{
+    struct wl_memory *mem = l_get_memory(L);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    if (mem == NULL)
+        return luaL_error(L, "memory accounting is not enabled");
+
+    size_t hard = l_opt_limit(L, 1, "hard");
+    if (lua_getfield(L, 1, "module") != LUA_TNIL) {
+        const char *name = luaL_checkstring(L, -1);
+        for (int i = 1; i < mem->nmodules; i++) {
+            if (strcmp(mem->modules[i].name, name) == 0) {
+                mem->modules[i].hard_limit = hard;
+                return 0;
+            }
+        }
+        return luaL_error(L, "module \"%s\" not found", name);
+    }
+    mem->soft_limit = l_opt_limit(L, 1, "soft");
+    mem->hard_limit = hard;
+    mem->gc_threshold = mem->soft_limit;
+    return 0;
+}
+
+/***
+ * Get the memory used by Lua
+ * @function memory
+ * @treturn table a table with the fields live and peak (bytes used by
+ *      Lua, without the allocator overhead), soft_limit, hard_limit,
+ *      emergency_gcs, modules, a table indexed by the module file name
+ *      ("core" for the plugin itself) of tables with the fields live,
+ *      peak, hard_limit and limit_errors, and gc, a table with the
+ *      collector mode, packet_steps and the pauses of the steps between
+ *      packets and of the full collections at file close (steps and full,
+ *      tables with the fields count, total_us and max_us)
+ */
+static int wl_memory(lua_State *L)
+{
+    struct wl_memory *mem = l_get_memory(L);
+    if (mem == NULL)
+        return luaL_error(L, "memory accounting is not enabled");
+
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, (lua_Integer)mem->live);
+    lua_setfield(L, -2, "live");
+    lua_pushinteger(L, (lua_Integer)mem->peak);
+    lua_setfield(L, -2, "peak");
+    lua_pushinteger(L, (lua_Integer)mem->soft_limit);
+    lua_setfield(L, -2, "soft_limit");
+    lua_pushinteger(L, (lua_Integer)mem->hard_limit);
+    lua_setfield(L, -2, "hard_limit");
+    lua_pushinteger(L, (lua_Integer)mem->emergency_gcs);
+    lua_setfield(L, -2, "emergency_gcs");
+    lua_createtable(L, 0, mem->nmodules);
+    for (int i = 0; i < mem->nmodules; i++) {
+        struct wl_memory_module *m = &mem->modules[i];
+        lua_createtable(L, 0, 4);
+        lua_pushinteger(L, (lua_Integer)m->live);
+        lua_setfield(L, -2, "live");
+        lua_pushinteger(L, (lua_Integer)m->peak);
+        lua_setfield(L, -2, "peak");
+        lua_pushinteger(L, (lua_Integer)m->hard_limit);
+        lua_setfield(L, -2, "hard_limit");
+        lua_pushinteger(L, (lua_Integer)m->limit_errors);
+        lua_setfield(L, -2, "limit_errors");
+        lua_setfield(L, -2, m->name);
+    }
+    lua_setfield(L, -2, "modules");
+    luaW_gc_push_stats(L);
+    lua_setfield(L, -2, "gc");
+    return 1;
+}
+
+static const struct luaL_Reg wl_memory_f[] = {
+    { "memory", wl_memory },
+    { "set_memory_limits", wl_set_memory_limits },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_memory(lua_State *L)
+{
+    lua_getfield(L, -1, "util");
+    luaL_setfuncs(L, wl_memory_f, 0);
+    lua_pop(L, 1);
+}
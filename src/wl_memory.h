@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_MEMORY_H_
+#define _WL_MEMORY_H_
+
+/*
+ * Memory accounting for the Lua state. wl_memory_alloc() wraps another
+ * lua_Alloc and charges each block to the module that was running when
+ * it was allocated. Module 0 is the plugin core.
+ */
+
+struct wl_memory;
+
+struct wl_memory *wl_memory_new(lua_Alloc alloc, void *ud);
+
+void wl_memory_destroy(struct wl_memory *mem);
+
+/* A lua_Alloc function, 'ud' is the wl_memory */
+void *wl_memory_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+/* Returns the wrapped allocator of the state */
+lua_Alloc luaW_memory_getallocf(lua_State *L, void **ud);
+
+/* Adds a module loaded from 'path' and returns its id */
+int luaW_memory_add_module(lua_State *L, const char *name, const char *path);
+
+/* Returns the module that defines the function at 'idx' or the current module */
+int luaW_memory_module_of(lua_State *L, int idx);
+
+/* Charges allocations to 'module' and returns the previous module */
+int luaW_memory_enter(lua_State *L, int module);
+
+/* Restores the previous module and runs a pending emergency collection */
+void luaW_memory_leave(lua_State *L, int prev);
+
+void wl_open_memory(lua_State *L);
+
+#endif
@@ -0,0 +1,601 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <wsutil/file_util.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/***
+ * @module wireshark.util
+ */
+
+/*
+ * On-disk format of a mapped table, in host byte order:
+ *
+ *   header
+ *   slots[nslots]    open addressing hash table with linear probing
+ *   data             key and value bytes of each entry, back to back
+ *
+ * A slot with key_len 0 is empty. The table is at most half full so
+ * probe sequences stay short.
+ */
+
+#define MMAP_MAGIC          "WSL2MAP"
+#define MMAP_VERSION        1
+#define MMAP_BYTE_ORDER     0x01020304U
+#define MMAP_SEED           0x6d6d61705f746162ULL
+
+struct wl_mmap_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t count;
+    uint64_t nslots;            /* power of 2 */
+    uint64_t slots_offset;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+struct wl_mmap_slot {
+    uint64_t hash;
+    uint64_t offset;            /* relative to the data */
+    uint32_t key_len;
+    uint32_t value_len;
+};
+
+struct wl_mmap_table {
+    const uint8_t *base;
+    size_t size;
+    const struct wl_mmap_slot *slots;
+    const uint8_t *data;
+    uint64_t data_size;
+    uint64_t mask;
+    uint64_t count;
+};
+
+static struct wl_mmap_table *luaW_check_mmap_table(lua_State *L, int arg)
+{
+    struct wl_mmap_table *ptr = luaL_checkudata(L, arg, "wslua.MmapTable");
+    if (ptr->base == NULL)
+        luaL_argerror(L, arg, "table is closed");
+    return ptr;
+}
+
+static void l_mmap_unmap(struct wl_mmap_table *mt)
+{
+    if (mt->base == NULL)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(mt->base);
+#else
+    munmap((void *)mt->base, mt->size);
+#endif
+    mt->base = NULL;
+}
+
+/* Returns NULL and sets errno on failure */
+static const uint8_t *l_mmap_file(const char *path, size_t *size)
+{
+    ws_statb64 st;
+    const uint8_t *base;
+
+    int fd = ws_open(path, O_RDONLY | O_BINARY, 0);
+    if (fd < 0)
+        return NULL;
+    if (ws_fstat64(fd, &st) < 0) {
+        ws_close(fd);
+        return NULL;
+    }
+    if ((uint64_t)st.st_size < sizeof(struct wl_mmap_header) || (uint64_t)st.st_size > SIZE_MAX) {
+        ws_close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+    base = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (mapping)
+        CloseHandle(mapping);
+    if (base == NULL)
+        errno = EACCES;
+#else
+    base = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        base = NULL;
+    }
+#ifdef MADV_RANDOM
+    else {
+        /* Lookups are scattered, read ahead would only evict other pages */
+        madvise((void *)base, *size, MADV_RANDOM);
+    }
+#endif
+#endif
+    int save_errno = errno;
+    ws_close(fd);
+    errno = save_errno;
+    return base;
+}
+
+static bool l_mmap_check_header(const struct wl_mmap_header *hdr, size_t size)
+{
+    if (memcmp(hdr->magic, MMAP_MAGIC, sizeof(hdr->magic)) != 0)
+        return false;
+    if (hdr->version != MMAP_VERSION || hdr->byte_order != MMAP_BYTE_ORDER)
+        return false;
+    if (hdr->nslots == 0 || (hdr->nslots & (hdr->nslots - 1)) != 0 || hdr->count >= hdr->nslots)
+        return false;
+    if (hdr->slots_offset % sizeof(uint64_t) != 0 || hdr->slots_offset > size ||
+            hdr->nslots > (size - hdr->slots_offset) / sizeof(struct wl_mmap_slot))
+        return false;
+    if (hdr->data_offset > size || hdr->data_size > size - hdr->data_offset)
+        return false;
+    return true;
+}
+
+/***
+ * Memory-mapped lookup table class.
+ *
+ * A read-only table of string keys to string values stored in a file
+ * written by @{mmap_table_build}. Opening the table only maps the file;
+ * pages are read on demand and shared with other processes mapping the
+ * same file.
+ * @type MmapTable
+ */
+
+/***
+ * Open a memory-mapped table
+ * @function mmap_table
+ * @string path the path of a file written by @{mmap_table_build}
+ * @treturn MmapTable
+ */
+static int wl_mmap_table_open(lua_State *L)
+{
+    const char *path = luaL_checkstring(L, 1);
+    struct wl_mmap_table *mt = NEWUSERDATA(L, struct wl_mmap_table, "wslua.MmapTable");
+    memset(mt, 0, sizeof(*mt));
+
+    mt->base = l_mmap_file(path, &mt->size);
+    if (mt->base == NULL)
+        return luaL_error(L, "mmap_table: cannot map %s: %s", path, strerror(errno));
+
+    const struct wl_mmap_header *hdr = (const struct wl_mmap_header *)mt->base;
+    if (!l_mmap_check_header(hdr, mt->size)) {
+        l_mmap_unmap(mt);
+        return luaL_error(L, "mmap_table: %s is not a valid table file", path);
+    }
+    mt->slots = (const struct wl_mmap_slot *)(mt->base + hdr->slots_offset);
+    mt->data = mt->base + hdr->data_offset;
+    mt->data_size = hdr->data_size;
+    mt->mask = hdr->nslots - 1;
+    mt->count = hdr->count;
+    return 1;
+}
+
+static const struct wl_mmap_slot *l_mmap_find(const struct wl_mmap_table *mt, const void *key, size_t len)
+{
+    uint64_t hash = wl_xxh3_64(key, len, MMAP_SEED);
+
+    /* A corrupt file may have no empty slot, probe each slot at most once */
+    uint64_t i = hash & mt->mask;
+    for (uint64_t n = 0; n <= mt->mask; n++, i = (i + 1) & mt->mask) {
+        const struct wl_mmap_slot *slot = &mt->slots[i];
+        if (slot->key_len == 0)
+            return NULL;
+        if (slot->hash != hash || slot->key_len != len)
+            continue;
+        /* Guard against corrupt files */
+        if (slot->offset > mt->data_size ||
+                (uint64_t)slot->key_len + slot->value_len > mt->data_size - slot->offset)
+            return NULL;
+        if (memcmp(mt->data + slot->offset, key, len) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+static void l_mmap_push_value(lua_State *L, const struct wl_mmap_table *mt, const struct wl_mmap_slot *slot)
+{
+    if (slot == NULL)
+        lua_pushnil(L);
+    else
+        lua_pushlstring(L, (const char *)mt->data + slot->offset + slot->key_len, slot->value_len);
+}
+
+/***
+ * Look up a key
+ * @function get
+ * @string key the key
+ * @treturn string|nil the value or nil if the key is not in the table
+ */
+static int wl_mmap_table_get(lua_State *L)
+{
+    struct wl_mmap_table *mt = luaW_check_mmap_table(L, 1);
+    size_t len;
+    const char *key = luaL_checklstring(L, 2, &len);
+
+    l_mmap_push_value(L, mt, len ? l_mmap_find(mt, key, len) : NULL);
+    return 1;
+}
+
+/***
+ * Look up a key stored as raw bytes in a TVBuff
+ * @function get_tvb
+ * @tparam TVBuff tvb a TVBuff
+ * @tparam int|Offset offset the offset of the key
+ * @int len the length of the key
+ * @treturn string|nil the value or nil if the key is not in the table
+ */
+static int wl_mmap_table_get_tvb(lua_State *L)
+{
+    struct wl_mmap_table *mt = luaW_check_mmap_table(L, 1);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+    int offset = (int)luaW_check_offset_toint(L, 3);
+    int len = (int)luaL_checkinteger(L, 4);
+    luaL_argcheck(L, len > 0, 4, "length must be positive");
+
+    const uint8_t *key = NULL;
+    LUAW_TRY(L, key = tvb_get_ptr(tvb, offset, len));
+    l_mmap_push_value(L, mt, l_mmap_find(mt, key, len));
+    return 1;
+}
+
+/***
+ * Unmap the table
+ *
+ * The table can not be used after this. Tables are also unmapped when
+ * they are garbage collected.
+ * @function close
+ */
+static int wl_mmap_table_close(lua_State *L)
+{
+    struct wl_mmap_table *mt = luaL_checkudata(L, 1, "wslua.MmapTable");
+    l_mmap_unmap(mt);
+    return 0;
+}
+
+static int wl_mmap_table_len(lua_State *L)
+{
+    struct wl_mmap_table *mt = luaW_check_mmap_table(L, 1);
+    lua_pushinteger(L, (lua_Integer)mt->count);
+    return 1;
+}
+
+/***
+ * @section end
+ */
+
+/*
+ * Builder
+ */
+
+struct wl_mmap_builder {
+    struct wl_mmap_slot *entries;
+    size_t count;
+    size_t alloc;
+    uint8_t *data;
+    size_t data_size;
+    size_t data_alloc;
+    char *field;        /* unquoted field buffer */
+    size_t field_alloc;
+};
+
+static void l_builder_free(struct wl_mmap_builder *b)
+{
+    free(b->entries);
+    free(b->data);
+    free(b->field);
+}
+
+static void l_builder_append(struct wl_mmap_builder *b, const void *ptr, size_t len)
+{
+    if (b->data_size + len > b->data_alloc) {
+        while (b->data_size + len > b->data_alloc)
+            b->data_alloc = b->data_alloc ? b->data_alloc * 2 : 4096;
+        b->data = xrealloc(b->data, b->data_alloc);
+    }
+    memcpy(b->data + b->data_size, ptr, len);
+    b->data_size += len;
+}
+
+/*
+ * Finds field 'n' (0-based) in a CSV line. Fields may be quoted with '"',
+ * with "" for a literal quote. Returns false if the line has fewer fields.
+ */
+static bool l_csv_field(struct wl_mmap_builder *b, const char *line, char sep, unsigned n,
+                        const char **field, size_t *len)
+{
+    const char *p = line;
+
+    for (unsigned i = 0; ; i++) {
+        if (*p == '"') {
+            size_t flen = 0;
+            for (p++; *p != '\0'; p++) {
+                if (*p == '"') {
+                    if (p[1] != '"')
+                        break;
+                    p++;
+                }
+                if (i == n) {
+                    if (flen == b->field_alloc) {
+                        b->field_alloc = b->field_alloc ? b->field_alloc * 2 : 256;
+                        b->field = xrealloc(b->field, b->field_alloc);
+                    }
+                    b->field[flen] = *p;
+                }
+                flen++;
+            }
+            if (*p == '"')
+                p++;
+            if (i == n) {
+                *field = b->field;
+                *len = flen;
+                return true;
+            }
+        }
+        else {
+            const char *end = strchr(p, sep);
+            if (end == NULL)
+                end = p + strlen(p);
+            if (i == n) {
+                *field = p;
+                *len = end - p;
+                return true;
+            }
+            p = end;
+        }
+        if (*p != sep)
+            return false;
+        p++;
+    }
+}
+
+/* Reads a line without the line terminator. Returns NULL at the end of the file. */
+static char *l_read_line(FILE *fp, char **buf, size_t *alloc)
+{
+    size_t len = 0;
+
+    if (*buf == NULL) {
+        *alloc = 1024;
+        *buf = xmalloc(*alloc);
+    }
+    while (fgets(*buf + len, (int)(*alloc - len), fp) != NULL) {
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n')
+            break;
+        if (len + 1 < *alloc)
+            break;
+        *alloc *= 2;
+        *buf = xrealloc(*buf, *alloc);
+    }
+    if (len == 0 && (feof(fp) || ferror(fp)))
+        return NULL;
+    while (len > 0 && ((*buf)[len - 1] == '\n' || (*buf)[len - 1] == '\r'))
+        (*buf)[--len] = '\0';
+    return *buf;
+}
+
+static bool l_write_all(FILE *fp, const void *ptr, size_t len)
+{
+    return fwrite(ptr, 1, len, fp) == len;
+}
+
+/* Returns NULL on success or an error message */
+static const char *l_builder_write(struct wl_mmap_builder *b, const char *path, size_t *count)
+{
+    uint64_t nslots = 16;
+    while (nslots < b->count * 2)
+        nslots *= 2;
+    struct wl_mmap_slot *slots = xmalloc(nslots * sizeof(struct wl_mmap_slot));
+    memset(slots, 0, nslots * sizeof(struct wl_mmap_slot));
+
+    /* Insert in file order so the last duplicate wins */
+    *count = 0;
+    for (size_t n = 0; n < b->count; n++) {
+        const struct wl_mmap_slot *e = &b->entries[n];
+        uint64_t i = e->hash & (nslots - 1);
+        while (slots[i].key_len != 0) {
+            if (slots[i].hash == e->hash && slots[i].key_len == e->key_len &&
+                    memcmp(b->data + slots[i].offset, b->data + e->offset, e->key_len) == 0)
+                break;
+            i = (i + 1) & (nslots - 1);
+        }
+        if (slots[i].key_len == 0)
+            (*count)++;
+        slots[i] = *e;
+    }
+
+    struct wl_mmap_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MMAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = MMAP_VERSION;
+    hdr.byte_order = MMAP_BYTE_ORDER;
+    hdr.count = *count;
+    hdr.nslots = nslots;
+    hdr.slots_offset = sizeof(hdr);
+    hdr.data_offset = hdr.slots_offset + nslots * sizeof(struct wl_mmap_slot);
+    hdr.data_size = b->data_size;
+
+    /*
+     * Write a temporary file next to the table and rename it over the
+     * table. Truncating the table in place would make processes that
+     * have it mapped fault on the pages past the new end.
+     */
+    const char *err = NULL;
+    size_t tmp_size = strlen(path) + sizeof(".XXXXXX");
+    char *tmp_path = xmalloc(tmp_size);
+    snprintf(tmp_path, tmp_size, "%s.XXXXXX", path);
+    FILE *fp = NULL;
+    int fd = g_mkstemp_full(tmp_path, O_BINARY, 0666);
+    if (fd < 0 || (fp = ws_fdopen(fd, "wb")) == NULL) {
+        err = strerror(errno);
+        if (fd >= 0) {
+            ws_close(fd);
+            ws_unlink(tmp_path);
+        }
+    }
+    else {
+        if (!l_write_all(fp, &hdr, sizeof(hdr)) ||
+                !l_write_all(fp, slots, nslots * sizeof(struct wl_mmap_slot)) ||
+                !l_write_all(fp, b->data, b->data_size))
+            err = strerror(errno);
+        if (fclose(fp) != 0 && err == NULL)
+            err = strerror(errno);
+        if (err == NULL && ws_rename(tmp_path, path) != 0)
+            err = strerror(errno);
+        if (err != NULL)
+            ws_unlink(tmp_path);
+    }
+    free(tmp_path);
+    free(slots);
+    return err;
+}
+
+/***
+ * Build a memory-mapped table file from a CSV file
+ *
+ * Fields may be quoted with '"'. Empty lines are skipped. If a key is
+ * repeated the last value is kept. The file is written in the host byte
+ * order and can only be opened on hosts with the same byte order.
+ * @function mmap_table_build
+ * @string csv_path the CSV file
+ * @string path the table file to write
+ * @tparam[opt] table options a table with the fields:
+ *      sep (the field separator, default ","),
+ *      key and value (the 1-based columns, default 1 and 2) and
+ *      header (true to skip the first line, default false)
+ * @treturn int the number of distinct keys
+ */
+static int wl_mmap_table_build(lua_State *L)
+{
+    const char *csv_path = luaL_checkstring(L, 1);
+    const char *path = luaL_checkstring(L, 2);
+    char sep = ',';
+    lua_Integer key_col = 1, value_col = 2;
+    bool header = false;
+
+    if (!lua_isnoneornil(L, 3)) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+        if (lua_getfield(L, 3, "sep") != LUA_TNIL) {
+            size_t len;
+            const char *s = lua_tolstring(L, -1, &len);
+            luaL_argcheck(L, s != NULL && len == 1 && *s != '"', 3, "sep must be a single character");
+            sep = *s;
+        }
+        if (lua_getfield(L, 3, "key") != LUA_TNIL)
+            key_col = luaL_checkinteger(L, -1);
+        if (lua_getfield(L, 3, "value") != LUA_TNIL)
+            value_col = luaL_checkinteger(L, -1);
+        lua_getfield(L, 3, "header");
+        header = lua_toboolean(L, -1);
+        lua_settop(L, 3);
+        luaL_argcheck(L, key_col > 0 && value_col > 0 && key_col != value_col, 3, "invalid columns");
+    }
+
+    FILE *fp = ws_fopen(csv_path, "r");
+    if (fp == NULL)
+        return luaL_error(L, "mmap_table_build: cannot open %s: %s", csv_path, strerror(errno));
+
+    struct wl_mmap_builder b;
+    memset(&b, 0, sizeof(b));
+    char *line = NULL;
+    size_t line_alloc = 0;
+    unsigned lineno = 0;
+    const char *key, *value;
+    size_t key_len, value_len;
+    char err[256] = "";
+
+    while (l_read_line(fp, &line, &line_alloc) != NULL) {
+        lineno++;
+        if (*line == '\0' || (header && lineno == 1))
+            continue;
+
+        if (!l_csv_field(&b, line, sep, (unsigned)key_col - 1, &key, &key_len) || key_len == 0 ||
+                key_len > UINT32_MAX) {
+            snprintf(err, sizeof(err), "%s:%u: missing key", csv_path, lineno);
+            break;
+        }
+        if (b.count == b.alloc) {
+            b.alloc = b.alloc ? b.alloc * 2 : 1024;
+            b.entries = xrealloc(b.entries, b.alloc * sizeof(struct wl_mmap_slot));
+        }
+        struct wl_mmap_slot *e = &b.entries[b.count];
+        e->hash = wl_xxh3_64(key, key_len, MMAP_SEED);
+        e->offset = b.data_size;
+        e->key_len = (uint32_t)key_len;
+        l_builder_append(&b, key, key_len);
+
+        /* The key may be in the field buffer, which is reused for the value */
+        if (!l_csv_field(&b, line, sep, (unsigned)value_col - 1, &value, &value_len) ||
+                value_len > UINT32_MAX) {
+            snprintf(err, sizeof(err), "%s:%u: missing value", csv_path, lineno);
+            break;
+        }
+        e->value_len = (uint32_t)value_len;
+        l_builder_append(&b, value, value_len);
+        b.count++;
+    }
+    if (*err == '\0' && ferror(fp))
+        snprintf(err, sizeof(err), "%s: %s", csv_path, strerror(errno));
+    fclose(fp);
+    free(line);
+
+    size_t count = 0;
+    if (*err == '\0') {
+        const char *write_err = l_builder_write(&b, path, &count);
+        if (write_err != NULL)
+            snprintf(err, sizeof(err), "%s: %s", path, write_err);
+    }
+    l_builder_free(&b);
+    if (*err != '\0')
+        return luaL_error(L, "mmap_table_build: %s", err);
+
+    lua_pushinteger(L, (lua_Integer)count);
+    return 1;
+}
+
+static const struct luaL_Reg wl_mmap_table_m[] = {
+    { "get", wl_mmap_table_get },
+    { "get_tvb", wl_mmap_table_get_tvb },
+    { "close", wl_mmap_table_close },
+    { "__len", wl_mmap_table_len },
+    { "__gc", wl_mmap_table_close },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_mmap_f[] = {
+    { "mmap_table", wl_mmap_table_open },
+    { "mmap_table_build", wl_mmap_table_build },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_mmap(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.MmapTable", wl_mmap_table_m);
+    lua_getfield(L, -1, "util");
+    luaL_setfuncs(L, wl_mmap_f, 0);
+    lua_pop(L, 1);
+}
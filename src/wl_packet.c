@@ -24,8 +24,86 @@
 struct wl_dissector_data {
     lua_State *L;
     int lua_dissector_ref;
+    int module;                 /* charged for the memory used */
+    const char *name;
+    struct {
+        uint64_t calls;
+        uint64_t errors;
+    } stats;
+    struct wl_budget budget;
+    struct wl_breaker breaker;
 };
 
+struct wl_heur_prefilter {
+    unsigned min_length;
+    unsigned magic_offset;
+    unsigned magic_len;
+    uint8_t *magic;             /* pre-masked */
+    uint8_t *mask;
+    struct wl_range ports;      /* range is NULL if unused */
+};
+
+struct wl_heur_dissector {
+    lua_State *L;
+    int lua_dissector_ref;
+    int module;
+    const char *list_name;
+    const char *proto_name;
+    const char *internal_name;
+    struct wl_heur_prefilter prefilter;
+    struct {
+        uint64_t calls;
+        uint64_t rejected;
+        uint64_t accepted;
+        uint64_t errors;
+    } stats;
+    struct wl_budget budget;
+    struct wl_breaker breaker;
+    struct wl_heur_dissector *next;     /* same protocol, other lists */
+};
+
+/* Registry table of DissectorTable objects, keyed by name */
+#define DISSECTOR_TABLES_REGISTRY   "wslua2.dissector_tables"
+
+/* Data of the dissectors registered in Lua, by handle */
+static wmem_map_t *lua_dissectors = NULL;
+
+struct wl_dissector_table *luaW_check_dissector_table(lua_State *L, int arg)
+{
+    struct wl_dissector_table *ptr = luaL_checkudata(L, arg, "wslua.DissectorTable");
+    return ptr;
+}
+
+/*
+ * DissectorTable objects are cached by name, so that looking up a table
+ * for every packet does not copy its name again.
+ */
+void luaW_push_dissector_table(lua_State *L, dissector_table_t table,
+                                heur_dissector_list_t heur_list, const char *name)
+{
+    struct wl_dissector_table *ptr;
+
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, DISSECTOR_TABLES_REGISTRY);
+    if (lua_getfield(L, -1, name) == LUA_TUSERDATA) {
+        ptr = luaW_check_dissector_table(L, -1);
+        /* a table and a heuristic list can share a name */
+        if (table != NULL)
+            ptr->table = table;
+        if (heur_list != NULL)
+            ptr->heur_list = heur_list;
+        lua_remove(L, -2);
+        return;
+    }
+    lua_pop(L, 1);
+    ptr = NEWUSERDATA(L, struct wl_dissector_table, "wslua.DissectorTable");
+    ptr->table = table;
+    ptr->heur_list = heur_list;
+    ptr->name = wmem_strdup(wmem_epan_scope(), name);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -3, name);
+    lua_remove(L, -2);
+}
+
 dissector_handle_t luaW_check_dissector_handle(lua_State *L, int arg)
 {
     dissector_handle_t *ptr = luaL_checkudata(L, arg, "wslua.DissectorHandle");
@@ -38,39 +116,376 @@ void luaW_push_dissector_handle(lua_State *L, dissector_handle_t handle)
     *ptr = handle;
 }
 
+/* Converts the error on top of the stack into a Wireshark exception */
+void luaW_throw_error(lua_State *L, packet_info *pinfo)
+{
+    if (lua_isinteger(L, -1)) {
+        int exc = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        THROW(exc);
+    }
+    else if (lua_isstring(L, -1)) {
+        /* The message must outlive the Lua stack slot */
+        const char *msg = wmem_strdup(pinfo->pool, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        THROW_MESSAGE(DissectorError, msg);
+    }
+    else {
+        lua_pop(L, 1);
+        THROW(DissectorError);
+    }
+    ws_assert_not_reached();
+}
+
+void luaW_save_exception(struct wl_exception *exc, int code, const char *message)
+{
+    exc->code = code;
+    /* The message does not outlive the TRY block */
+    if (message != NULL)
+        snprintf(exc->message, sizeof(exc->message), "%s", message);
+    else
+        exc->message[0] = '\0';
+}
+
+/*
+ * Raises the error for a caught exception: the message of a dissector
+ * error, or the exception code for the others, e.g. bounds errors.
+ */
+void luaW_raise_exception(lua_State *L, const struct wl_exception *exc)
+{
+    if (exc->code == DissectorError && exc->message[0] != '\0')
+        lua_pushstring(L, exc->message);
+    else
+        lua_pushinteger(L, exc->code);
+    lua_error(L);
+}
+
+/*
+ * Calls the Lua dissector function referenced by 'ref' with the arguments
+ * tvb, pinfo, tree and cinfo. Leaves the result or the error on the stack
+ * and returns the lua_pcall() status.
+ */
+int luaW_pcall_dissector_ref(lua_State *L, int ref, tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    luaW_push_tvbuff(L, tvb);
+    luaW_push_pinfo(L, pinfo);
+    luaW_push_proto_tree(L, tree);
+    luaW_push_cinfo(L, pinfo->cinfo);
+    return lua_pcall(L, 4, 1, 0);
+}
+
 static int wslua2_call_dissector(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U_, void *dissector_data)
 {
     lua_State *L;
-    int offset, err, exc;
-    const char *msg;
+    int offset;
 
     struct wl_dissector_data *ldata = dissector_data;
     
+    if (wl_budget_is_disabled(&ldata->budget, pinfo))
+        return 0;
+    if (wl_breaker_is_open(&ldata->breaker, pinfo)) {
+        call_data_dissector(tvb, pinfo, tree);
+        return tvb_captured_length(tvb);
+    }
+
     L = ldata->L;
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ldata->lua_dissector_ref);
-    luaW_push_tvbuff(L, tvb);
-    luaW_push_pinfo(L, pinfo);
-    luaW_push_proto_tree(L, tree);
-    luaW_push_cinfo(L, pinfo->cinfo);
-    err = lua_pcall(L, 4, 1, 0);
-    if (err != LUA_OK) {
-        if (lua_isinteger(L, -1)) {
-            exc = (int)lua_tointeger(L, -1);
-            THROW(exc);
-        }
-        else if (lua_isstring(L, -1)) {
-            msg = lua_tostring(L, -1);
-            THROW_MESSAGE(DissectorError, msg);
-        }
-        else {
-            THROW(DissectorError);
-        }
-        ws_assert_not_reached();
+    ldata->stats.calls++;
+    volatile int status = LUA_OK;
+    int prev = luaW_memory_enter(L, ldata->module);
+    const char *prev_name = luaW_profile_enter(ldata->name);
+    TRY {
+        status = luaW_budget_pcall_dissector(L, ldata->lua_dissector_ref, &ldata->budget,
+                                            ldata->name, tvb, pinfo, tree);
+    }
+    CATCH_ALL {
+        /* Not a Lua error, but a failure of the dissector all the same */
+        ldata->stats.errors++;
+        wl_breaker_record(&ldata->breaker, pinfo, true, ldata->name);
+        RETHROW;
+    }
+    FINALLY {
+        /* Also when an exception escapes the call */
+        luaW_profile_leave(prev_name);
+        luaW_memory_leave(L, prev);
+    }
+    ENDTRY;
+    luaW_gc_check(L);
+    wl_breaker_record(&ldata->breaker, pinfo, status != LUA_OK, ldata->name);
+    if (status != LUA_OK) {
+        ldata->stats.errors++;
+        luaW_throw_error(L, pinfo);
     }
     offset = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
     return offset;
 }
 
+/*
+ * Heuristic dissectors. Wireshark does not pass registration data to
+ * heuristic dissectors, so they are found by the protocol short name and
+ * list name that dissector_try_heuristic() stores in pinfo. The name
+ * pointers are stable, so the lookup is a pointer hash. A protocol can
+ * register only one heuristic per list, and when pinfo has no list name
+ * the protocol must have a single heuristic.
+ */
+static wmem_map_t *heur_dissectors = NULL;
+
+static struct wl_heur_dissector *l_find_heur_dissector(packet_info *pinfo)
+{
+    struct wl_heur_dissector *hd;
+
+    if (heur_dissectors == NULL || pinfo->current_proto == NULL)
+        return NULL;
+    hd = wmem_map_lookup(heur_dissectors, pinfo->current_proto);
+    if (pinfo->heur_list_name == NULL)
+        return hd != NULL && hd->next == NULL ? hd : NULL;
+    while (hd != NULL && strcmp(hd->list_name, pinfo->heur_list_name) != 0)
+        hd = hd->next;
+    return hd;
+}
+
+/* Returns true if the packet may be accepted by the heuristic */
+static bool l_heur_prefilter(const struct wl_heur_prefilter *f, tvbuff_t *tvb, packet_info *pinfo)
+{
+    unsigned len = tvb_captured_length(tvb);
+
+    if (len < f->min_length)
+        return false;
+    if (f->magic_len > 0) {
+        if (len < f->magic_offset || len - f->magic_offset < f->magic_len)
+            return false;
+        const uint8_t *p = tvb_get_ptr(tvb, f->magic_offset, f->magic_len);
+        for (unsigned i = 0; i < f->magic_len; i++) {
+            if ((p[i] & f->mask[i]) != f->magic[i])
+                return false;
+        }
+    }
+    if (f->ports.range != NULL) {
+        if (!wl_range_contains(&f->ports, pinfo->srcport) &&
+                        !wl_range_contains(&f->ports, pinfo->destport))
+            return false;
+    }
+    return true;
+}
+
+static bool wslua2_call_heur_dissector(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U_)
+{
+    struct wl_heur_dissector *hd = l_find_heur_dissector(pinfo);
+    lua_State *L;
+    bool accepted;
+
+    if (hd == NULL || wl_budget_is_disabled(&hd->budget, pinfo) || wl_breaker_is_open(&hd->breaker, pinfo))
+        return false;
+
+    hd->stats.calls++;
+    if (!l_heur_prefilter(&hd->prefilter, tvb, pinfo)) {
+        hd->stats.rejected++;
+        return false;
+    }
+
+    L = hd->L;
+    volatile int status = LUA_OK;
+    int prev = luaW_memory_enter(L, hd->module);
+    const char *prev_name = luaW_profile_enter(hd->internal_name);
+    TRY {
+        status = luaW_budget_pcall_dissector(L, hd->lua_dissector_ref, &hd->budget,
+                                            hd->internal_name, tvb, pinfo, tree);
+    }
+    CATCH_ALL {
+        /* Not a Lua error, but a failure of the dissector all the same */
+        hd->stats.errors++;
+        wl_breaker_record(&hd->breaker, pinfo, true, hd->internal_name);
+        RETHROW;
+    }
+    FINALLY {
+        /* Also when an exception escapes the call */
+        luaW_profile_leave(prev_name);
+        luaW_memory_leave(L, prev);
+    }
+    ENDTRY;
+    luaW_gc_check(L);
+    wl_breaker_record(&hd->breaker, pinfo, status != LUA_OK, hd->internal_name);
+    if (status != LUA_OK) {
+        hd->stats.errors++;
+        luaW_throw_error(L, pinfo);
+    }
+    /* true or a positive length */
+    if (lua_isinteger(L, -1))
+        accepted = lua_tointeger(L, -1) > 0;
+    else
+        accepted = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if (accepted)
+        hd->stats.accepted++;
+    return accepted;
+}
+
+static void l_check_prefilter(lua_State *L, int idx, struct wl_heur_prefilter *f)
+{
+    size_t magic_len, mask_len;
+    const char *magic, *mask;
+
+    memset(f, 0, sizeof(*f));
+    if (lua_isnoneornil(L, idx))
+        return;
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    lua_getfield(L, idx, "min_length");
+    lua_Integer min_length = luaL_optinteger(L, -1, 0);
+    luaL_argcheck(L, min_length >= 0 && min_length <= INT_MAX, idx, "prefilter min_length out of range");
+    f->min_length = (unsigned)min_length;
+    lua_getfield(L, idx, "offset");
+    lua_Integer offset = luaL_optinteger(L, -1, 0);
+    luaL_argcheck(L, offset >= 0 && offset <= INT_MAX, idx, "prefilter offset out of range");
+    f->magic_offset = (unsigned)offset;
+    lua_getfield(L, idx, "magic");
+    magic = luaL_optlstring(L, -1, NULL, &magic_len);
+    lua_getfield(L, idx, "mask");
+    mask = luaL_optlstring(L, -1, NULL, &mask_len);
+    if (magic != NULL && magic_len > 0) {
+        if (mask != NULL && mask_len != magic_len)
+            luaL_error(L, "prefilter mask and magic must have the same length");
+        luaL_argcheck(L, magic_len <= (size_t)(INT_MAX - offset), idx, "prefilter magic out of range");
+        f->magic_len = (unsigned)magic_len;
+        f->magic = wmem_alloc(wmem_epan_scope(), magic_len);
+        f->mask = wmem_alloc(wmem_epan_scope(), magic_len);
+        for (size_t i = 0; i < magic_len; i++) {
+            f->mask[i] = mask ? (uint8_t)mask[i] : 0xff;
+            f->magic[i] = (uint8_t)magic[i] & f->mask[i];
+        }
+        /* the pattern must be captured */
+        if (f->min_length < f->magic_offset + f->magic_len)
+            f->min_length = f->magic_offset + f->magic_len;
+    }
+    lua_pop(L, 4);
+
+    if (lua_getfield(L, idx, "ports") != LUA_TNIL) {
+        range_t *range = luaW_check_range_arg(L, lua_gettop(L), UINT16_MAX);
+        wl_range_init(&f->ports, range);
+    }
+    lua_pop(L, 1);
+}
+
+/***
+ * Register a heuristic dissector
+ *
+ * The optional prefilter is evaluated in C before calling the dissector,
+ * so packets that cannot match never enter Lua. The fields are:
+ *
+ *  - min_length: the minimum captured length
+ *  - magic: bytes that must be present at 'offset' (default 0)
+ *  - mask: bytes and-ed with the packet data before comparing with magic
+ *  - ports: a Range or range string, the source or destination port must be in it
+ *
+ * The dissector returns true or a positive length if it accepts the packet.
+ * A protocol can add only one heuristic dissector to each list.
+ * @function heur_dissector_add
+ * @string list heuristic list name, e.g. "udp"
+ * @func dissector dissector function
+ * @string display_name the name shown to users
+ * @string internal_name a unique short name
+ * @tparam Protocol proto the protocol
+ * @tparam[opt] table prefilter the prefilter
+ * @bool[opt=true] enabled whether the heuristic is enabled by default
+ * @treturn HeurDissector the heuristic dissector
+ */
+static int wl_heur_dissector_add(lua_State *L)
+{
+    const char *list = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    const char *display_name = luaL_checkstring(L, 3);
+    const char *internal_name = luaL_checkstring(L, 4);
+    int proto = luaW_check_protocol(L, 5);
+    bool enabled = lua_isnoneornil(L, 7) || lua_toboolean(L, 7);
+    struct wl_heur_dissector *hd, *prev;
+
+    if (find_heur_dissector_list(list) == NULL)
+        return luaL_argerror(L, 1, "heuristic dissector list not found");
+    if (heur_dissectors == NULL)
+        heur_dissectors = wmem_map_new(wmem_epan_scope(), g_direct_hash, g_direct_equal);
+    const char *proto_name = proto_get_protocol_short_name(find_protocol_by_id(proto));
+    prev = wmem_map_lookup(heur_dissectors, proto_name);
+    for (hd = prev; hd != NULL; hd = hd->next) {
+        if (strcmp(hd->list_name, list) == 0)
+            return luaL_error(L, "protocol %s already has a heuristic dissector on list %s", proto_name, list);
+    }
+
+    hd = wmem_new0(wmem_epan_scope(), struct wl_heur_dissector);
+    l_check_prefilter(L, 6, &hd->prefilter);
+    hd->L = L;
+    hd->list_name = wmem_strdup(wmem_epan_scope(), list);
+    hd->proto_name = proto_name;
+    hd->module = luaW_memory_module_of(L, 2);
+    lua_pushvalue(L, 2);
+    hd->lua_dissector_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    hd->next = prev;
+    wmem_map_insert(heur_dissectors, hd->proto_name, hd);
+
+    hd->internal_name = wmem_strdup(wmem_epan_scope(), internal_name);
+    heur_dissector_add(hd->list_name, wslua2_call_heur_dissector,
+                        wmem_strdup(wmem_epan_scope(), display_name),
+                        hd->internal_name,
+                        proto, enabled ? HEURISTIC_ENABLE : HEURISTIC_DISABLE);
+
+    struct wl_heur_dissector **ptr = NEWUSERDATA(L, struct wl_heur_dissector *, "wslua.HeurDissector");
+    *ptr = hd;
+    return 1;
+}
+
+/***
+ * A heuristic dissector class.
+ * @type HeurDissector
+ */
+
+/***
+ * Get the call counters
+ * @function stats
+ * @treturn table a table with the fields 'calls' (packets offered),
+ * 'rejected' (rejected by the prefilter), 'accepted' (accepted by the
+ * dissector), 'errors', 'timeouts' (calls that ran out of CPU budget),
+ * 'skipped' (packets not offered after repeated errors) and 'disabled'
+ */
+static int wl_heur_dissector_stats(lua_State *L)
+{
+    struct wl_heur_dissector *hd = *(struct wl_heur_dissector **)luaL_checkudata(L, 1, "wslua.HeurDissector");
+
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, (lua_Integer)hd->stats.calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushinteger(L, (lua_Integer)hd->stats.rejected);
+    lua_setfield(L, -2, "rejected");
+    lua_pushinteger(L, (lua_Integer)hd->stats.accepted);
+    lua_setfield(L, -2, "accepted");
+    lua_pushinteger(L, (lua_Integer)hd->stats.errors);
+    lua_setfield(L, -2, "errors");
+    lua_pushinteger(L, (lua_Integer)hd->budget.timeouts);
+    lua_setfield(L, -2, "timeouts");
+    lua_pushinteger(L, (lua_Integer)hd->breaker.skipped);
+    lua_setfield(L, -2, "skipped");
+    lua_pushboolean(L, hd->budget.disabled);
+    lua_setfield(L, -2, "disabled");
+    return 1;
+}
+
+/***
+ * Reset the call counters
+ * @function reset_stats
+ */
+static int wl_heur_dissector_reset_stats(lua_State *L)
+{
+    struct wl_heur_dissector *hd = *(struct wl_heur_dissector **)luaL_checkudata(L, 1, "wslua.HeurDissector");
+    memset(&hd->stats, 0, sizeof(hd->stats));
+    hd->budget.timeouts = 0;
+    hd->breaker.skipped = 0;
+    return 0;
+}
+
+/***
+ * @section end
+ */
+
 /***
  * Register a dissector
  * @function register_dissector
@@ -89,9 +504,17 @@ static int wl_register_dissector(lua_State *L)
 
     struct wl_dissector_data *ldata = wmem_new(wmem_epan_scope(), struct wl_dissector_data);
     ldata->L = L;
+    ldata->module = luaW_memory_module_of(L, 3);
+    ldata->name = wmem_strdup(wmem_epan_scope(), name);
+    memset(&ldata->stats, 0, sizeof(ldata->stats));
+    memset(&ldata->budget, 0, sizeof(ldata->budget));
+    memset(&ldata->breaker, 0, sizeof(ldata->breaker));
     ldata->lua_dissector_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
     handle = register_dissector_with_data(name, wslua2_call_dissector, proto, ldata);
+    if (lua_dissectors == NULL)
+        lua_dissectors = wmem_map_new(wmem_epan_scope(), g_direct_hash, g_direct_equal);
+    wmem_map_insert(lua_dissectors, handle, ldata);
     luaW_push_dissector_handle(L, handle);
     return 1;
 }
@@ -103,22 +526,22 @@ static int wl_register_dissector(lua_State *L)
  * @int value pattern to match
  * @tparam TVBuff tvb tvb to dissect
  * @tparam PacketInfo pinfo a packet info
- * @tparam ProtoTree tree a proto tree
+ * @tparam[opt] ProtoTree tree a proto tree
  * @treturn int length of dissected tvbuff
  */
 static int wl_dissector_try_uint(lua_State *L)
 {
     dissector_table_t dt;
-    int len;
+    int len = 0;
 
     const char *table = luaL_checkstring(L, 1);
     uint32_t val = luaL_checkinteger(L, 2);
     tvbuff_t *tvb = luaW_check_tvbuff(L, 3);
     packet_info *pinfo = luaW_check_pinfo(L, 4);
-    proto_tree *tree = luaW_check_proto_tree(L, 5);
+    proto_tree *tree = luaW_opt_proto_tree(L, 5);
 
     dt = find_dissector_table(table);
-    len = dissector_try_uint(dt, val, tvb, pinfo, tree);
+    LUAW_TRY(L, len = dissector_try_uint(dt, val, tvb, pinfo, tree));
     lua_pushinteger(L, len);
     return 1;
 }
@@ -127,8 +550,8 @@ static int wl_call_data_dissector(lua_State *L)
 {
     tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
     packet_info *pinfo = luaW_check_pinfo(L, 2);
-    proto_tree *tree = luaW_check_proto_tree(L, 3);
-    call_data_dissector(tvb, pinfo, tree);
+    proto_tree *tree = luaW_opt_proto_tree(L, 3);
+    LUAW_TRY(L, call_data_dissector(tvb, pinfo, tree));
     return 0;
 }
 
@@ -149,17 +572,429 @@ static int wl_dissector_add_uint(lua_State *L)
     return 0;
 }
 
+/***
+ * Add a dissector handle to a table for a range of values.
+ * If the range is a range Preference the handle is moved to the new range
+ * whenever the preference changes.
+ * @function dissector_add_uint_range
+ * @string table dissector table name
+ * @tparam Range|Preference|string range the values to match
+ * @tparam DissectorHandle handle dissector handle
+ */
+static int wl_dissector_add_uint_range(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    dissector_handle_t handle = luaW_check_dissector_handle(L, 3);
+
+    if (luaL_testudata(L, 2, "wslua.Preference")) {
+        luaW_pref_dissector_range(L, 2, name, handle, true);
+        return 0;
+    }
+    dissector_add_uint_range(name, luaW_check_range_arg(L, 2, UINT32_MAX), handle);
+    return 0;
+}
+
+/***
+ * Remove a dissector handle from a table for a range of values.
+ * @function dissector_delete_uint_range
+ * @string table dissector table name
+ * @tparam Range|Preference|string range the values to remove
+ * @tparam DissectorHandle handle dissector handle
+ */
+static int wl_dissector_delete_uint_range(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    dissector_handle_t handle = luaW_check_dissector_handle(L, 3);
+
+    if (luaL_testudata(L, 2, "wslua.Preference")) {
+        luaW_pref_dissector_range(L, 2, name, handle, false);
+        return 0;
+    }
+    dissector_delete_uint_range(name, luaW_check_range_arg(L, 2, UINT32_MAX), handle);
+    return 0;
+}
+
+/***
+ * Find a dissector handle by name
+ * @function find_dissector
+ * @string name the dissector name
+ * @treturn DissectorHandle the handle or nil if not found
+ */
+static int wl_find_dissector(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    dissector_handle_t handle = find_dissector(name);
+    if (handle == NULL)
+        return 0;
+    luaW_push_dissector_handle(L, handle);
+    return 1;
+}
+
+/***
+ * Call a dissector
+ * @function call_dissector
+ * @tparam DissectorHandle handle the dissector handle
+ * @tparam TVBuff tvb tvb to dissect
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam[opt] ProtoTree tree a proto tree
+ * @treturn int length of dissected tvbuff
+ */
+static int wl_call_dissector(lua_State *L)
+{
+    dissector_handle_t handle = luaW_check_dissector_handle(L, 1);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+    packet_info *pinfo = luaW_check_pinfo(L, 3);
+    proto_tree *tree = luaW_opt_proto_tree(L, 4);
+    int len = 0;
+
+    LUAW_TRY(L, len = call_dissector(handle, tvb, pinfo, tree));
+    lua_pushinteger(L, len);
+    return 1;
+}
+
+/***
+ * A dissector handle class.
+ * @type DissectorHandle
+ */
+
+/***
+ * Call the dissector
+ * @function call
+ * @tparam TVBuff tvb tvb to dissect
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam[opt] ProtoTree tree a proto tree
+ * @treturn int length of dissected tvbuff
+ */
+
+/***
+ * Get the call counters of a dissector registered in Lua
+ * @function stats
+ * @treturn table a table with the fields 'calls', 'errors', 'timeouts'
+ * (calls that ran out of CPU budget), 'skipped' (packets passed to the
+ * data dissector after repeated errors) and 'disabled', or nil if the
+ * dissector is not a Lua dissector
+ */
+static int wl_dissector_handle_stats(lua_State *L)
+{
+    dissector_handle_t handle = luaW_check_dissector_handle(L, 1);
+    struct wl_dissector_data *ldata;
+
+    if (lua_dissectors == NULL || (ldata = wmem_map_lookup(lua_dissectors, handle)) == NULL)
+        return 0;
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, (lua_Integer)ldata->stats.calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushinteger(L, (lua_Integer)ldata->stats.errors);
+    lua_setfield(L, -2, "errors");
+    lua_pushinteger(L, (lua_Integer)ldata->budget.timeouts);
+    lua_setfield(L, -2, "timeouts");
+    lua_pushinteger(L, (lua_Integer)ldata->breaker.skipped);
+    lua_setfield(L, -2, "skipped");
+    lua_pushboolean(L, ldata->budget.disabled);
+    lua_setfield(L, -2, "disabled");
+    return 1;
+}
+
+static int wl_dissector_handle_eq(lua_State *L)
+{
+    dissector_handle_t h1 = luaW_check_dissector_handle(L, 1);
+    dissector_handle_t h2 = luaW_check_dissector_handle(L, 2);
+    lua_pushboolean(L, h1 == h2);
+    return 1;
+}
+
+static int wl_dissector_handle_tostring(lua_State *L)
+{
+    dissector_handle_t handle = luaW_check_dissector_handle(L, 1);
+    const char *name = dissector_handle_get_dissector_name(handle);
+    lua_pushfstring(L, "DissectorHandle: %s", name ? name : "(anonymous)");
+    return 1;
+}
+
+/***
+ * @section end
+ */
+
+/***
+ * A dissector table class. Look tables up once, at handoff time, and keep
+ * the object: dispatching through it avoids finding the table by name on
+ * every packet.
+ * @type DissectorTable
+ */
+
+static dissector_table_t l_check_table(lua_State *L, struct wl_dissector_table *dt)
+{
+    if (dt->table == NULL)
+        luaL_error(L, "%s is not a dissector table", dt->name);
+    return dt->table;
+}
+
+/***
+ * Get an existing dissector table or heuristic dissector list
+ * @function DissectorTable.get
+ * @string name the table name
+ * @treturn DissectorTable the table or nil if not found
+ */
+static int wl_dissector_table_get(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    dissector_table_t table = find_dissector_table(name);
+    heur_dissector_list_t heur_list = find_heur_dissector_list(name);
+
+    if (table == NULL && heur_list == NULL)
+        return 0;
+    luaW_push_dissector_table(L, table, heur_list, name);
+    return 1;
+}
+
+/***
+ * Register a new dissector table
+ * @function DissectorTable.new
+ * @string name the table name
+ * @string ui_name the name shown to users
+ * @tparam Protocol proto the protocol that owns the table
+ * @int type the key type, ws.FT_UINT8 to ws.FT_UINT32 or ws.FT_STRING
+ * @int[opt] param the display base for integer keys (default ws.BASE_DEC)
+ * or the string case sensitivity (default ws.STRING_CASE_SENSITIVE)
+ * @treturn DissectorTable
+ */
+static int wl_dissector_table_new(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    const char *ui_name = luaL_checkstring(L, 2);
+    int proto = luaW_check_protocol(L, 3);
+    enum ftenum type = (enum ftenum)luaL_checkinteger(L, 4);
+    int param;
+
+    switch (type) {
+        case FT_UINT8:
+        case FT_UINT16:
+        case FT_UINT24:
+        case FT_UINT32:
+            param = (int)luaL_optinteger(L, 5, BASE_DEC);
+            break;
+        case FT_STRING:
+            param = (int)luaL_optinteger(L, 5, STRING_CASE_SENSITIVE);
+            break;
+        default:
+            return luaL_argerror(L, 4, "unsupported table type");
+    }
+    /* Wireshark keeps the name pointers */
+    name = wmem_strdup(wmem_epan_scope(), name);
+    ui_name = wmem_strdup(wmem_epan_scope(), ui_name);
+    dissector_table_t table = register_dissector_table(name, ui_name, proto, type, param);
+    luaW_push_dissector_table(L, table, NULL, name);
+    return 1;
+}
+
+/***
+ * Register a new heuristic dissector list
+ * @function DissectorTable.new_heuristic
+ * @string name the list name
+ * @string ui_name the name shown to users
+ * @tparam Protocol proto the protocol that owns the list
+ * @treturn DissectorTable
+ */
+static int wl_dissector_table_new_heuristic(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    const char *ui_name = luaL_checkstring(L, 2);
+    int proto = luaW_check_protocol(L, 3);
+
+    name = wmem_strdup(wmem_epan_scope(), name);
+    ui_name = wmem_strdup(wmem_epan_scope(), ui_name);
+    heur_dissector_list_t heur_list = register_heur_dissector_list_with_description(name, ui_name, proto);
+    luaW_push_dissector_table(L, NULL, heur_list, name);
+    return 1;
+}
+
+/***
+ * Try to dissect using the dissector registered for an integer value
+ * @function try_uint
+ * @int value pattern to match
+ * @tparam TVBuff tvb tvb to dissect
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam[opt] ProtoTree tree a proto tree
+ * @bool[opt=true] add_proto_name set the protocol column to the dissector protocol
+ * @treturn int length of dissected tvbuff, 0 if no dissector accepted it
+ */
+static int wl_dissector_table_try_uint(lua_State *L)
+{
+    struct wl_dissector_table *dt = luaW_check_dissector_table(L, 1);
+    uint32_t val = (uint32_t)luaL_checkinteger(L, 2);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 3);
+    packet_info *pinfo = luaW_check_pinfo(L, 4);
+    proto_tree *tree = luaW_opt_proto_tree(L, 5);
+    bool add_proto_name = lua_isnoneornil(L, 6) || lua_toboolean(L, 6);
+    dissector_table_t table = l_check_table(L, dt);
+    int len = 0;
+
+    LUAW_TRY(L, len = dissector_try_uint_new(table, val, tvb, pinfo, tree, add_proto_name, NULL));
+    lua_pushinteger(L, len);
+    return 1;
+}
+
+/***
+ * Try to dissect using the dissector registered for a string value
+ * @function try_string
+ * @string value pattern to match
+ * @tparam TVBuff tvb tvb to dissect
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam[opt] ProtoTree tree a proto tree
+ * @treturn int length of dissected tvbuff, 0 if no dissector accepted it
+ */
+static int wl_dissector_table_try_string(lua_State *L)
+{
+    struct wl_dissector_table *dt = luaW_check_dissector_table(L, 1);
+    const char *val = luaL_checkstring(L, 2);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 3);
+    packet_info *pinfo = luaW_check_pinfo(L, 4);
+    proto_tree *tree = luaW_opt_proto_tree(L, 5);
+    dissector_table_t table = l_check_table(L, dt);
+    int len = 0;
+
+    LUAW_TRY(L, len = dissector_try_string(table, val, tvb, pinfo, tree, NULL));
+    lua_pushinteger(L, len);
+    return 1;
+}
+
+/***
+ * Try the heuristic dissectors of the list
+ * @function try_heuristic
+ * @tparam TVBuff tvb tvb to dissect
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam[opt] ProtoTree tree a proto tree
+ * @treturn bool true if a heuristic dissector accepted the packet
+ */
+static int wl_dissector_table_try_heuristic(lua_State *L)
+{
+    struct wl_dissector_table *dt = luaW_check_dissector_table(L, 1);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+    packet_info *pinfo = luaW_check_pinfo(L, 3);
+    proto_tree *tree = luaW_opt_proto_tree(L, 4);
+    heur_dtbl_entry_t *hdtbl_entry;
+    bool accepted = false;
+
+    if (dt->heur_list == NULL)
+        return luaL_error(L, "%s is not a heuristic dissector list", dt->name);
+    LUAW_TRY(L, accepted = dissector_try_heuristic(dt->heur_list, tvb, pinfo, tree, &hdtbl_entry, NULL));
+    lua_pushboolean(L, accepted);
+    return 1;
+}
+
+/***
+ * Get the dissector handle registered for a value
+ * @function get_handle
+ * @param value an integer or string pattern
+ * @treturn DissectorHandle the handle or nil
+ */
+static int wl_dissector_table_get_handle(lua_State *L)
+{
+    struct wl_dissector_table *dt = luaW_check_dissector_table(L, 1);
+    dissector_table_t table = l_check_table(L, dt);
+    dissector_handle_t handle;
+
+    if (lua_type(L, 2) == LUA_TNUMBER)
+        handle = dissector_get_uint_handle(table, (uint32_t)luaL_checkinteger(L, 2));
+    else
+        handle = dissector_get_string_handle(table, luaL_checkstring(L, 2));
+    if (handle == NULL)
+        return 0;
+    luaW_push_dissector_handle(L, handle);
+    return 1;
+}
+
+/***
+ * Add a dissector handle to the table
+ * @function add
+ * @param pattern an integer, string or Range pattern
+ * @tparam DissectorHandle handle dissector handle
+ */
+static int wl_dissector_table_add(lua_State *L)
+{
+    struct wl_dissector_table *dt = luaW_check_dissector_table(L, 1);
+    dissector_handle_t handle = luaW_check_dissector_handle(L, 3);
+
+    l_check_table(L, dt);
+    switch (lua_type(L, 2)) {
+        case LUA_TNUMBER:
+            dissector_add_uint(dt->name, (uint32_t)luaL_checkinteger(L, 2), handle);
+            break;
+        case LUA_TSTRING:
+            dissector_add_string(dt->name, lua_tostring(L, 2), handle);
+            break;
+        default:
+            if (luaL_testudata(L, 2, "wslua.Preference"))
+                luaW_pref_dissector_range(L, 2, dt->name, handle, true);
+            else
+                dissector_add_uint_range(dt->name, luaW_check_range(L, 2)->range, handle);
+            break;
+    }
+    return 0;
+}
+
+static int wl_dissector_table_tostring(lua_State *L)
+{
+    struct wl_dissector_table *dt = luaW_check_dissector_table(L, 1);
+    lua_pushfstring(L, "DissectorTable: %s", dt->name);
+    return 1;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_dissector_handle_m[] = {
+    { "call", wl_call_dissector },
+    { "stats", wl_dissector_handle_stats },
+    { "__eq", wl_dissector_handle_eq },
+    { "__tostring", wl_dissector_handle_tostring },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_dissector_table_m[] = {
+    { "try_uint", wl_dissector_table_try_uint },
+    { "try_string", wl_dissector_table_try_string },
+    { "try_heuristic", wl_dissector_table_try_heuristic },
+    { "get_handle", wl_dissector_table_get_handle },
+    { "add", wl_dissector_table_add },
+    { "__tostring", wl_dissector_table_tostring },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_heur_dissector_m[] = {
+    { "stats", wl_heur_dissector_stats },
+    { "reset_stats", wl_heur_dissector_reset_stats },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_dissector_table_f[] = {
+    { "get", wl_dissector_table_get },
+    { "new", wl_dissector_table_new },
+    { "new_heuristic", wl_dissector_table_new_heuristic },
+    { NULL, NULL }
+};
+
 static const struct luaL_Reg wl_packet_f[] = {
     { "register_dissector", wl_register_dissector },
     { "dissector_add_uint", wl_dissector_add_uint },
+    { "dissector_add_uint_range", wl_dissector_add_uint_range },
+    { "dissector_delete_uint_range", wl_dissector_delete_uint_range },
     { "dissector_try_uint", wl_dissector_try_uint },
     { "call_data_dissector", wl_call_data_dissector },
+    { "find_dissector", wl_find_dissector },
+    { "call_dissector", wl_call_dissector },
+    { "heur_dissector_add", wl_heur_dissector_add },
     { NULL, NULL }
 };
 
 /* Receives module on the stack */
 void wl_open_packet(lua_State *L)
 {
-    luaW_newmetatable(L, "wslua.DissectorHandle", NULL);
+    luaW_newmetatable(L, "wslua.DissectorHandle", wl_dissector_handle_m);
+    luaW_newmetatable(L, "wslua.DissectorTable", wl_dissector_table_m);
+    luaW_newmetatable(L, "wslua.HeurDissector", wl_heur_dissector_m);
     luaL_setfuncs(L, wl_packet_f, 0);
+    luaL_newlib(L, wl_dissector_table_f);
+    lua_setfield(L, -2, "DissectorTable");
 }
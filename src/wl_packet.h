@@ -20,11 +20,55 @@
 
 #include <epan/packet.h>
 
+struct wl_dissector_table {
+    dissector_table_t table;
+    heur_dissector_list_t heur_list;
+    const char *name;
+};
+
+struct wl_dissector_table *luaW_check_dissector_table(lua_State *L, int arg);
+
+void luaW_push_dissector_table(lua_State *L, dissector_table_t table,
+                                heur_dissector_list_t heur_list, const char *name);
 
 dissector_handle_t luaW_check_dissector_handle(lua_State *L, int arg);
 
 void luaW_push_dissector_handle(lua_State *L, dissector_handle_t handle);
 
+void luaW_throw_error(lua_State *L, packet_info *pinfo);
+
+/* A Wireshark exception caught in a Lua binding */
+struct wl_exception {
+    int code;
+    char message[256];
+};
+
+void luaW_save_exception(struct wl_exception *exc, int code, const char *message);
+
+void luaW_raise_exception(lua_State *L, const struct wl_exception *exc);
+
+/*
+ * Runs 'stmt', which may throw a Wireshark exception. The exception must
+ * not unwind the Lua stack, so it is caught and raised again as a Lua
+ * error once the TRY block is closed. luaW_throw_error() turns that error
+ * back into the exception when the Lua dissector returns.
+ */
+#define LUAW_TRY(L, stmt) \
+    do { \
+        struct wl_exception wl_exc_ = { 0 }; \
+        TRY { \
+            stmt; \
+        } \
+        CATCH_ALL { \
+            luaW_save_exception(&wl_exc_, EXCEPT_CODE, GET_MESSAGE); \
+        } \
+        ENDTRY; \
+        if (wl_exc_.code != 0) \
+            luaW_raise_exception(L, &wl_exc_); \
+    } while (0)
+
+int luaW_pcall_dissector_ref(lua_State *L, int ref, tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree);
+
 void wl_open_packet(lua_State *L);
 
 #endif
@@ -29,20 +29,122 @@ packet_info *luaW_check_pinfo(lua_State *L, int arg)
 
 column_info *luaW_check_cinfo(lua_State *L, int arg)
 {
-    column_info **ptr = luaL_checkudata(L, arg, "wslua.ColumnInfo");
-    return *ptr;
+    return luaW_check_handle(L, arg, WL_HANDLE_COLUMN_INFO);
 }
 
+#ifdef HAVE_TEST_API
+/* Weak table of PacketInfo objects of ws.pinfo.new(), by packet_info pointer */
+#define TEST_PINFO "wslua2.test_pinfo"
+#endif
+
 void luaW_push_pinfo(lua_State *L, packet_info *pinfo)
 {
     lua_pushlightuserdata(L, pinfo);
+#ifdef HAVE_TEST_API
+    if (lua_rawget(L, LUA_REGISTRYINDEX) != LUA_TNIL)
+        return;
+    lua_pop(L, 1);
+    lua_getfield(L, LUA_REGISTRYINDEX, TEST_PINFO);
+    lua_rawgetp(L, -1, pinfo);
+    lua_remove(L, -2);
+#else
     lua_rawget(L, LUA_REGISTRYINDEX);
+#endif
 }
 
 void luaW_push_cinfo(lua_State *L, column_info *cinfo)
 {
-    column_info **ptr = NEWUSERDATA(L, column_info *, "wslua.ColumnInfo");
-    *ptr = cinfo;
+    luaW_push_handle(L, WL_HANDLE_COLUMN_INFO, cinfo);
+}
+
+/* Last Address pushed for each pinfo address field */
+#define ADDR_CACHE "wslua2.pinfo_addr"
+
+enum {
+    PINFO_ADDR_SRC = 1,
+    PINFO_ADDR_DST,
+    PINFO_ADDR_NET_SRC,
+    PINFO_ADDR_NET_DST,
+    PINFO_ADDR_DL_SRC,
+    PINFO_ADDR_DL_DST,
+};
+
+/*
+ * Returns the cached Address if it still holds the field's value, so that
+ * repeated reads within a packet return the same object without building
+ * its intern key.
+ */
+static void l_pinfo_push_addr(lua_State *L, const address *addr, int field)
+{
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, ADDR_CACHE);
+    if (lua_rawgeti(L, -1, field) == LUA_TUSERDATA &&
+            addresses_equal(luaW_check_addr(L, -1), addr)) {
+        lua_remove(L, -2);
+        return;
+    }
+    lua_pop(L, 1);
+    luaW_push_addr(L, addr);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, field);
+    lua_remove(L, -2);
+}
+
+/* Free scratch tables. They are cleared but keep their size. */
+#define SCRATCH_POOL "wslua2.scratch"
+
+/* Pushes the scratch table of the PacketInfo at 'arg' */
+static void l_pinfo_push_scratch(lua_State *L, int arg)
+{
+    lua_Integer n = 0;
+
+    if (lua_getiuservalue(L, arg, 1) == LUA_TTABLE)
+        return;
+    lua_pop(L, 1);
+    if (lua_getfield(L, LUA_REGISTRYINDEX, SCRATCH_POOL) == LUA_TTABLE)
+        n = (lua_Integer)lua_rawlen(L, -1);
+    if (n > 0) {
+        lua_rawgeti(L, -1, n);
+        lua_pushnil(L);
+        lua_rawseti(L, -3, n);
+    }
+    else {
+        lua_newtable(L);
+    }
+    lua_remove(L, -2);
+    lua_pushvalue(L, -1);
+    lua_setiuservalue(L, arg, 1);
+}
+
+/*
+ * Returns the scratch table of the PacketInfo at 'arg' to the pool. Setting
+ * the fields to nil leaves the table parts allocated, so the keys of the
+ * next packet are stored without resizing.
+ */
+void luaW_pinfo_release_scratch(lua_State *L, int arg)
+{
+    arg = lua_absindex(L, arg);
+    if (lua_getiuservalue(L, arg, 1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, -4);
+    }
+    if (lua_getfield(L, LUA_REGISTRYINDEX, SCRATCH_POOL) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, SCRATCH_POOL);
+    }
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, (lua_Integer)lua_rawlen(L, -2) + 1);
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_setiuservalue(L, arg, 1);
 }
 
 /***
@@ -81,22 +183,32 @@ static int wl_pinfo_index(lua_State *L)
             lua_pushboolean(L, pinfo->flags.in_gre_pkt);
         else if (strcmp(key, "fragmented") == 0)
             lua_pushboolean(L, pinfo->fragmented);
+        else if (strcmp(key, "scratch") == 0)
+            l_pinfo_push_scratch(L, 1);
+        else if (strcmp(key, "visited") == 0)
+            lua_pushboolean(L, pinfo->fd != NULL && PINFO_FD_VISITED(pinfo));
         else if (strcmp(key, "src_port") == 0)
             lua_pushinteger(L, pinfo->srcport);
         else if (strcmp(key, "dst_port") == 0)
             lua_pushinteger(L, pinfo->destport);
         else if (strcmp(key, "src") == 0)
-            luaW_push_addr(L, &pinfo->src);
+            l_pinfo_push_addr(L, &pinfo->src, PINFO_ADDR_SRC);
         else if (strcmp(key, "dst") == 0)
-            luaW_push_addr(L, &pinfo->dst);
+            l_pinfo_push_addr(L, &pinfo->dst, PINFO_ADDR_DST);
         else if (strcmp(key, "net_src") == 0)
-            luaW_push_addr(L, &pinfo->net_src);
+            l_pinfo_push_addr(L, &pinfo->net_src, PINFO_ADDR_NET_SRC);
         else if (strcmp(key, "net_dst") == 0)
-            luaW_push_addr(L, &pinfo->net_dst);
+            l_pinfo_push_addr(L, &pinfo->net_dst, PINFO_ADDR_NET_DST);
         else if (strcmp(key, "dl_src") == 0)
-            luaW_push_addr(L, &pinfo->dl_src);
+            l_pinfo_push_addr(L, &pinfo->dl_src, PINFO_ADDR_DL_SRC);
         else if (strcmp(key, "dl_dst") == 0)
-            luaW_push_addr(L, &pinfo->dl_dst);
+            l_pinfo_push_addr(L, &pinfo->dl_dst, PINFO_ADDR_DL_DST);
+        else if (strcmp(key, "can_desegment") == 0)
+            lua_pushboolean(L, pinfo->can_desegment);
+        else if (strcmp(key, "desegment_offset") == 0)
+            lua_pushinteger(L, pinfo->desegment_offset);
+        else if (strcmp(key, "desegment_len") == 0)
+            lua_pushinteger(L, pinfo->desegment_len);
         else 
             lua_pushnil(L);
     }
@@ -127,6 +239,14 @@ static int wl_pinfo_newindex(lua_State *L)
         l_pinfo_copy_address(L, pinfo->pool, &pinfo->dl_src, -1);
     else if (strcmp(key, "dl_dst") == 0)
         l_pinfo_copy_address(L, pinfo->pool, &pinfo->dl_dst, -1);
+    else if (strcmp(key, "src_port") == 0)
+        pinfo->srcport = (uint32_t)luaL_checkinteger(L, -1);
+    else if (strcmp(key, "dst_port") == 0)
+        pinfo->destport = (uint32_t)luaL_checkinteger(L, -1);
+    else if (strcmp(key, "desegment_offset") == 0)
+        pinfo->desegment_offset = (int)luaL_checkinteger(L, -1);
+    else if (strcmp(key, "desegment_len") == 0)
+        pinfo->desegment_len = (uint32_t)luaL_checkinteger(L, -1);
     else 
         return luaL_error(L, "wslua.Pinfo does not support setting field %s", key);
 
@@ -189,18 +309,68 @@ static int wl_col_clear_info(lua_State *L)
  * @section end
  */
 
+#ifdef HAVE_TEST_API
+/* A PacketInfo that owns its packet_info, frame data and pool */
+struct wl_test_pinfo {
+    packet_info *ptr; /* must come first, see luaW_check_pinfo() */
+    packet_info pinfo;
+    frame_data fd;
+    wmem_allocator_t *pool;
+};
+
+/***
+ * Create a PacketInfo that is not part of a capture, e.g. to call a
+ * dissector from a test. It has its own frame data, for the functions
+ * that keep state per frame. Only available when the plugin is built with
+ * ENABLE_TEST_API.
+ * @function pinfo.new
+ * @int[opt] number the frame number
+ * @treturn PacketInfo
+ */
 static int wl_pinfo_new(lua_State *L)
 {
-    packet_info *pinfo = wmem_new0(wmem_epan_scope(), packet_info);
-    packet_info **ptr = NEWUSERDATA(L, packet_info *, "wslua.PacketInfo");
-    *ptr = pinfo;
+    lua_Integer num = luaL_optinteger(L, 1, 0);
+    luaL_argcheck(L, num >= 0 && num <= UINT32_MAX, 1, "frame number out of range");
+
+    struct wl_test_pinfo *tp = NEWUSERDATA(L, struct wl_test_pinfo, "wslua.PacketInfo");
+    memset(tp, 0, sizeof(*tp));
+    tp->ptr = &tp->pinfo;
+    tp->pool = wmem_allocator_new(WMEM_ALLOCATOR_BLOCK);
+    tp->pinfo.pool = tp->pool;
+    tp->pinfo.layers = wmem_list_new(tp->pool);
+    wtap_rec rec;
+    memset(&rec, 0, sizeof(rec));
+    frame_data_init(&tp->fd, (uint32_t)num, &rec, 0, 0);
+    tp->pinfo.fd = &tp->fd;
+    tp->pinfo.num = (uint32_t)num;
+
+    /* Dissectors called with it receive this object, see luaW_push_pinfo() */
+    lua_getfield(L, LUA_REGISTRYINDEX, TEST_PINFO);
+    lua_pushvalue(L, -2);
+    lua_rawsetp(L, -2, tp->ptr);
+    lua_pop(L, 1);
     return 1;
 }
 
+static int wl_pinfo_gc(lua_State *L)
+{
+    /* Only objects of ws.pinfo.new() own their packet_info */
+    if (lua_rawlen(L, 1) != sizeof(struct wl_test_pinfo))
+        return 0;
+    struct wl_test_pinfo *tp = lua_touserdata(L, 1);
+    frame_data_destroy(&tp->fd);
+    wmem_destroy_allocator(tp->pool);
+    return 0;
+}
+#endif
+
 static const struct luaL_Reg wl_pinfo_m[] = {
     { "set_net_addr", wl_pinfo_set_net_addr },
     { "__index", wl_pinfo_index },
     { "__newindex", wl_pinfo_newindex },
+#ifdef HAVE_TEST_API
+    { "__gc", wl_pinfo_gc },
+#endif
     { NULL, NULL }
 };
 
@@ -213,7 +383,9 @@ static const struct luaL_Reg wl_cinfo_m[] = {
 };
 
 static const struct luaL_Reg wl_pinfo_f[] = {
+#ifdef HAVE_TEST_API
     { "new", wl_pinfo_new },
+#endif
     { NULL, NULL }
 };
   
@@ -222,6 +394,14 @@ void wl_open_pinfo(lua_State *L)
 {
     luaW_newmetatable(L, "wslua.PacketInfo", wl_pinfo_m);
     luaW_newmetatable(L, "wslua.ColumnInfo", wl_cinfo_m);
+#ifdef HAVE_TEST_API
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, TEST_PINFO);
+#endif
     luaL_newlib(L, wl_pinfo_f);
     lua_setfield(L, -2, "pinfo");
 }
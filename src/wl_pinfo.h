@@ -29,6 +29,8 @@ int luaW_check_column(lua_State *L, int idx);
 void luaW_push_pinfo(lua_State *L, packet_info *pinfo);
 
 void luaW_push_cinfo(lua_State *L, column_info *cinfo);
+
+void luaW_pinfo_release_scratch(lua_State *L, int arg);
   
 void wl_open_pinfo(lua_State *L);
 
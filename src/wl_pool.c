@@ -0,0 +1,353 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/***
+ * @module wireshark.util
+ */
+
+/*
+ * Pages are aligned to their size so the page of an object is found by
+ * masking its address. Lua passes the old size of a block to the
+ * allocator, so the size class of a freed object is known without a
+ * header. Each page keeps its own free list; pages with free objects are
+ * linked in the partial list of their class. A page whose objects are
+ * all freed is kept for reuse by any class, up to POOL_EMPTY_PAGES, and
+ * released otherwise.
+ */
+
+#define POOL_PAGE_SIZE      (64 * 1024)
+#define POOL_EMPTY_PAGES    8
+
+struct wl_pool_page {
+    struct wl_pool_page *next;
+    struct wl_pool_page *prev;
+    void *free;             /* freed objects */
+    char *bump;             /* objects never allocated start here */
+    uint32_t live;
+    uint16_t cls;
+    bool partial;
+};
+
+#define POOL_PAGE_HEADER    ((sizeof(struct wl_pool_page) + 15) & ~(size_t)15)
+#define POOL_PAGE(ptr)      ((struct wl_pool_page *)((uintptr_t)(ptr) & ~(uintptr_t)(POOL_PAGE_SIZE - 1)))
+
+struct wl_pool_class {
+    struct wl_pool_page *partial;
+    size_t live;            /* objects */
+    size_t pages;
+};
+
+struct wl_pool {
+    struct wl_pool_class classes[WL_POOL_NCLASSES];
+    struct wl_pool_page *empty;
+    unsigned nempty;
+    size_t pages;
+    size_t live;            /* bytes requested by Lua */
+    size_t peak;
+    size_t large_live;      /* bytes from malloc() */
+};
+
+static inline unsigned l_pool_class(size_t size)
+{
+    return (unsigned)((size - 1) / WL_POOL_CLASS_STEP);
+}
+
+static inline size_t l_pool_class_size(unsigned cls)
+{
+    return (cls + 1) * WL_POOL_CLASS_STEP;
+}
+
+static void l_out_of_memory(void)
+{
+    fprintf(stderr, "Out of memory error\n");
+    abort();
+}
+
+static void l_pool_link(struct wl_pool_class *c, struct wl_pool_page *page)
+{
+    page->prev = NULL;
+    page->next = c->partial;
+    if (c->partial != NULL)
+        c->partial->prev = page;
+    c->partial = page;
+    page->partial = true;
+}
+
+static void l_pool_unlink(struct wl_pool_class *c, struct wl_pool_page *page)
+{
+    if (page->prev != NULL)
+        page->prev->next = page->next;
+    else
+        c->partial = page->next;
+    if (page->next != NULL)
+        page->next->prev = page->prev;
+    page->partial = false;
+}
+
+/* Returns NULL on failure, MinGW has no posix_memalign() */
+static void *l_page_alloc(void)
+{
+#ifdef _WIN32
+    return _aligned_malloc(POOL_PAGE_SIZE, POOL_PAGE_SIZE);
+#else
+    void *mem;
+    if (posix_memalign(&mem, POOL_PAGE_SIZE, POOL_PAGE_SIZE) != 0)
+        return NULL;
+    return mem;
+#endif
+}
+
+static void l_page_free(struct wl_pool_page *page)
+{
+#ifdef _WIN32
+    _aligned_free(page);
+#else
+    free(page);
+#endif
+}
+
+static struct wl_pool_page *l_pool_new_page(struct wl_pool *pool, unsigned cls)
+{
+    struct wl_pool_page *page = pool->empty;
+    if (page != NULL) {
+        pool->empty = page->next;
+        pool->nempty--;
+    }
+    else {
+        page = l_page_alloc();
+        if (page == NULL)
+            l_out_of_memory();
+        pool->pages++;
+    }
+    page->free = NULL;
+    page->bump = (char *)page + POOL_PAGE_HEADER;
+    page->live = 0;
+    page->cls = (uint16_t)cls;
+    pool->classes[cls].pages++;
+    l_pool_link(&pool->classes[cls], page);
+    return page;
+}
+
+static void l_pool_release_page(struct wl_pool *pool, struct wl_pool_page *page)
+{
+    pool->classes[page->cls].pages--;
+    if (pool->nempty < POOL_EMPTY_PAGES) {
+        page->next = pool->empty;
+        pool->empty = page;
+        pool->nempty++;
+    }
+    else {
+        l_page_free(page);
+        pool->pages--;
+    }
+}
+
+static void *l_pool_get(struct wl_pool *pool, unsigned cls)
+{
+    struct wl_pool_class *c = &pool->classes[cls];
+    struct wl_pool_page *page = c->partial;
+    size_t size = l_pool_class_size(cls);
+    void *obj;
+
+    if (page == NULL)
+        page = l_pool_new_page(pool, cls);
+    if (page->free != NULL) {
+        obj = page->free;
+        page->free = *(void **)obj;
+    }
+    else {
+        obj = page->bump;
+        page->bump += size;
+    }
+    page->live++;
+    c->live++;
+    if (page->free == NULL && page->bump + size > (char *)page + POOL_PAGE_SIZE)
+        l_pool_unlink(c, page);
+    return obj;
+}
+
+static void l_pool_put(struct wl_pool *pool, void *obj)
+{
+    struct wl_pool_page *page = POOL_PAGE(obj);
+    struct wl_pool_class *c = &pool->classes[page->cls];
+
+    *(void **)obj = page->free;
+    page->free = obj;
+    page->live--;
+    c->live--;
+    if (page->live == 0) {
+        if (page->partial)
+            l_pool_unlink(c, page);
+        l_pool_release_page(pool, page);
+    }
+    else if (!page->partial) {
+        l_pool_link(c, page);
+    }
+}
+
+struct wl_pool *wl_pool_new(void)
+{
+    struct wl_pool *pool = xmalloc(sizeof(struct wl_pool));
+    memset(pool, 0, sizeof(*pool));
+    return pool;
+}
+
+void wl_pool_destroy(struct wl_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    while (pool->empty != NULL) {
+        struct wl_pool_page *page = pool->empty;
+        pool->empty = page->next;
+        l_page_free(page);
+        pool->pages--;
+    }
+    if (pool->pages != 0)
+        ws_warning("Lua pool destroyed with %zu pages in use", pool->pages);
+    free(pool);
+}
+
+void *wl_pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    struct wl_pool *pool = ud;
+    void *p;
+
+    /* When 'ptr' is NULL 'osize' is the object type, not a size */
+    if (ptr == NULL)
+        osize = 0;
+    pool->live += nsize - osize;
+    if (pool->live > pool->peak)
+        pool->peak = pool->live;
+
+    if (nsize == 0) {
+        if (osize > WL_POOL_MAX_SIZE) {
+            pool->large_live -= osize;
+            free(ptr);
+        }
+        else if (ptr != NULL) {
+            l_pool_put(pool, ptr);
+        }
+        return NULL;
+    }
+
+    if (nsize <= WL_POOL_MAX_SIZE) {
+        if (ptr != NULL && osize <= WL_POOL_MAX_SIZE && l_pool_class(osize) == l_pool_class(nsize))
+            return ptr;
+        p = l_pool_get(pool, l_pool_class(nsize));
+    }
+    else if (osize > WL_POOL_MAX_SIZE) {
+        p = realloc(ptr, nsize);
+        if (p == NULL)
+            l_out_of_memory();
+        pool->large_live += nsize - osize;
+        return p;
+    }
+    else {
+        p = malloc(nsize);
+        if (p == NULL)
+            l_out_of_memory();
+        pool->large_live += nsize;
+    }
+
+    /* Moving between the pool and malloc() or between classes */
+    if (ptr != NULL) {
+        memcpy(p, ptr, osize < nsize ? osize : nsize);
+        if (osize > WL_POOL_MAX_SIZE) {
+            pool->large_live -= osize;
+            free(ptr);
+        }
+        else {
+            l_pool_put(pool, ptr);
+        }
+    }
+    return p;
+}
+
+/***
+ * Get the memory statistics of the Lua allocator
+ *
+ * The pool allocator is used if the plugin was built with
+ * ENABLE_POOL_ALLOC. Otherwise only the allocator and live fields are set.
+ * @function alloc_stats
+ * @treturn table a table with the fields:
+ *      allocator ("pool" or "system"),
+ *      live (bytes in use by Lua),
+ *      peak (the highest value of live),
+ *      large (bytes in blocks larger than the biggest size class),
+ *      pages and empty_pages (pool pages allocated and kept for reuse) and
+ *      classes (an array of tables with the fields size, live and pages)
+ */
+static int wl_alloc_stats(lua_State *L)
+{
+    void *ud;
+    lua_Alloc f = luaW_memory_getallocf(L, &ud);
+
+    lua_newtable(L);
+    if (f != wl_pool_alloc) {
+        lua_pushliteral(L, "system");
+        lua_setfield(L, -2, "allocator");
+        lua_pushinteger(L, (lua_Integer)lua_gc(L, LUA_GCCOUNT) * 1024 + lua_gc(L, LUA_GCCOUNTB));
+        lua_setfield(L, -2, "live");
+        return 1;
+    }
+
+    struct wl_pool *pool = ud;
+    lua_pushliteral(L, "pool");
+    lua_setfield(L, -2, "allocator");
+    lua_pushinteger(L, (lua_Integer)pool->live);
+    lua_setfield(L, -2, "live");
+    lua_pushinteger(L, (lua_Integer)pool->peak);
+    lua_setfield(L, -2, "peak");
+    lua_pushinteger(L, (lua_Integer)pool->large_live);
+    lua_setfield(L, -2, "large");
+    lua_pushinteger(L, (lua_Integer)pool->pages);
+    lua_setfield(L, -2, "pages");
+    lua_pushinteger(L, pool->nempty);
+    lua_setfield(L, -2, "empty_pages");
+    lua_createtable(L, WL_POOL_NCLASSES, 0);
+    for (unsigned i = 0; i < WL_POOL_NCLASSES; i++) {
+        lua_createtable(L, 0, 3);
+        lua_pushinteger(L, (lua_Integer)l_pool_class_size(i));
+        lua_setfield(L, -2, "size");
+        lua_pushinteger(L, (lua_Integer)pool->classes[i].live);
+        lua_setfield(L, -2, "live");
+        lua_pushinteger(L, (lua_Integer)pool->classes[i].pages);
+        lua_setfield(L, -2, "pages");
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "classes");
+    return 1;
+}
+
+static const struct luaL_Reg wl_pool_f[] = {
+    { "alloc_stats", wl_alloc_stats },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_pool(lua_State *L)
+{
+    lua_getfield(L, -1, "util");
+    luaL_setfuncs(L, wl_pool_f, 0);
+    lua_pop(L, 1);
+}
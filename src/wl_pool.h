@@ -0,0 +1,45 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_POOL_H_
+#define _WL_POOL_H_
+
+#include <stddef.h>
+
+/*
+ * Size-class allocator for the Lua state. Blocks up to WL_POOL_MAX_SIZE
+ * bytes come from pages that hold objects of a single size class, larger
+ * blocks from malloc(). A pool must only be used by one thread, like the
+ * Lua state that owns it.
+ */
+
+#define WL_POOL_CLASS_STEP  16
+#define WL_POOL_NCLASSES    16
+#define WL_POOL_MAX_SIZE    (WL_POOL_CLASS_STEP * WL_POOL_NCLASSES)
+
+struct wl_pool;
+
+struct wl_pool *wl_pool_new(void);
+
+void wl_pool_destroy(struct wl_pool *pool);
+
+/* A lua_Alloc function, 'ud' is the pool */
+void *wl_pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+void wl_open_pool(lua_State *L);
+
+#endif
@@ -0,0 +1,520 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <wsutil/file_util.h>
+
+/***
+ * @module wireshark
+ */
+
+/*
+ * Longest prefix match with a multibit trie using strides of 16, 8, 8, ...
+ * bits (DIR-16-8 for IPv4). Prefixes are expanded into the nodes when the
+ * table is built, so a lookup reads one entry per stride and stops at the
+ * first leaf: at most 3 reads for IPv4 and 15 for IPv6.
+ *
+ * An entry is either a value index (0 for no match) or a child node, whose
+ * 256 entries start at (entry & ~PREFIX_CHILD) * 256.
+ */
+
+#define PREFIX_ROOT_BITS    16
+#define PREFIX_ROOT_SIZE    (1U << PREFIX_ROOT_BITS)
+#define PREFIX_NODE_SIZE    256
+#define PREFIX_CHILD        0x80000000U
+#define PREFIX_VALUES_MAX   0x7fffffff
+
+struct wl_prefix {
+    uint8_t bytes[16];
+    uint8_t len;
+    uint8_t family_len;     /* 4 or 16 */
+    uint32_t seq;
+    uint32_t value;
+};
+
+/* A value is an integer or a reference into the uservalue table */
+struct wl_prefix_value {
+    bool is_ref;
+    lua_Integer i;
+};
+
+struct wl_trie {
+    uint32_t *nodes;
+    size_t size;        /* entries in use */
+    size_t alloc;
+};
+
+struct wl_prefix_table {
+    struct wl_prefix *prefixes;
+    uint32_t nprefixes;
+    uint32_t prefixes_alloc;
+    struct wl_prefix_value *values;
+    uint32_t nvalues;
+    uint32_t values_alloc;
+    struct wl_trie v4;
+    struct wl_trie v6;
+    bool dirty;
+};
+
+static struct wl_prefix_table *luaW_check_prefix_table(lua_State *L, int arg)
+{
+    struct wl_prefix_table *ptr = luaL_checkudata(L, arg, "wslua.PrefixTable");
+    return ptr;
+}
+
+static uint32_t l_trie_new_node(struct wl_trie *trie, uint32_t fill)
+{
+    if (trie->size + PREFIX_NODE_SIZE > trie->alloc) {
+        trie->alloc *= 2;
+        trie->nodes = xrealloc(trie->nodes, trie->alloc * sizeof(uint32_t));
+    }
+    uint32_t node = (uint32_t)(trie->size / PREFIX_NODE_SIZE);
+    for (size_t i = 0; i < PREFIX_NODE_SIZE; i++)
+        trie->nodes[trie->size + i] = fill;
+    trie->size += PREFIX_NODE_SIZE;
+    return node;
+}
+
+/* Prefixes must be inserted by increasing length */
+static void l_trie_insert(struct wl_trie *trie, const struct wl_prefix *p)
+{
+    size_t base = 0;
+    unsigned bits = PREFIX_ROOT_BITS;  /* bits consumed after this level */
+    unsigned idx = (p->bytes[0] << 8) | p->bytes[1];
+    unsigned byte = 2;
+
+    if (trie->nodes == NULL) {
+        trie->alloc = PREFIX_ROOT_SIZE * 2;
+        trie->nodes = xmalloc(trie->alloc * sizeof(uint32_t));
+        memset(trie->nodes, 0, PREFIX_ROOT_SIZE * sizeof(uint32_t));
+        trie->size = PREFIX_ROOT_SIZE;
+    }
+
+    while (p->len > bits) {
+        uint32_t entry = trie->nodes[base + idx];
+        if (!(entry & PREFIX_CHILD)) {
+            uint32_t node = l_trie_new_node(trie, entry);
+            entry = node | PREFIX_CHILD;
+            trie->nodes[base + idx] = entry;
+        }
+        base = (size_t)(entry & ~PREFIX_CHILD) * PREFIX_NODE_SIZE;
+        idx = p->bytes[byte++];
+        bits += 8;
+    }
+
+    /* Expand over the entries covered by the prefix at this level */
+    unsigned span = 1U << (bits - p->len);
+    idx &= ~(span - 1);
+    for (unsigned i = 0; i < span; i++)
+        trie->nodes[base + idx + i] = p->value;
+}
+
+static uint32_t l_trie_lookup(const struct wl_trie *trie, const uint8_t *addr)
+{
+    if (trie->nodes == NULL)
+        return 0;
+    uint32_t entry = trie->nodes[(addr[0] << 8) | addr[1]];
+    for (unsigned byte = 2; entry & PREFIX_CHILD; byte++)
+        entry = trie->nodes[(size_t)(entry & ~PREFIX_CHILD) * PREFIX_NODE_SIZE + addr[byte]];
+    return entry;
+}
+
+static void l_trie_shrink(struct wl_trie *trie)
+{
+    if (trie->nodes != NULL && trie->size < trie->alloc) {
+        trie->nodes = xrealloc(trie->nodes, trie->size * sizeof(uint32_t));
+        trie->alloc = trie->size;
+    }
+}
+
+static int l_prefix_cmp(const void *a, const void *b)
+{
+    const struct wl_prefix *p1 = a, *p2 = b;
+    if (p1->len != p2->len)
+        return p1->len < p2->len ? -1 : 1;
+    return p1->seq < p2->seq ? -1 : (p1->seq > p2->seq);
+}
+
+static void l_prefix_table_build(struct wl_prefix_table *pt)
+{
+    free(pt->v4.nodes);
+    free(pt->v6.nodes);
+    memset(&pt->v4, 0, sizeof(pt->v4));
+    memset(&pt->v6, 0, sizeof(pt->v6));
+
+    qsort(pt->prefixes, pt->nprefixes, sizeof(struct wl_prefix), l_prefix_cmp);
+    for (uint32_t i = 0; i < pt->nprefixes; i++) {
+        struct wl_prefix *p = &pt->prefixes[i];
+        l_trie_insert(p->family_len == 4 ? &pt->v4 : &pt->v6, p);
+    }
+    l_trie_shrink(&pt->v4);
+    l_trie_shrink(&pt->v6);
+    pt->dirty = false;
+}
+
+/* Parses "addr[/len]". Returns false if not valid. */
+static bool l_prefix_parse(const char *str, struct wl_prefix *p)
+{
+    char buf[64];
+    const char *slash = strchr(str, '/');
+    size_t addr_len = slash ? (size_t)(slash - str) : strlen(str);
+    unsigned max;
+
+    if (addr_len >= sizeof(buf))
+        return false;
+    memcpy(buf, str, addr_len);
+    buf[addr_len] = '\0';
+
+    memset(p, 0, sizeof(*p));
+    if (strchr(buf, ':') != NULL) {
+        if (!ws_inet_pton6(buf, (ws_in6_addr *)p->bytes))
+            return false;
+        max = 128;
+        p->family_len = 16;
+    }
+    else {
+        if (!ws_inet_pton4(buf, (ws_in4_addr *)p->bytes))
+            return false;
+        max = 32;
+        p->family_len = 4;
+    }
+
+    if (slash != NULL) {
+        char *end;
+        unsigned long len = strtoul(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || len > max)
+            return false;
+        p->len = (uint8_t)len;
+    }
+    else {
+        p->len = (uint8_t)max;
+    }
+
+    /* Clear the host bits */
+    for (unsigned bit = p->len; bit < max; bit++)
+        p->bytes[bit / 8] &= ~(0x80 >> (bit % 8));
+    return true;
+}
+
+/* Adds the value at 'idx' and returns its index */
+static uint32_t l_prefix_table_add_value(lua_State *L, struct wl_prefix_table *pt, int idx)
+{
+    if (pt->nvalues == PREFIX_VALUES_MAX)
+        luaL_error(L, "PrefixTable: too many values");
+    if (pt->nvalues + 1 >= pt->values_alloc) {
+        pt->values_alloc = pt->values_alloc ? pt->values_alloc * 2 : 64;
+        pt->values = xrealloc(pt->values, pt->values_alloc * sizeof(struct wl_prefix_value));
+    }
+    /* Index 0 means no match */
+    struct wl_prefix_value *v = &pt->values[++pt->nvalues];
+    if (lua_isinteger(L, idx)) {
+        v->is_ref = false;
+        v->i = lua_tointeger(L, idx);
+    }
+    else {
+        idx = lua_absindex(L, idx);
+        v->is_ref = true;
+        lua_getiuservalue(L, 1, 1);
+        lua_pushvalue(L, idx);
+        lua_rawseti(L, -2, pt->nvalues);
+        lua_pop(L, 1);
+    }
+    return pt->nvalues;
+}
+
+static void l_prefix_table_add(struct wl_prefix_table *pt, struct wl_prefix *p)
+{
+    if (pt->nprefixes == pt->prefixes_alloc) {
+        pt->prefixes_alloc = pt->prefixes_alloc ? pt->prefixes_alloc * 2 : 64;
+        pt->prefixes = xrealloc(pt->prefixes, pt->prefixes_alloc * sizeof(struct wl_prefix));
+    }
+    p->seq = pt->nprefixes;
+    pt->prefixes[pt->nprefixes++] = *p;
+    pt->dirty = true;
+}
+
+static void l_prefix_table_push_value(lua_State *L, struct wl_prefix_table *pt, uint32_t value)
+{
+    if (value == 0) {
+        lua_pushnil(L);
+        return;
+    }
+    struct wl_prefix_value *v = &pt->values[value];
+    if (!v->is_ref) {
+        lua_pushinteger(L, v->i);
+        return;
+    }
+    lua_getiuservalue(L, 1, 1);
+    lua_rawgeti(L, -1, value);
+    lua_remove(L, -2);
+}
+
+/***
+ * Longest prefix match table class.
+ *
+ * Maps IPv4 and IPv6 prefixes to integers or other Lua values. Prefixes
+ * are added when the script is loaded and the lookup structure is built
+ * on the first lookup after a change.
+ * @type PrefixTable
+ */
+
+/***
+ * Create an empty prefix table
+ * @function PrefixTable.new
+ * @treturn PrefixTable
+ */
+static int wl_prefix_table_new(lua_State *L)
+{
+    struct wl_prefix_table *pt = NEWUSERDATA(L, struct wl_prefix_table, "wslua.PrefixTable");
+    memset(pt, 0, sizeof(*pt));
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+    return 1;
+}
+
+/***
+ * Add a prefix
+ *
+ * Adding the same prefix again replaces its value.
+ * @function add
+ * @string prefix an IPv4 or IPv6 prefix, e.g. "10.0.0.0/8" or "2001:db8::/32",
+ *      a host address if the length is omitted
+ * @param value an integer or any other Lua value
+ */
+static int wl_prefix_table_add(lua_State *L)
+{
+    struct wl_prefix_table *pt = luaW_check_prefix_table(L, 1);
+    const char *str = luaL_checkstring(L, 2);
+    luaL_checkany(L, 3);
+    luaL_argcheck(L, !lua_isnil(L, 3), 3, "value must not be nil");
+    struct wl_prefix p;
+
+    if (!l_prefix_parse(str, &p))
+        return luaL_argerror(L, 2, "invalid prefix");
+    p.value = l_prefix_table_add_value(L, pt, 3);
+    l_prefix_table_add(pt, &p);
+    return 0;
+}
+
+/***
+ * Add prefixes from a file
+ *
+ * Each line has a prefix and a value separated by white space. Values that
+ * are integers are stored as integers, others as strings. Empty lines and
+ * lines starting with '#' are ignored.
+ * @function load
+ * @string path the file path
+ * @treturn int the number of prefixes added
+ */
+static int wl_prefix_table_load(lua_State *L)
+{
+    struct wl_prefix_table *pt = luaW_check_prefix_table(L, 1);
+    const char *path = luaL_checkstring(L, 2);
+    char line[512];
+    unsigned lineno = 0;
+    lua_Integer count = 0;
+    struct wl_prefix p;
+
+    FILE *fp = ws_fopen(path, "r");
+    if (fp == NULL)
+        return luaL_error(L, "PrefixTable: cannot open %s: %s", path, strerror(errno));
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        char *prefix = line + strspn(line, " \t");
+        if (*prefix == '#' || *prefix == '\n' || *prefix == '\r' || *prefix == '\0')
+            continue;
+        char *value = prefix + strcspn(prefix, " \t\r\n");
+        if (*value != '\0')
+            *value++ = '\0';
+        value += strspn(value, " \t");
+        value[strcspn(value, "\r\n")] = '\0';
+        if (*value == '\0' || !l_prefix_parse(prefix, &p)) {
+            fclose(fp);
+            return luaL_error(L, "PrefixTable: %s:%d: invalid line", path, (int)lineno);
+        }
+        if (lua_stringtonumber(L, value) == 0 || !lua_isinteger(L, -1)) {
+            lua_settop(L, 2);
+            lua_pushstring(L, value);
+        }
+        p.value = l_prefix_table_add_value(L, pt, -1);
+        lua_pop(L, 1);
+        l_prefix_table_add(pt, &p);
+        count++;
+    }
+    fclose(fp);
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+/***
+ * Find the value of the longest prefix matching an address
+ * @function lookup
+ * @tparam Address|IPv4|IPv6 addr the address
+ * @return the value or nil if no prefix matches
+ */
+static int wl_prefix_table_lookup(lua_State *L)
+{
+    struct wl_prefix_table *pt = luaW_check_prefix_table(L, 1);
+    const uint8_t *data = NULL;
+    const struct wl_trie *trie = NULL;
+
+    if (pt->dirty)
+        l_prefix_table_build(pt);
+
+    /* Compare with the metatables in the upvalues to avoid the registry lookups */
+    if (lua_getmetatable(L, 2)) {
+        if (lua_rawequal(L, -1, lua_upvalueindex(1))) {
+            const address *addr = lua_touserdata(L, 2);
+            if (addr->type == AT_IPv4)
+                trie = &pt->v4;
+            else if (addr->type == AT_IPv6)
+                trie = &pt->v6;
+            data = addr->data;
+        }
+        else if (lua_rawequal(L, -1, lua_upvalueindex(2))) {
+            trie = &pt->v4;
+            data = lua_touserdata(L, 2);
+        }
+        else if (lua_rawequal(L, -1, lua_upvalueindex(3))) {
+            trie = &pt->v6;
+            data = lua_touserdata(L, 2);
+        }
+        lua_pop(L, 1);
+    }
+    if (data == NULL)
+        return luaL_typeerror(L, 2, "Address, IPv4 or IPv6");
+
+    l_prefix_table_push_value(L, pt, trie ? l_trie_lookup(trie, data) : 0);
+    return 1;
+}
+
+/***
+ * Find the value of the longest prefix matching an address in a TVBuff
+ * @function lookup_tvb
+ * @tparam TVBuff tvb a TVBuff
+ * @tparam int|Offset offset the offset of the address
+ * @int[opt=4] len the address length, 4 for IPv4 or 16 for IPv6
+ * @return the value or nil if no prefix matches
+ */
+static int wl_prefix_table_lookup_tvb(lua_State *L)
+{
+    struct wl_prefix_table *pt = luaW_check_prefix_table(L, 1);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+    int offset = (int)luaW_check_offset_toint(L, 3);
+    lua_Integer len = luaL_optinteger(L, 4, 4);
+    luaL_argcheck(L, len == 4 || len == 16, 4, "length must be 4 or 16");
+
+    if (pt->dirty)
+        l_prefix_table_build(pt);
+
+    const uint8_t *data = NULL;
+    LUAW_TRY(L, data = tvb_get_ptr(tvb, offset, (int)len));
+    l_prefix_table_push_value(L, pt, l_trie_lookup(len == 4 ? &pt->v4 : &pt->v6, data));
+    return 1;
+}
+
+/***
+ * Get the memory used by the table
+ * @function memory
+ * @treturn int the total size in bytes
+ * @treturn table the fields prefixes, v4_nodes and v6_nodes (number of
+ *      trie nodes) and v4_bytes, v6_bytes, prefix_bytes and value_bytes
+ */
+static int wl_prefix_table_memory(lua_State *L)
+{
+    struct wl_prefix_table *pt = luaW_check_prefix_table(L, 1);
+
+    if (pt->dirty)
+        l_prefix_table_build(pt);
+
+    size_t v4_bytes = pt->v4.alloc * sizeof(uint32_t);
+    size_t v6_bytes = pt->v6.alloc * sizeof(uint32_t);
+    size_t prefix_bytes = pt->prefixes_alloc * sizeof(struct wl_prefix);
+    size_t value_bytes = pt->values_alloc * sizeof(struct wl_prefix_value);
+
+    lua_pushinteger(L, (lua_Integer)(v4_bytes + v6_bytes + prefix_bytes + value_bytes));
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, pt->nprefixes);
+    lua_setfield(L, -2, "prefixes");
+    lua_pushinteger(L, (lua_Integer)(pt->v4.size / PREFIX_NODE_SIZE));
+    lua_setfield(L, -2, "v4_nodes");
+    lua_pushinteger(L, (lua_Integer)(pt->v6.size / PREFIX_NODE_SIZE));
+    lua_setfield(L, -2, "v6_nodes");
+    lua_pushinteger(L, (lua_Integer)v4_bytes);
+    lua_setfield(L, -2, "v4_bytes");
+    lua_pushinteger(L, (lua_Integer)v6_bytes);
+    lua_setfield(L, -2, "v6_bytes");
+    lua_pushinteger(L, (lua_Integer)prefix_bytes);
+    lua_setfield(L, -2, "prefix_bytes");
+    lua_pushinteger(L, (lua_Integer)value_bytes);
+    lua_setfield(L, -2, "value_bytes");
+    return 2;
+}
+
+static int wl_prefix_table_len(lua_State *L)
+{
+    struct wl_prefix_table *pt = luaW_check_prefix_table(L, 1);
+    lua_pushinteger(L, pt->nprefixes);
+    return 1;
+}
+
+static int wl_prefix_table_gc(lua_State *L)
+{
+    struct wl_prefix_table *pt = luaW_check_prefix_table(L, 1);
+    free(pt->prefixes);
+    free(pt->values);
+    free(pt->v4.nodes);
+    free(pt->v6.nodes);
+    memset(pt, 0, sizeof(*pt));
+    return 0;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_prefix_table_m[] = {
+    { "add", wl_prefix_table_add },
+    { "load", wl_prefix_table_load },
+    { "lookup_tvb", wl_prefix_table_lookup_tvb },
+    { "memory", wl_prefix_table_memory },
+    { "__len", wl_prefix_table_len },
+    { "__gc", wl_prefix_table_gc },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_prefix_table_f[] = {
+    { "new", wl_prefix_table_new },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_prefix(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.PrefixTable", wl_prefix_table_m);
+    luaL_getmetatable(L, "wslua.PrefixTable");
+    luaL_getmetatable(L, "wslua.Address");
+    luaL_getmetatable(L, "wslua.IPv4");
+    luaL_getmetatable(L, "wslua.IPv6");
+    lua_pushcclosure(L, wl_prefix_table_lookup, 3);
+    lua_setfield(L, -2, "lookup");
+    lua_pop(L, 1);
+    luaL_newlib(L, wl_prefix_table_f);
+    lua_setfield(L, -2, "PrefixTable");
+}
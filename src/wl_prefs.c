@@ -21,13 +21,30 @@
  * @module wireshark.prefs
  */
 
+/* Registry table of module state tables, keyed by module_t pointer */
+#define PREFS_REGISTRY  "wslua2.prefs"
+
+enum wl_pref_type {
+    WL_PREF_BOOL,
+    WL_PREF_UINT,
+    WL_PREF_ENUM,
+    WL_PREF_STRING,
+    WL_PREF_FILENAME,
+    WL_PREF_RANGE,
+};
+
 struct wl_preference {
     char *name;
     char *title;
     char *description;
-    unsigned type;
+    module_t *module;
+    enum wl_pref_type type;
     union {
         bool boolean;
+        unsigned uint;
+        int enumval;
+        const char *string;
+        range_t *range;
     } value;
 };
 
@@ -60,21 +77,46 @@ void luaW_push_preference(lua_State *L, struct wl_preference *pref)
  * @type Preference
  */
 
-/***
- * Get a boolean from a preference
- * @function get
- * @return value the preference value
- */
-static int wl_preference_call(lua_State *L)
+static void l_push_pref_value(lua_State *L, struct wl_preference *pref)
 {
-    struct wl_preference *pref = luaW_check_preference(L, 1);
     switch (pref->type) {
-        case LUA_TBOOLEAN:
+        case WL_PREF_BOOL:
             lua_pushboolean(L, pref->value.boolean);
             break;
+        case WL_PREF_UINT:
+            lua_pushinteger(L, pref->value.uint);
+            break;
+        case WL_PREF_ENUM:
+            lua_pushinteger(L, pref->value.enumval);
+            break;
+        case WL_PREF_STRING:
+        case WL_PREF_FILENAME:
+            lua_pushstring(L, pref->value.string ? pref->value.string : "");
+            break;
+        case WL_PREF_RANGE:
+            luaW_push_range(L, pref->value.range);
+            break;
         default:
             ws_assert_not_reached();
     }
+}
+
+void luaW_push_pref_range(lua_State *L, struct wl_preference *pref)
+{
+    if (pref->type != WL_PREF_RANGE)
+        luaL_error(L, "preference %s is not a range", pref->name);
+    luaW_push_range(L, pref->value.range);
+}
+
+/***
+ * Get the value of a preference. Ranges are returned as a Range.
+ * @function get
+ * @return value the preference value
+ */
+static int wl_preference_call(lua_State *L)
+{
+    struct wl_preference *pref = luaW_check_preference(L, 1);
+    l_push_pref_value(L, pref);
     return 1;
 }
 
@@ -85,16 +127,8 @@ static int wl_preference_call(lua_State *L)
 static int wl_preference_tostring(lua_State *L)
 {
     struct wl_preference *pref = luaW_check_preference(L, 1);
-    switch (pref->type) {
-        case LUA_TBOOLEAN:
-            if (pref->value.boolean)
-                lua_pushliteral(L, "wslua.Preference: true");
-            else
-                lua_pushliteral(L, "wslua.Preference: false");
-            break;
-        default:
-            ws_assert_not_reached();
-    }
+    l_push_pref_value(L, pref);
+    lua_pushfstring(L, "wslua.Preference: %s", luaL_tolstring(L, -1, NULL));
     return 1;
 }
 
@@ -122,19 +156,193 @@ static int wl_pref_module_index(lua_State *L)
  */
 
 
+/*
+ * Moves the dissectors registered with a range preference from the old
+ * Range at index 'old_idx' to the new Range at 'new_idx'. Does nothing
+ * for preferences of other types or without registered dissectors.
+ */
+static void l_move_dissector_ranges(lua_State *L, int dissectors, const char *name,
+                                        int old_idx, int new_idx)
+{
+    struct wl_range *old_range = luaL_testudata(L, old_idx, "wslua.Range");
+    struct wl_range *new_range = luaL_testudata(L, new_idx, "wslua.Range");
+
+    if (old_range == NULL || new_range == NULL || !lua_istable(L, dissectors))
+        return;
+    if (lua_getfield(L, dissectors, name) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return;
+    }
+    for (lua_Integer i = 1; lua_rawgeti(L, -1, i) != LUA_TNIL; i++) {
+        lua_getfield(L, -1, "table");
+        lua_getfield(L, -2, "handle");
+        const char *table = lua_tostring(L, -2);
+        dissector_handle_t handle = luaW_check_dissector_handle(L, -1);
+        dissector_delete_uint_range(table, old_range->range, handle);
+        dissector_add_uint_range(table, new_range->range, handle);
+        lua_pop(L, 3);
+    }
+    lua_pop(L, 2);
+}
+
+/*
+ * Updates the cached values of every module and runs the change callbacks
+ * for the preferences with a new value.
+ */
+static int l_prefs_apply(lua_State *L)
+{
+    if (lua_getfield(L, LUA_REGISTRYINDEX, PREFS_REGISTRY) != LUA_TTABLE)
+        return 0;
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+        int state = lua_gettop(L);
+        lua_getfield(L, state, "prefs");
+        lua_getfield(L, state, "values");
+        lua_getfield(L, state, "bound");
+        lua_getfield(L, state, "on_change");
+        lua_getfield(L, state, "dissectors");
+        int prefs = state + 1, values = state + 2, bound = state + 3, on_change = state + 4;
+        int dissectors = state + 5;
+
+        lua_pushnil(L);
+        while (lua_next(L, prefs) != 0) {
+            /* name at -2, Preference at -1 */
+            l_push_pref_value(L, luaW_check_preference(L, -1));
+            lua_getfield(L, values, lua_tostring(L, -3));
+            if (lua_compare(L, -1, -2, LUA_OPEQ)) {
+                lua_pop(L, 3);
+                continue;
+            }
+            l_move_dissector_ranges(L, dissectors, lua_tostring(L, -4), -1, -2);
+            lua_pop(L, 1);
+            lua_pushvalue(L, -3);
+            lua_pushvalue(L, -2);
+            lua_rawset(L, values);
+            for (lua_Integer i = 1; lua_rawgeti(L, bound, i) != LUA_TNIL; i++) {
+                lua_pushvalue(L, -4);
+                lua_pushvalue(L, -3);
+                lua_rawset(L, -3);
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+            for (lua_Integer i = 1; lua_rawgeti(L, on_change, i) != LUA_TNIL; i++) {
+                lua_pushvalue(L, -4);
+                lua_pushvalue(L, -3);
+                if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+                    ws_warning("Preference %s on_change: %s",
+                                    lua_tostring(L, -4), lua_tostring(L, -1));
+                    lua_pop(L, 1);
+                }
+            }
+            lua_pop(L, 3);
+        }
+        lua_settop(L, state - 1);
+    }
+    return 0;
+}
+
+/*
+ * Called by Wireshark when the preferences of one of our modules have been
+ * changed. Runs protected, Wireshark is not prepared for a Lua error.
+ */
+static void wl_prefs_apply(void)
+{
+    lua_State *L = g_lua;
+
+    if (L == NULL)
+        return;
+
+    BEGIN_STACK_DEBUG(L);
+    lua_pushcfunction(L, l_prefs_apply);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+        ws_warning("Applying preferences: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+    END_STACK_DEBUG(L, 0);
+}
+
+/* Pushes the state table of a preferences module */
+static void l_push_module_state(lua_State *L, module_t *module)
+{
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, PREFS_REGISTRY);
+    lua_pushlightuserdata(L, module);
+    lua_rawget(L, -2);
+    lua_remove(L, -2);
+}
+
+/* Pushes the state table of the PrefModule at index 'arg' */
+static void l_get_module_state(lua_State *L, int arg)
+{
+    l_push_module_state(L, luaW_check_pref_module(L, arg));
+}
+
 static int wl_prefs_register_protocol(lua_State *L)
 {
     int proto = luaW_check_protocol(L, 1);
-    module_t *module = prefs_register_protocol(proto, NULL);
-    luaW_push_pref_module(L, module);
+    module_t *module = prefs_register_protocol(proto, wl_prefs_apply);
+
+    lua_settop(L, 1);
+    luaW_push_pref_module(L, module);   /* 2: module */
+    lua_newtable(L);                    /* 3: preferences by name */
+    lua_pushvalue(L, 3);
+    lua_setuservalue(L, 2);
+
+    lua_createtable(L, 0, 5);           /* 4: module state */
+    lua_pushvalue(L, 3);
+    lua_setfield(L, 4, "prefs");
+    lua_newtable(L);
+    lua_setfield(L, 4, "values");
+    lua_newtable(L);
+    lua_setfield(L, 4, "bound");
     lua_newtable(L);
-    lua_setuservalue(L, -2);
+    lua_setfield(L, 4, "on_change");
+    lua_newtable(L);
+    lua_setfield(L, 4, "dissectors");
+
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, PREFS_REGISTRY);
+    lua_pushlightuserdata(L, module);
+    lua_pushvalue(L, 4);
+    lua_rawset(L, -3);
+    lua_settop(L, 2);
     return 1;
 }
 
+/* Allocates a preference using the name, title and description at 2, 3 and 4 */
+static struct wl_preference *l_pref_new(lua_State *L, enum wl_pref_type type)
+{
+    module_t *module = luaW_check_pref_module(L, 1);
+    const char *name = luaL_checkstring(L, 2);
+    const char *title = luaL_checkstring(L, 3);
+    const char *description = luaL_checkstring(L, 4);
+
+    struct wl_preference *pref = wmem_new0(wmem_epan_scope(), struct wl_preference);
+    pref->name = wmem_strdup(wmem_epan_scope(), name);
+    pref->title = wmem_strdup(wmem_epan_scope(), title);
+    pref->description = wmem_strdup(wmem_epan_scope(), description);
+    pref->module = module;
+    pref->type = type;
+    return pref;
+}
+
+/* Adds a registered preference to the module and caches its value */
+static void l_pref_add(lua_State *L, struct wl_preference *pref)
+{
+    lua_getuservalue(L, 1);
+    luaW_push_preference(L, pref);
+    lua_setfield(L, -2, pref->name);
+    lua_pop(L, 1);
+
+    l_get_module_state(L, 1);
+    lua_getfield(L, -1, "values");
+    l_push_pref_value(L, pref);
+    lua_setfield(L, -2, pref->name);
+    lua_pop(L, 2);
+}
+
 /***
  * Create a new boolean preference
- * @function bool
+ * @function register_bool_preference
+ * @tparam PrefModule module the preferences module
  * @string name the name
  * @string title the title
  * @string description the description
@@ -142,23 +350,285 @@ static int wl_prefs_register_protocol(lua_State *L)
  */
 static int wl_prefs_register_bool_preference(lua_State *L)
 {
-    module_t *module = luaW_check_pref_module(L, 1);
-    const char *name = luaL_checkstring(L, 2);
-    const char *title = luaL_checkstring(L, 3);
-    const char *description = luaL_checkstring(L, 4);
-    bool value = lua_toboolean(L, 5);
+    struct wl_preference *pref = l_pref_new(L, WL_PREF_BOOL);
+    pref->value.boolean = lua_toboolean(L, 5);
+    prefs_register_bool_preference(luaW_check_pref_module(L, 1), pref->name,
+                                    pref->title, pref->description, &pref->value.boolean);
+    l_pref_add(L, pref);
+    return 0;
+}
 
-    lua_getuservalue(L, 1);
+/***
+ * Create a new unsigned integer preference
+ * @function register_uint_preference
+ * @tparam PrefModule module the preferences module
+ * @string name the name
+ * @string title the title
+ * @string description the description
+ * @int value the preference default value
+ * @int[opt=10] base the base used to display the value
+ */
+static int wl_prefs_register_uint_preference(lua_State *L)
+{
+    struct wl_preference *pref = l_pref_new(L, WL_PREF_UINT);
+    lua_Integer value = luaL_checkinteger(L, 5);
+    lua_Integer base = luaL_optinteger(L, 6, 10);
+    luaL_argcheck(L, value >= 0 && value <= UINT_MAX, 5, "value out of range");
+    luaL_argcheck(L, base == 8 || base == 10 || base == 16, 6, "base must be 8, 10 or 16");
+    pref->value.uint = (unsigned)value;
+    prefs_register_uint_preference(luaW_check_pref_module(L, 1), pref->name,
+                                    pref->title, pref->description, (unsigned)base, &pref->value.uint);
+    l_pref_add(L, pref);
+    return 0;
+}
 
-    struct wl_preference *pref = wmem_new(wmem_epan_scope(), struct wl_preference);
-    pref->name = wmem_strdup(wmem_epan_scope(), name);
-    pref->title = wmem_strdup(wmem_epan_scope(), title);
-    pref->description = wmem_strdup(wmem_epan_scope(), description);
-    pref->type = LUA_TBOOLEAN;
-    pref->value.boolean = value;
-    prefs_register_bool_preference(module, pref->name, pref->title, pref->description, &pref->value.boolean);
-    luaW_push_preference(L, pref);
-    lua_setfield(L, -2, name);
+/***
+ * Create a new enumerated preference
+ * @function register_enum_preference
+ * @tparam PrefModule module the preferences module
+ * @string name the name
+ * @string title the title
+ * @string description the description
+ * @int value the preference default value
+ * @tparam table enumvals list of {name, description, value}
+ * @bool[opt=false] radio_buttons show as radio buttons instead of a menu
+ */
+static int wl_prefs_register_enum_preference(lua_State *L)
+{
+    struct wl_preference *pref = l_pref_new(L, WL_PREF_ENUM);
+    pref->value.enumval = (int)luaL_checkinteger(L, 5);
+    luaL_checktype(L, 6, LUA_TTABLE);
+    bool radio_buttons = lua_toboolean(L, 7);
+
+    int len = (int)luaL_len(L, 6);
+    enum_val_t *enumvals = wmem_alloc0_array(wmem_epan_scope(), enum_val_t, len + 1);
+    for (int i = 0; i < len; i++) {
+        if (lua_geti(L, 6, i + 1) != LUA_TTABLE)
+            return luaL_error(L, "enum value %d must be a table", i + 1);
+        lua_geti(L, -1, 1);
+        lua_geti(L, -2, 2);
+        lua_geti(L, -3, 3);
+        if (!lua_isstring(L, -3) || !lua_isstring(L, -2) || !lua_isinteger(L, -1))
+            return luaL_error(L, "enum value %d must be {name, description, value}", i + 1);
+        enumvals[i].name = wmem_strdup(wmem_epan_scope(), lua_tostring(L, -3));
+        enumvals[i].description = wmem_strdup(wmem_epan_scope(), lua_tostring(L, -2));
+        enumvals[i].value = (int)lua_tointeger(L, -1);
+        lua_pop(L, 4);
+    }
+    prefs_register_enum_preference(luaW_check_pref_module(L, 1), pref->name,
+                                    pref->title, pref->description, &pref->value.enumval,
+                                    enumvals, radio_buttons);
+    l_pref_add(L, pref);
+    return 0;
+}
+
+/***
+ * Create a new string preference
+ * @function register_string_preference
+ * @tparam PrefModule module the preferences module
+ * @string name the name
+ * @string title the title
+ * @string description the description
+ * @string value the preference default value
+ */
+static int wl_prefs_register_string_preference(lua_State *L)
+{
+    struct wl_preference *pref = l_pref_new(L, WL_PREF_STRING);
+    pref->value.string = wmem_strdup(wmem_epan_scope(), luaL_checkstring(L, 5));
+    prefs_register_string_preference(luaW_check_pref_module(L, 1), pref->name,
+                                    pref->title, pref->description, &pref->value.string);
+    l_pref_add(L, pref);
+    return 0;
+}
+
+/***
+ * Create a new filename preference
+ * @function register_filename_preference
+ * @tparam PrefModule module the preferences module
+ * @string name the name
+ * @string title the title
+ * @string description the description
+ * @string value the preference default value
+ * @bool[opt=false] for_writing the file is used for writing
+ */
+static int wl_prefs_register_filename_preference(lua_State *L)
+{
+    struct wl_preference *pref = l_pref_new(L, WL_PREF_FILENAME);
+    pref->value.string = wmem_strdup(wmem_epan_scope(), luaL_checkstring(L, 5));
+    prefs_register_filename_preference(luaW_check_pref_module(L, 1), pref->name,
+                                    pref->title, pref->description, &pref->value.string,
+                                    lua_toboolean(L, 6));
+    l_pref_add(L, pref);
+    return 0;
+}
+
+/***
+ * Create a new range preference
+ * @function register_range_preference
+ * @tparam PrefModule module the preferences module
+ * @string name the name
+ * @string title the title
+ * @string description the description
+ * @string value the preference default value, e.g. "80,8000-8080"
+ * @int max_value the maximum value in the range
+ */
+static int wl_prefs_register_range_preference(lua_State *L)
+{
+    struct wl_preference *pref = l_pref_new(L, WL_PREF_RANGE);
+    const char *value = luaL_checkstring(L, 5);
+    lua_Integer max_value = luaL_checkinteger(L, 6);
+    luaL_argcheck(L, max_value >= 0 && max_value <= UINT32_MAX, 6, "value out of range");
+
+    if (range_convert_str(wmem_epan_scope(), &pref->value.range, value, (uint32_t)max_value) != CVT_NO_ERROR)
+        return luaL_argerror(L, 5, "invalid range");
+    prefs_register_range_preference(luaW_check_pref_module(L, 1), pref->name,
+                                    pref->title, pref->description, &pref->value.range,
+                                    (uint32_t)max_value);
+    l_pref_add(L, pref);
+    return 0;
+}
+
+/*
+ * Adds or deletes 'handle' in a uint dissector table for the values of the
+ * range preference at index 'arg'. Added handles follow the preference:
+ * when its value changes they are moved to the new range.
+ */
+void luaW_pref_dissector_range(lua_State *L, int arg, const char *table,
+                                dissector_handle_t handle, bool add)
+{
+    struct wl_preference *pref = luaW_check_preference(L, arg);
+
+    if (pref->type != WL_PREF_RANGE)
+        luaL_argerror(L, arg, "preference is not a range");
+
+    l_push_module_state(L, pref->module);
+    lua_getfield(L, -1, "dissectors");
+    luaW_getsubtable(L, lua_gettop(L), pref->name, 0, 0);
+    lua_Integer len = luaL_len(L, -1);
+
+    if (add) {
+        dissector_add_uint_range(table, pref->value.range, handle);
+        lua_createtable(L, 0, 2);
+        lua_pushstring(L, table);
+        lua_setfield(L, -2, "table");
+        luaW_push_dissector_handle(L, handle);
+        lua_setfield(L, -2, "handle");
+        lua_rawseti(L, -2, len + 1);
+    }
+    else {
+        dissector_delete_uint_range(table, pref->value.range, handle);
+        for (lua_Integer i = 1; i <= len; i++) {
+            lua_rawgeti(L, -1, i);
+            lua_getfield(L, -1, "table");
+            lua_getfield(L, -2, "handle");
+            bool found = strcmp(lua_tostring(L, -2), table) == 0 &&
+                            luaW_check_dissector_handle(L, -1) == handle;
+            lua_pop(L, 3);
+            if (found) {
+                /* shift down the remaining entries */
+                for (; i < len; i++) {
+                    lua_rawgeti(L, -1, i + 1);
+                    lua_rawseti(L, -2, i);
+                }
+                lua_pushnil(L);
+                lua_rawseti(L, -2, len);
+                break;
+            }
+        }
+    }
+    lua_pop(L, 3);
+}
+
+/***
+ * Bind the preference values of a module to a table. The table is filled
+ * with the current values, keyed by preference name, and updated only when
+ * the preferences change, so reading it costs a table access.
+ * @function bind
+ * @tparam PrefModule module the preferences module
+ * @tparam[opt] table tbl the table to update, a new table by default
+ * @treturn table the bound table
+ */
+static int wl_prefs_bind(lua_State *L)
+{
+    luaW_check_pref_module(L, 1);
+    if (lua_isnoneornil(L, 2)) {
+        lua_settop(L, 1);
+        lua_newtable(L);
+    }
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+
+    l_get_module_state(L, 1);
+    lua_getfield(L, 3, "values");
+    lua_pushnil(L);
+    while (lua_next(L, 4) != 0) {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, 2);
+    }
+    lua_getfield(L, 3, "bound");
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+    lua_settop(L, 2);
+    return 1;
+}
+
+/***
+ * Register a function to be called when preference values change.
+ * The function is called as fn(name, value) for each preference of the
+ * module with a new value, after the bound tables have been updated.
+ * @function on_change
+ * @tparam PrefModule module the preferences module
+ * @func fn the callback
+ */
+static int wl_prefs_on_change(lua_State *L)
+{
+    luaW_check_pref_module(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    l_get_module_state(L, 1);
+    lua_getfield(L, -1, "on_change");
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+    return 0;
+}
+
+/***
+ * Set a preference and apply it, as with the -o command line option.
+ * Works with the preferences of any protocol, not only those created
+ * from Lua.
+ * @function set
+ * @string name the preference name, e.g. "tcp.desegment_tcp_streams"
+ * @param value the new value, converted to a string
+ */
+static int wl_prefs_set(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    const char *value = luaL_tolstring(L, 2, NULL);
+    char *prefarg = xstrdup(lua_pushfstring(L, "%s:%s", name, value));
+    char *errmsg = NULL;
+
+    /* prefs_set_pref() modifies its argument */
+    prefs_set_pref_e ret = prefs_set_pref(prefarg, &errmsg);
+    free(prefarg);
+    if (errmsg != NULL) {
+        lua_pushstring(L, errmsg);
+        g_free(errmsg);
+    }
+    else {
+        lua_pushliteral(L, "invalid value");
+    }
+    switch (ret) {
+        case PREFS_SET_OK:
+            break;
+        case PREFS_SET_NO_SUCH_PREF:
+            return luaL_error(L, "unknown preference %s", name);
+        case PREFS_SET_OBSOLETE:
+            return luaL_error(L, "obsolete preference %s", name);
+        default:
+            return luaL_error(L, "preference %s: %s", name, lua_tostring(L, -1));
+    }
+    prefs_apply_all();
     return 0;
 }
 
@@ -176,6 +646,14 @@ static const struct luaL_Reg wl_pref_module_m[] = {
 static const struct luaL_Reg wl_prefs_f[] = {
     { "register_protocol", wl_prefs_register_protocol },
     { "register_bool_preference", wl_prefs_register_bool_preference },
+    { "register_uint_preference", wl_prefs_register_uint_preference },
+    { "register_enum_preference", wl_prefs_register_enum_preference },
+    { "register_string_preference", wl_prefs_register_string_preference },
+    { "register_filename_preference", wl_prefs_register_filename_preference },
+    { "register_range_preference", wl_prefs_register_range_preference },
+    { "bind", wl_prefs_bind },
+    { "on_change", wl_prefs_on_change },
+    { "set", wl_prefs_set },
     { NULL, NULL }
 };
 
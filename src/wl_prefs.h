@@ -26,6 +26,11 @@ struct wl_preference *luaW_check_preference(lua_State *L, int arg);
 
 void luaW_push_preference(lua_State *L, struct wl_preference *pref);
 
+void luaW_push_pref_range(lua_State *L, struct wl_preference *pref);
+
+void luaW_pref_dissector_range(lua_State *L, int arg, const char *table,
+                                dissector_handle_t handle, bool add);
+
 void wl_open_prefs(lua_State *L);
 
 #endif
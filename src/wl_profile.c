@@ -0,0 +1,240 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <wsutil/file_util.h>
+#include <errno.h>
+#include <signal.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+/*
+ * The stack can only be read from a hook, so the timer signal leaves the
+ * sample pending and a count hook takes it. lua_sethook() is safe to call
+ * from a signal handler. The signal cannot tell which thread runs: every
+ * thread has a hook that polls every PROFILE_POLL_COUNT instructions (new
+ * threads copy the hook of their creator) and the signal makes the hook of
+ * the main thread take the sample at the next instruction. If another hook
+ * is set, for example by the CPU budget, that hook polls instead.
+ *
+ * Samples are stored by stack, root first:
+ *
+ *   dissector;function (file.lua:10);function (file.lua:42) 17
+ *
+ * Time spent outside of Lua dissectors is counted under [wireshark].
+ */
+
+#define PROFILE_INTERVAL_US     1000
+#define PROFILE_POLL_COUNT      1000
+#define PROFILE_MAX_DEPTH       64
+#define PROFILE_FRAME_MAX       160
+
+static struct {
+    lua_State *L;
+    char *path;
+    wmem_allocator_t *scope;
+    wmem_map_t *stacks;         /* stack string -> count */
+    const char *volatile dissector;
+    volatile sig_atomic_t pending;
+    volatile unsigned long outside;
+    unsigned long samples;
+} profile;
+
+bool luaW_profile_running(void)
+{
+    return profile.L != NULL;
+}
+
+const char *luaW_profile_enter(const char *dissector)
+{
+    const char *prev = profile.dissector;
+    if (prev == NULL)
+        profile.dissector = dissector;
+    return prev;
+}
+
+void luaW_profile_leave(const char *prev)
+{
+    if (prev == NULL)
+        profile.dissector = NULL;
+}
+
+/* Formats one frame, without the ';' separator */
+static void l_profile_frame(char *buf, size_t size, const lua_Debug *ar)
+{
+    const char *name = ar->name;
+
+    if (*ar->what == 'C') {
+        snprintf(buf, size, "%s [C]", name ? name : "?");
+    }
+    else if (*ar->what == 'm') {
+        snprintf(buf, size, "main chunk (%s:%d)", ar->short_src, ar->currentline);
+    }
+    else if (name != NULL) {
+        snprintf(buf, size, "%s (%s:%d)", name, ar->short_src, ar->currentline);
+    }
+    else {
+        snprintf(buf, size, "function <%s:%d> (%s:%d)", ar->short_src, ar->linedefined,
+                        ar->short_src, ar->currentline);
+    }
+    for (char *p = buf; *p != '\0'; p++) {
+        if (*p == ';')
+            *p = ':';
+    }
+}
+
+static void l_profile_sample(lua_State *L)
+{
+    char frames[PROFILE_MAX_DEPTH][PROFILE_FRAME_MAX];
+    lua_Debug ar;
+    int depth = 0;
+
+    while (depth < PROFILE_MAX_DEPTH && lua_getstack(L, depth, &ar)) {
+        lua_getinfo(L, "Sln", &ar);
+        l_profile_frame(frames[depth], sizeof(frames[depth]), &ar);
+        depth++;
+    }
+
+    wmem_strbuf_t *buf = wmem_strbuf_new(NULL, profile.dissector);
+    while (depth-- > 0) {
+        wmem_strbuf_append_c(buf, ';');
+        wmem_strbuf_append(buf, frames[depth]);
+    }
+    const char *stack = wmem_strbuf_get_str(buf);
+    const char *key;
+    void *count;
+    if (wmem_map_lookup_extended(profile.stacks, stack, (const void **)&key, &count))
+        wmem_map_insert(profile.stacks, key, GSIZE_TO_POINTER(GPOINTER_TO_SIZE(count) + 1));
+    else
+        wmem_map_insert(profile.stacks, wmem_strdup(profile.scope, stack), GSIZE_TO_POINTER(1));
+    wmem_strbuf_destroy(buf);
+    profile.samples++;
+}
+
+void luaW_profile_poll(lua_State *L)
+{
+    if (!profile.pending)
+        return;
+    profile.pending = 0;
+    if (profile.dissector == NULL)
+        profile.outside++;
+    else
+        l_profile_sample(L);
+}
+
+static void l_profile_hook(lua_State *L, lua_Debug *ar _U_)
+{
+    if (!luaW_profile_running()) {
+        /* A thread that kept the hook after the profiler stopped */
+        lua_sethook(L, NULL, 0, 0);
+        return;
+    }
+    if (lua_gethookcount(L) != PROFILE_POLL_COUNT)
+        lua_sethook(L, l_profile_hook, LUA_MASKCOUNT, PROFILE_POLL_COUNT);
+    luaW_profile_poll(L);
+}
+
+void luaW_profile_set_hook(lua_State *L)
+{
+    if (luaW_profile_running())
+        lua_sethook(L, l_profile_hook, LUA_MASKCOUNT, PROFILE_POLL_COUNT);
+    else
+        lua_sethook(L, NULL, 0, 0);
+}
+
+#ifndef _WIN32
+static void l_profile_signal(int sig _U_)
+{
+    if (profile.dissector == NULL) {
+        profile.outside++;
+        return;
+    }
+    profile.pending = 1;
+    if (lua_gethook(profile.L) == l_profile_hook)
+        lua_sethook(profile.L, l_profile_hook, LUA_MASKCOUNT, 1);
+}
+#endif
+
+void luaW_profile_start(lua_State *L, const char *path)
+{
+#ifdef _WIN32
+    ws_warning("The Lua profiler is not supported on Windows");
+#else
+    struct sigaction sa;
+    struct itimerval timer;
+
+    profile.L = L;
+    profile.path = xstrdup(path);
+    profile.scope = wmem_allocator_new(WMEM_ALLOCATOR_BLOCK);
+    profile.stacks = wmem_map_new(profile.scope, g_str_hash, g_str_equal);
+    luaW_profile_set_hook(L);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = l_profile_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = PROFILE_INTERVAL_US;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        ws_warning("Cannot start the Lua profiler: %s", strerror(errno));
+        luaW_profile_stop(L);
+        return;
+    }
+    ws_info("Lua profiler writing to %s", path);
+#endif
+}
+
+static void l_profile_write(void *key, void *value, void *user_data)
+{
+    fprintf(user_data, "%s %zu\n", (const char *)key, GPOINTER_TO_SIZE(value));
+}
+
+void luaW_profile_stop(lua_State *L)
+{
+#ifndef _WIN32
+    struct itimerval timer;
+
+    if (profile.L == NULL)
+        return;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_DFL);
+    if (lua_gethook(L) == l_profile_hook)
+        lua_sethook(L, NULL, 0, 0);
+
+    FILE *fp = ws_fopen(profile.path, "w");
+    if (fp == NULL) {
+        ws_warning("Cannot write the Lua profile to %s: %s", profile.path, strerror(errno));
+    }
+    else {
+        wmem_map_foreach(profile.stacks, l_profile_write, fp);
+        if (profile.outside > 0)
+            fprintf(fp, "[wireshark] %lu\n", profile.outside);
+        fclose(fp);
+        ws_info("Lua profiler wrote %lu samples to %s", profile.samples, profile.path);
+    }
+
+    wmem_destroy_allocator(profile.scope);
+    free(profile.path);
+    memset(&profile, 0, sizeof(profile));
+#endif
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_PROFILE_H_
+#define _WL_PROFILE_H_
+
+#include <stdbool.h>
+
+/*
+ * Sampling profiler, enabled with -X wslua2.profile:path. The Lua stack is
+ * sampled on a CPU time timer while Lua dissectors run and the samples are
+ * written in the collapsed stack format of flame graph tools.
+ */
+
+void luaW_profile_start(lua_State *L, const char *path);
+
+/* Writes the samples */
+void luaW_profile_stop(lua_State *L);
+
+bool luaW_profile_running(void);
+
+/* Samples are attributed to the outermost dissector entered */
+const char *luaW_profile_enter(const char *dissector);
+
+void luaW_profile_leave(const char *prev);
+
+/* Takes a pending sample, for hooks that replace the profiler hook */
+void luaW_profile_poll(lua_State *L);
+
+/* Gives a thread the profiler hook, or clears its hook if not running */
+void luaW_profile_set_hook(lua_State *L);
+
+#endif
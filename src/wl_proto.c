@@ -45,14 +45,20 @@ int luaW_check_protocol(lua_State *L, int arg)
 
 proto_item *luaW_check_proto_item(lua_State *L, int arg)
 {
-    proto_item **ptr = luaL_checkudata(L, arg, "wslua.ProtoItem");
-    return *ptr;
+    return luaW_check_handle(L, arg, WL_HANDLE_PROTO_ITEM);
 }
 
 proto_tree *luaW_check_proto_tree(lua_State *L, int arg)
 {
-    proto_tree **ptr = luaL_checkudata(L, arg, "wslua.ProtoTree");
-    return *ptr;
+    return luaW_check_handle(L, arg, WL_HANDLE_PROTO_TREE);
+}
+
+/* Returns NULL for a missing or nil tree, as when dissecting without a tree */
+proto_tree *luaW_opt_proto_tree(lua_State *L, int arg)
+{
+    if (lua_isnoneornil(L, arg))
+        return NULL;
+    return luaW_check_proto_tree(L, arg);
 }
 
 hf_register_info *luaW_check_hf_register_info(lua_State *L, int arg)
@@ -63,14 +69,12 @@ hf_register_info *luaW_check_hf_register_info(lua_State *L, int arg)
 
 void luaW_push_proto_item(lua_State *L, proto_item *item)
 {
-    proto_item **ptr = NEWUSERDATA(L, proto_item *, "wslua.ProtoItem");
-    *ptr = item;
+    luaW_push_handle(L, WL_HANDLE_PROTO_ITEM, item);
 }
 
 void luaW_push_proto_tree(lua_State *L, proto_tree *tree)
 {
-    proto_tree **ptr = NEWUSERDATA(L, proto_tree *, "wslua.ProtoTree");
-    *ptr = tree;
+    luaW_push_handle(L, WL_HANDLE_PROTO_TREE, tree);
 }
 
 void luaW_push_hf_register_info(lua_State *L, hf_register_info *hf)
@@ -115,7 +119,7 @@ lua_Integer luaW_check_offset_toint(lua_State *L, int arg)
  * @string name field name
  * @string abbrev field abbrev
  * @string ftype field type
- * @param[opt] strings VALS value or nil
+ * @param[opt] strings ValueString (vals, rvals or vals64) or nil
  * @string[optchain] display display base
  * @int[optchain] bitmask field bitmask
  * @string[optchain] blurb field blurb
@@ -137,13 +141,26 @@ static int new_hf_register_info(lua_State *L)
 
     lua_geti(L, 1, 5);
     struct wl_value_string *strings = luaW_opt_value_string(L, -1);
+    const void *strings_ptr = NULL;
     if (strings) {
         switch (strings->type) {
             case WL_VALS:
+                strings_ptr = strings->data.vals;
+                break;
+            case WL_VALS_EXT:
+                display |= BASE_EXT_STRING;
+                strings_ptr = strings->data.vals_ext;
                 break;
             case WL_RVALS:
                 display |= BASE_RANGE_STRING;
+                strings_ptr = strings->data.rvals;
+                break;
+            case WL_VALS64:
+                display |= BASE_VAL64_STRING;
+                strings_ptr = strings->data.vals64;
                 break;
+            case WL_STRSTRS:
+                return luaL_error(L, "string to string mappings cannot be used with fields");
             default:
                 ws_assert_not_reached();
         }
@@ -162,7 +179,7 @@ static int new_hf_register_info(lua_State *L)
     hf->hfinfo.abbrev = wmem_strdup(wmem_epan_scope(), abbrev);
     hf->hfinfo.type = type;
     hf->hfinfo.display = display;
-    hf->hfinfo.strings = strings ? strings->data.vals : NULL;
+    hf->hfinfo.strings = strings_ptr;
     hf->hfinfo.bitmask = bitmask;
     hf->hfinfo.blurb = wmem_strdup(wmem_epan_scope(), blurb);
     hf->hfinfo.id = -1;
@@ -20,6 +20,8 @@
 
 proto_tree *luaW_check_proto_tree(lua_State *L, int arg);
 
+proto_tree *luaW_opt_proto_tree(lua_State *L, int arg);
+
 proto_item *luaW_check_proto_item(lua_State *L, int arg);
 
 int luaW_check_protocol(lua_State *L, int arg);
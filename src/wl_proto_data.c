@@ -0,0 +1,311 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <epan/proto_data.h>
+
+/***
+ * @module wireshark
+ */
+
+/*
+ * Lua values stored with a frame. Scalars and strings are copied into file
+ * scope memory. Other values are referenced from a per-file table.
+ */
+enum {
+    FV_NIL,
+    FV_BOOLEAN,
+    FV_INTEGER,
+    FV_NUMBER,
+    FV_STRING,
+    FV_REF,
+};
+
+struct wl_frame_value {
+    int type;
+    union {
+        bool b;
+        lua_Integer i;
+        lua_Number n;
+        int ref;
+        size_t len;
+    } u;
+    char str[];
+};
+
+#define FRAME_VALUES "frame_values"
+
+/* Memoized values of a frame, keyed by string or integer */
+struct wl_memo {
+    struct wl_memo *next;
+    struct wl_frame_value *key;
+    struct wl_frame_value *value;
+};
+
+/* Frame number -> struct wl_memo list, reset with the file scope */
+static wmem_map_t *memo_frames = NULL;
+
+static void l_push_frame_values(lua_State *L)
+{
+    luaW_push_file_table(L);
+    if (lua_getfield(L, -1, FRAME_VALUES) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, FRAME_VALUES);
+    }
+    lua_remove(L, -2);
+}
+
+static struct wl_frame_value *l_frame_value_new(lua_State *L, int idx)
+{
+    struct wl_frame_value *fv;
+    const char *str;
+    size_t len;
+
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            fv = wmem_new(wmem_file_scope(), struct wl_frame_value);
+            fv->type = FV_NIL;
+            break;
+        case LUA_TBOOLEAN:
+            fv = wmem_new(wmem_file_scope(), struct wl_frame_value);
+            fv->type = FV_BOOLEAN;
+            fv->u.b = lua_toboolean(L, idx);
+            break;
+        case LUA_TNUMBER:
+            fv = wmem_new(wmem_file_scope(), struct wl_frame_value);
+            if (lua_isinteger(L, idx)) {
+                fv->type = FV_INTEGER;
+                fv->u.i = lua_tointeger(L, idx);
+            }
+            else {
+                fv->type = FV_NUMBER;
+                fv->u.n = lua_tonumber(L, idx);
+            }
+            break;
+        case LUA_TSTRING:
+            str = lua_tolstring(L, idx, &len);
+            fv = wmem_alloc(wmem_file_scope(), sizeof(*fv) + len);
+            fv->type = FV_STRING;
+            fv->u.len = len;
+            memcpy(fv->str, str, len);
+            break;
+        default:
+            idx = lua_absindex(L, idx);
+            fv = wmem_new(wmem_file_scope(), struct wl_frame_value);
+            fv->type = FV_REF;
+            l_push_frame_values(L);
+            lua_pushvalue(L, idx);
+            fv->u.ref = luaL_ref(L, -2);
+            lua_pop(L, 1);
+            break;
+    }
+    return fv;
+}
+
+static void l_frame_value_push(lua_State *L, const struct wl_frame_value *fv)
+{
+    switch (fv->type) {
+        case FV_NIL:
+            lua_pushnil(L);
+            break;
+        case FV_BOOLEAN:
+            lua_pushboolean(L, fv->u.b);
+            break;
+        case FV_INTEGER:
+            lua_pushinteger(L, fv->u.i);
+            break;
+        case FV_NUMBER:
+            lua_pushnumber(L, fv->u.n);
+            break;
+        case FV_STRING:
+            lua_pushlstring(L, fv->str, fv->u.len);
+            break;
+        case FV_REF:
+            l_push_frame_values(L);
+            lua_rawgeti(L, -1, fv->u.ref);
+            lua_remove(L, -2);
+            break;
+        default:
+            ws_assert_not_reached();
+    }
+}
+
+static void l_frame_value_free(lua_State *L, struct wl_frame_value *fv)
+{
+    if (fv->type == FV_REF) {
+        l_push_frame_values(L);
+        luaL_unref(L, -1, fv->u.ref);
+        lua_pop(L, 1);
+    }
+    wmem_free(wmem_file_scope(), fv);
+}
+
+/* Compares a memo key with the string or integer at 'idx' */
+static bool l_memo_key_equal(lua_State *L, const struct wl_frame_value *key, int idx)
+{
+    const char *str;
+    size_t len;
+
+    if (lua_type(L, idx) == LUA_TSTRING) {
+        if (key->type != FV_STRING)
+            return false;
+        str = lua_tolstring(L, idx, &len);
+        return key->u.len == len && memcmp(key->str, str, len) == 0;
+    }
+    return key->type == FV_INTEGER && key->u.i == lua_tointeger(L, idx);
+}
+
+/***
+ * Attach a value to the frame for a protocol
+ *
+ * The value is kept for the lifetime of the capture file and can be read
+ * back in any later pass over the frame.
+ * @function p_add_proto_data
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam Protocol proto the protocol
+ * @int key a key to tell apart several values of the protocol
+ * @param value any Lua value
+ */
+static int wl_p_add_proto_data(lua_State *L)
+{
+    packet_info *pinfo = luaW_check_pinfo(L, 1);
+    int proto = luaW_check_protocol(L, 2);
+    uint32_t key = (uint32_t)luaL_checkinteger(L, 3);
+    luaL_checkany(L, 4);
+
+    struct wl_frame_value *fv = p_get_proto_data(wmem_file_scope(), pinfo, proto, key);
+    if (fv != NULL) {
+        p_remove_proto_data(wmem_file_scope(), pinfo, proto, key);
+        l_frame_value_free(L, fv);
+    }
+    fv = l_frame_value_new(L, 4);
+    p_add_proto_data(wmem_file_scope(), pinfo, proto, key, fv);
+    return 0;
+}
+
+/***
+ * Get a value attached to the frame
+ * @function p_get_proto_data
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam Protocol proto the protocol
+ * @int key the key
+ * @return the value or nil
+ */
+static int wl_p_get_proto_data(lua_State *L)
+{
+    packet_info *pinfo = luaW_check_pinfo(L, 1);
+    int proto = luaW_check_protocol(L, 2);
+    uint32_t key = (uint32_t)luaL_checkinteger(L, 3);
+
+    struct wl_frame_value *fv = p_get_proto_data(wmem_file_scope(), pinfo, proto, key);
+    if (fv == NULL)
+        lua_pushnil(L);
+    else
+        l_frame_value_push(L, fv);
+    return 1;
+}
+
+/***
+ * Remove a value attached to the frame
+ * @function p_remove_proto_data
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam Protocol proto the protocol
+ * @int key the key
+ */
+static int wl_p_remove_proto_data(lua_State *L)
+{
+    packet_info *pinfo = luaW_check_pinfo(L, 1);
+    int proto = luaW_check_protocol(L, 2);
+    uint32_t key = (uint32_t)luaL_checkinteger(L, 3);
+
+    struct wl_frame_value *fv = p_get_proto_data(wmem_file_scope(), pinfo, proto, key);
+    if (fv != NULL) {
+        p_remove_proto_data(wmem_file_scope(), pinfo, proto, key);
+        l_frame_value_free(L, fv);
+    }
+    return 0;
+}
+
+/* Pushes the value memoized for the frame with the key at index 2, if any */
+static bool l_memo_push(lua_State *L, uint32_t num)
+{
+    struct wl_memo *m = wmem_map_lookup(memo_frames, GUINT_TO_POINTER(num));
+    for (; m != NULL; m = m->next) {
+        if (l_memo_key_equal(L, m->key, 2)) {
+            l_frame_value_push(L, m->value);
+            return true;
+        }
+    }
+    return false;
+}
+
+/***
+ * Compute a value once per frame
+ *
+ * The first time the key is seen for the frame fn(...) is called and its
+ * first result is stored. Later calls for the same frame, such as in the
+ * second pass, return the stored value without calling fn.
+ * @function memo
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam string|int key the key, unique for the frame
+ * @tparam function fn the function computing the value
+ * @param ... arguments for fn
+ * @return the value
+ */
+static int wl_memo(lua_State *L)
+{
+    packet_info *pinfo = luaW_check_pinfo(L, 1);
+    int type = lua_type(L, 2);
+    luaL_argexpected(L, type == LUA_TSTRING ||
+                        (type == LUA_TNUMBER && lua_isinteger(L, 2)), 2, "string or integer");
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    if (memo_frames == NULL)
+        memo_frames = wmem_map_new_autoreset(wmem_epan_scope(), wmem_file_scope(),
+                                                g_direct_hash, g_direct_equal);
+
+    if (l_memo_push(L, pinfo->num))
+        return 1;
+
+    lua_call(L, lua_gettop(L) - 3, 1);
+    /* fn may have memoized values of the same frame, even this key */
+    if (l_memo_push(L, pinfo->num))
+        return 1;
+    struct wl_memo *m = wmem_new(wmem_file_scope(), struct wl_memo);
+    m->key = l_frame_value_new(L, 2);
+    m->value = l_frame_value_new(L, -1);
+    m->next = wmem_map_lookup(memo_frames, GUINT_TO_POINTER(pinfo->num));
+    wmem_map_insert(memo_frames, GUINT_TO_POINTER(pinfo->num), m);
+    return 1;
+}
+
+static const struct luaL_Reg wl_proto_data_f[] = {
+    { "p_add_proto_data", wl_p_add_proto_data },
+    { "p_get_proto_data", wl_p_get_proto_data },
+    { "p_remove_proto_data", wl_p_remove_proto_data },
+    { "memo", wl_memo },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_proto_data(lua_State *L)
+{
+    luaL_setfuncs(L, wl_proto_data_f, 0);
+}
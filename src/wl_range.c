@@ -0,0 +1,234 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+/***
+ * @module wireshark
+ */
+
+struct wl_range *luaW_check_range(lua_State *L, int arg)
+{
+    struct wl_range *ptr = luaL_checkudata(L, arg, "wslua.Range");
+    return ptr;
+}
+
+/*
+ * The bitmap covers the values from the lowest to the highest bound of the
+ * range, so port ranges cost at most 8 KiB and usually much less.
+ */
+static void l_range_build_bitmap(struct wl_range *r)
+{
+    const range_t *range = r->range;
+    uint32_t low = UINT32_MAX, high = 0;
+
+    r->bitmap = NULL;
+    r->base = 0;
+    r->span = 0;
+
+    for (unsigned i = 0; i < range->nranges; i++) {
+        if (range->ranges[i].low < low)
+            low = range->ranges[i].low;
+        if (range->ranges[i].high > high)
+            high = range->ranges[i].high;
+    }
+    if (range->nranges == 0 || (uint64_t)high - low >= WL_RANGE_BITMAP_MAX)
+        return;
+
+    r->base = low;
+    r->span = high - low + 1;
+    r->bitmap = xmalloc((r->span + 63) / 64 * sizeof(uint64_t));
+    memset(r->bitmap, 0, (r->span + 63) / 64 * sizeof(uint64_t));
+
+    for (unsigned i = 0; i < range->nranges; i++) {
+        for (uint32_t v = range->ranges[i].low - low; v <= range->ranges[i].high - low; v++)
+            r->bitmap[v / 64] |= UINT64_C(1) << (v % 64);
+    }
+}
+
+void wl_range_init(struct wl_range *r, const range_t *range)
+{
+    r->range = range_copy(NULL, range);
+    l_range_build_bitmap(r);
+}
+
+void wl_range_free(struct wl_range *r)
+{
+    wmem_free(NULL, r->range);
+    free(r->bitmap);
+    r->range = NULL;
+    r->bitmap = NULL;
+}
+
+void luaW_push_range(lua_State *L, const range_t *range)
+{
+    struct wl_range *ptr = NEWUSERDATA(L, struct wl_range, "wslua.Range");
+    wl_range_init(ptr, range);
+}
+
+/*
+ * Accepts a Range, a range Preference or a string. Returns a range owned by
+ * the argument, valid while it is on the stack.
+ */
+range_t *luaW_check_range_arg(lua_State *L, int arg, uint32_t max_value)
+{
+    struct wl_range *r;
+
+    if (lua_type(L, arg) == LUA_TSTRING) {
+        const char *str = lua_tostring(L, arg);
+        range_t *range;
+        if (range_convert_str(NULL, &range, str, max_value) != CVT_NO_ERROR)
+            luaL_argerror(L, arg, "invalid range");
+        luaW_push_range(L, range);
+        wmem_free(NULL, range);
+        lua_replace(L, arg);
+    }
+    else if (luaL_testudata(L, arg, "wslua.Preference")) {
+        luaW_push_pref_range(L, luaW_check_preference(L, arg));
+        lua_replace(L, arg);
+    }
+    r = luaW_check_range(L, arg);
+    return r->range;
+}
+
+bool wl_range_contains(const struct wl_range *r, uint32_t value)
+{
+    if (r->bitmap != NULL) {
+        uint32_t v = value - r->base;
+        if (v >= r->span)
+            return false;
+        return (r->bitmap[v / 64] >> (v % 64)) & 1;
+    }
+    return value_is_in_range(r->range, value);
+}
+
+/***
+ * A range of unsigned integers, such as a list of ports.
+ * Indexing a Range with an integer tests membership, e.g. `if range[port] then`.
+ * @type Range
+ */
+
+/***
+ * Test if a value is in the range
+ * @function contains
+ * @int value the value
+ * @treturn bool true if the range contains the value
+ */
+static int wl_range_contains_m(lua_State *L)
+{
+    struct wl_range *r = luaW_check_range(L, 1);
+    lua_Integer value = luaL_checkinteger(L, 2);
+    lua_pushboolean(L, value >= 0 && value <= UINT32_MAX && wl_range_contains(r, (uint32_t)value));
+    return 1;
+}
+
+static int wl_range_index(lua_State *L)
+{
+    struct wl_range *r = luaW_check_range(L, 1);
+    int isnum;
+    lua_Integer value = lua_tointegerx(L, 2, &isnum);
+
+    if (isnum) {
+        lua_pushboolean(L, value >= 0 && value <= UINT32_MAX && wl_range_contains(r, (uint32_t)value));
+        return 1;
+    }
+    lua_getmetatable(L, 1);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+}
+
+static int wl_range_eq(lua_State *L)
+{
+    struct wl_range *r1 = luaW_check_range(L, 1);
+    struct wl_range *r2 = luaW_check_range(L, 2);
+    lua_pushboolean(L, ranges_are_equal(r1->range, r2->range));
+    return 1;
+}
+
+static int wl_range_tostring(lua_State *L)
+{
+    struct wl_range *r = luaW_check_range(L, 1);
+    char *str = range_convert_range(NULL, r->range);
+    lua_pushstring(L, str);
+    wmem_free(NULL, str);
+    return 1;
+}
+
+static int wl_range_gc(lua_State *L)
+{
+    struct wl_range *r = luaW_check_range(L, 1);
+    wl_range_free(r);
+    return 0;
+}
+
+/***
+ * Create a new Range
+ * @function Range.new
+ * @string str the range representation, e.g. "80,8000-8080"
+ * @int[opt=0xffffffff] max_value the maximum value allowed in the range
+ * @treturn Range
+ */
+static int wl_range_new(lua_State *L)
+{
+    const char *str = luaL_checkstring(L, 1);
+    lua_Integer max_value = luaL_optinteger(L, 2, UINT32_MAX);
+    range_t *range;
+
+    luaL_argcheck(L, max_value >= 0 && max_value <= UINT32_MAX, 2, "value out of range");
+    switch (range_convert_str(NULL, &range, str, (uint32_t)max_value)) {
+        case CVT_NO_ERROR:
+            break;
+        case CVT_NUMBER_TOO_BIG:
+            return luaL_argerror(L, 1, "value too large");
+        default:
+            return luaL_argerror(L, 1, "invalid range");
+    }
+    luaW_push_range(L, range);
+    wmem_free(NULL, range);
+    return 1;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_range_m[] = {
+    { "contains", wl_range_contains_m },
+    { "__eq", wl_range_eq },
+    { "__tostring", wl_range_tostring },
+    { "__gc", wl_range_gc },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_range_f[] = {
+    { "new", wl_range_new },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_range(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.Range", wl_range_m);
+    /* Replaces the __index set by luaW_newmetatable */
+    luaL_getmetatable(L, "wslua.Range");
+    lua_pushcfunction(L, wl_range_index);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+    luaL_newlib(L, wl_range_f);
+    lua_setfield(L, -2, "Range");
+}
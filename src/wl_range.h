@@ -0,0 +1,48 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_RANGE_H_
+#define _WL_RANGE_H_
+
+#include <epan/range.h>
+
+/* Ranges spanning more values than this are not given a membership bitmap */
+#define WL_RANGE_BITMAP_MAX     (1U << 20)
+
+struct wl_range {
+    range_t *range;
+    uint32_t base;          /* first value in the bitmap */
+    uint32_t span;          /* number of bits in the bitmap */
+    uint64_t *bitmap;
+};
+
+struct wl_range *luaW_check_range(lua_State *L, int arg);
+
+void luaW_push_range(lua_State *L, const range_t *range);
+
+range_t *luaW_check_range_arg(lua_State *L, int arg, uint32_t max_value);
+
+/* Copies 'range' and builds the membership bitmap */
+void wl_range_init(struct wl_range *r, const range_t *range);
+
+void wl_range_free(struct wl_range *r);
+
+bool wl_range_contains(const struct wl_range *r, uint32_t value);
+
+void wl_open_range(lua_State *L);
+
+#endif
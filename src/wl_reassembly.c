@@ -0,0 +1,312 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <epan/reassemble.h>
+
+/***
+ * @module wireshark
+ */
+
+enum {
+    HF_FRAGMENTS,
+    HF_FRAGMENT,
+    HF_FRAGMENT_OVERLAP,
+    HF_FRAGMENT_OVERLAP_CONFLICT,
+    HF_FRAGMENT_MULTIPLE_TAILS,
+    HF_FRAGMENT_TOO_LONG_FRAGMENT,
+    HF_FRAGMENT_ERROR,
+    HF_FRAGMENT_COUNT,
+    HF_REASSEMBLED_IN,
+    HF_REASSEMBLED_LENGTH,
+    HF_MAX
+};
+
+static const struct {
+    const char *abbrev;
+    const char *name;
+    enum ftenum type;
+    int display;
+} reassembly_fields[HF_MAX] = {
+    { "fragments", "Fragments", FT_NONE, BASE_NONE },
+    { "fragment", "Fragment", FT_FRAMENUM, BASE_NONE },
+    { "fragment.overlap", "Fragment overlap", FT_BOOLEAN, BASE_NONE },
+    { "fragment.overlap.conflicts", "Conflicting data in fragment overlap", FT_BOOLEAN, BASE_NONE },
+    { "fragment.multiple_tails", "Multiple tail fragments found", FT_BOOLEAN, BASE_NONE },
+    { "fragment.too_long_fragment", "Fragment too long", FT_BOOLEAN, BASE_NONE },
+    { "fragment.error", "Defragmentation error", FT_FRAMENUM, BASE_NONE },
+    { "fragment.count", "Fragment count", FT_UINT32, BASE_DEC },
+    { "reassembled.in", "Reassembled in", FT_FRAMENUM, BASE_NONE },
+    { "reassembled.length", "Reassembled length", FT_UINT32, BASE_DEC },
+};
+
+/*
+ * Allocated with epan scope. The fragment data itself is owned by the
+ * reassembly table and released by epan when the capture file is closed.
+ */
+struct wl_reassembly {
+    reassembly_table table;
+    const reassembly_table_functions *funcs;
+    fragment_items items;
+    int hf[HF_MAX];
+    int ett[2];
+};
+
+static struct wl_reassembly *luaW_check_reassembly(lua_State *L, int arg)
+{
+    struct wl_reassembly **ptr = luaL_checkudata(L, arg, "wslua.ReassemblyTable");
+    return *ptr;
+}
+
+/* Fragment heads are freed with the reassembly table data at file close */
+struct wl_fragment_head {
+    fragment_head *fh;
+    unsigned file;
+};
+
+static fragment_head *luaW_opt_fragment_head(lua_State *L, int arg)
+{
+    if (lua_isnoneornil(L, arg))
+        return NULL;
+    struct wl_fragment_head *ptr = luaL_checkudata(L, arg, "wslua.FragmentHead");
+    if (ptr->file != luaW_file_generation())
+        luaL_error(L, "fragment head used after the capture file was closed");
+    return ptr->fh;
+}
+
+static void luaW_push_fragment_head(lua_State *L, fragment_head *fh)
+{
+    if (fh == NULL) {
+        lua_pushnil(L);
+        return;
+    }
+    struct wl_fragment_head *ptr = NEWUSERDATA(L, struct wl_fragment_head, "wslua.FragmentHead");
+    ptr->fh = fh;
+    ptr->file = luaW_file_generation();
+}
+
+static void l_register_fields(struct wl_reassembly *r, int proto)
+{
+    const char *filter_name = proto_get_protocol_filter_name(proto);
+    hf_register_info *hf = wmem_alloc0_array(wmem_epan_scope(), hf_register_info, HF_MAX);
+    int *ett[2];
+
+    for (int i = 0; i < HF_MAX; i++) {
+        r->hf[i] = -1;
+        hf[i].p_id = &r->hf[i];
+        hf[i].hfinfo.name = reassembly_fields[i].name;
+        hf[i].hfinfo.abbrev = wmem_strdup_printf(wmem_epan_scope(), "%s.%s",
+                                            filter_name, reassembly_fields[i].abbrev);
+        hf[i].hfinfo.type = reassembly_fields[i].type;
+        hf[i].hfinfo.display = reassembly_fields[i].display;
+        hf[i].hfinfo.id = -1;
+        hf[i].hfinfo.ref_type = HF_REF_TYPE_NONE;
+        hf[i].hfinfo.same_name_prev_id = -1;
+    }
+    proto_register_field_array(proto, hf, HF_MAX);
+
+    r->ett[0] = r->ett[1] = -1;
+    ett[0] = &r->ett[0];
+    ett[1] = &r->ett[1];
+    proto_register_subtree_array(ett, 2);
+
+    r->items.ett_fragment = &r->ett[0];
+    r->items.ett_fragments = &r->ett[1];
+    r->items.hf_fragments = &r->hf[HF_FRAGMENTS];
+    r->items.hf_fragment = &r->hf[HF_FRAGMENT];
+    r->items.hf_fragment_overlap = &r->hf[HF_FRAGMENT_OVERLAP];
+    r->items.hf_fragment_overlap_conflict = &r->hf[HF_FRAGMENT_OVERLAP_CONFLICT];
+    r->items.hf_fragment_multiple_tails = &r->hf[HF_FRAGMENT_MULTIPLE_TAILS];
+    r->items.hf_fragment_too_long_fragment = &r->hf[HF_FRAGMENT_TOO_LONG_FRAGMENT];
+    r->items.hf_fragment_error = &r->hf[HF_FRAGMENT_ERROR];
+    r->items.hf_fragment_count = &r->hf[HF_FRAGMENT_COUNT];
+    r->items.hf_reassembled_in = &r->hf[HF_REASSEMBLED_IN];
+    r->items.hf_reassembled_length = &r->hf[HF_REASSEMBLED_LENGTH];
+    r->items.hf_reassembled_data = NULL;
+}
+
+/***
+ * Fragment reassembly table class.
+ * @type ReassemblyTable
+ */
+
+/***
+ * Register a new reassembly table
+ *
+ * Must be called when the script is loaded. The fragment fields are
+ * registered under the protocol's filter name (e.g. "foo.fragment").
+ * Fragments are matched by id and by the packet addresses, and also by
+ * the ports if 'with_ports' is true.
+ * @function ReassemblyTable.new
+ * @tparam Protocol proto the protocol owning the fragments
+ * @string tag name used in the fragment tree, e.g. "Message fragments"
+ * @bool[opt=false] with_ports match fragments by port as well
+ * @treturn ReassemblyTable
+ */
+static int wl_reassembly_new(lua_State *L)
+{
+    int proto = luaW_check_protocol(L, 1);
+    const char *tag = luaL_checkstring(L, 2);
+    bool with_ports = lua_toboolean(L, 3);
+
+    struct wl_reassembly *r = wmem_new0(wmem_epan_scope(), struct wl_reassembly);
+    l_register_fields(r, proto);
+    r->items.tag = wmem_strdup(wmem_epan_scope(), tag);
+    r->funcs = with_ports ? &addresses_ports_reassembly_table_functions :
+                            &addresses_reassembly_table_functions;
+    reassembly_table_register(&r->table, r->funcs);
+
+    struct wl_reassembly **ptr = NEWUSERDATA(L, struct wl_reassembly *, "wslua.ReassemblyTable");
+    *ptr = r;
+    return 1;
+}
+
+/*
+ * Registered tables are initialized when a capture file is opened. A table
+ * used before that, e.g. by a script run at startup, is initialized here
+ * and emptied again when the file is opened.
+ */
+static reassembly_table *l_reassembly_table(struct wl_reassembly *r)
+{
+    if (r->table.fragment_table == NULL)
+        reassembly_table_init(&r->table, r->funcs);
+    return &r->table;
+}
+
+typedef fragment_head *(*l_fragment_add_func)(reassembly_table *, tvbuff_t *, const int,
+                            const packet_info *, const uint32_t, const void *,
+                            const uint32_t, const uint32_t, const bool);
+
+static int l_reassembly_add(lua_State *L, l_fragment_add_func fragment_add)
+{
+    struct wl_reassembly *r = luaW_check_reassembly(L, 1);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+    int offset = (int)luaW_check_offset_toint(L, 3);
+    packet_info *pinfo = luaW_check_pinfo(L, 4);
+    uint32_t id = (uint32_t)luaL_checkinteger(L, 5);
+    uint32_t frag = (uint32_t)luaL_checkinteger(L, 6);
+    uint32_t frag_len = (uint32_t)luaL_checkinteger(L, 7);
+    bool more_frags = lua_toboolean(L, 8);
+    reassembly_table *table = l_reassembly_table(r);
+    fragment_head *fh = NULL;
+
+    LUAW_TRY(L, fh = fragment_add(table, tvb, offset, pinfo, id, NULL, frag, frag_len, more_frags));
+    luaW_push_fragment_head(L, fh);
+    return 1;
+}
+
+/***
+ * Add a fragment identified by its sequence number
+ * @function add_seq
+ * @tparam TVBuff tvb a TVBuff
+ * @tparam int|Offset offset offset of the fragment data in tvb
+ * @tparam PacketInfo pinfo a packet info
+ * @int id the message identifier
+ * @int frag_number the fragment sequence number, starting at 0
+ * @int frag_len the length of the fragment data
+ * @bool more_frags false if this is the last fragment
+ * @treturn FragmentHead|nil the fragment head if the message is complete
+ */
+static int wl_reassembly_add_seq(lua_State *L)
+{
+    return l_reassembly_add(L, fragment_add_seq_check);
+}
+
+/***
+ * Add a fragment identified by its byte offset in the message
+ * @function add
+ * @tparam TVBuff tvb a TVBuff
+ * @tparam int|Offset offset offset of the fragment data in tvb
+ * @tparam PacketInfo pinfo a packet info
+ * @int id the message identifier
+ * @int frag_offset the offset of the fragment in the reassembled message
+ * @int frag_len the length of the fragment data
+ * @bool more_frags false if this is the last fragment
+ * @treturn FragmentHead|nil the fragment head if the message is complete
+ */
+static int wl_reassembly_add_offset(lua_State *L)
+{
+    return l_reassembly_add(L, fragment_add_check);
+}
+
+/***
+ * Build the reassembled message and add the fragment tree
+ *
+ * The reassembled TVBuff is added as a new data source. The fragment head
+ * is only valid while dissecting the packet that returned it.
+ * @function process
+ * @tparam TVBuff tvb a TVBuff
+ * @tparam int|Offset offset offset of the fragment data in tvb
+ * @tparam PacketInfo pinfo a packet info
+ * @string name the name of the data source, e.g. "Reassembled Foo"
+ * @tparam FragmentHead|nil fh the value returned by add() or add_seq()
+ * @tparam[opt] ProtoTree tree a proto tree
+ * @treturn TVBuff|nil the reassembled TVBuff or nil if the message is not complete in this packet
+ * @treturn bool whether the Info column should be updated
+ */
+static int wl_reassembly_process(lua_State *L)
+{
+    struct wl_reassembly *r = luaW_check_reassembly(L, 1);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+    int offset = (int)luaW_check_offset_toint(L, 3);
+    packet_info *pinfo = luaW_check_pinfo(L, 4);
+    const char *name = luaL_checkstring(L, 5);
+    fragment_head *fh = luaW_opt_fragment_head(L, 6);
+    proto_tree *tree = luaW_opt_proto_tree(L, 7);
+    const char *pool_name = wmem_strdup(pinfo->pool, name);
+    bool update_col = true;
+    tvbuff_t *new_tvb = NULL;
+
+    LUAW_TRY(L, new_tvb = process_reassembled_data(tvb, offset, pinfo, pool_name, fh,
+                                                    &r->items, &update_col, tree));
+    if (new_tvb != NULL)
+        luaW_push_tvbuff(L, new_tvb);
+    else
+        lua_pushnil(L);
+    lua_pushboolean(L, update_col);
+    return 2;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_reassembly_m[] = {
+    { "add_seq", wl_reassembly_add_seq },
+    { "add", wl_reassembly_add_offset },
+    { "process", wl_reassembly_process },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_fragment_head_m[] = {
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_reassembly_f[] = {
+    { "new", wl_reassembly_new },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_reassembly(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.ReassemblyTable", wl_reassembly_m);
+    luaW_newmetatable(L, "wslua.FragmentHead", wl_fragment_head_m);
+    luaL_newlib(L, wl_reassembly_f);
+    lua_setfield(L, -2, "ReassemblyTable");
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "wl_stats.h"
+
+/*
+ * Histogram kernel. A single table serialises on the load-increment-store
+ * of repeated byte values (very common for padding and zeros), so the
+ * counts are spread over four tables that are summed at the end. The
+ * input is read eight bytes at a time.
+ */
+void wl_byte_histogram(uint32_t hist[256], const uint8_t *src, size_t len)
+{
+    uint32_t t[4][256];
+    const uint8_t *end = src + len;
+    uint64_t w;
+
+    memset(t, 0, sizeof(t));
+
+    for (; end - src >= 8; src += 8) {
+        memcpy(&w, src, 8);
+        t[0][(uint8_t)w]++;
+        t[1][(uint8_t)(w >> 8)]++;
+        t[2][(uint8_t)(w >> 16)]++;
+        t[3][(uint8_t)(w >> 24)]++;
+        t[0][(uint8_t)(w >> 32)]++;
+        t[1][(uint8_t)(w >> 40)]++;
+        t[2][(uint8_t)(w >> 48)]++;
+        t[3][(uint8_t)(w >> 56)]++;
+    }
+    while (src < end)
+        t[0][*src++]++;
+
+    for (int i = 0; i < 256; i++)
+        hist[i] += t[0][i] + t[1][i] + t[2][i] + t[3][i];
+}
+
+void wl_byte_stats(struct wl_byte_stats *stats, const uint32_t hist[256], size_t len)
+{
+    double entropy = 0;
+    size_t printable = 0;
+
+    if (len > 0) {
+        double inv = 1.0 / (double)len;
+        for (int i = 0; i < 256; i++) {
+            if (hist[i] == 0)
+                continue;
+            double p = hist[i] * inv;
+            entropy -= p * log2(p);
+        }
+    }
+    for (int i = 0x20; i < 0x7f; i++)
+        printable += hist[i];
+
+    /* avoid -0.0 */
+    stats->entropy = entropy > 0 ? entropy : 0;
+    stats->printable = printable;
+    stats->zero = hist[0];
+    stats->len = len;
+}
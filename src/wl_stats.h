@@ -0,0 +1,37 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WL_STATS_H_
+#define _WL_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct wl_byte_stats {
+    double entropy;         /* Shannon entropy in bits per byte (0 to 8) */
+    size_t printable;       /* count of printable ASCII bytes (0x20-0x7e) */
+    size_t zero;            /* count of zero bytes */
+    size_t len;
+};
+
+/* Adds the byte counts of 'src' to 'hist'. */
+void wl_byte_histogram(uint32_t hist[256], const uint8_t *src, size_t len);
+
+/* Computes the statistics from a histogram of 'len' bytes. */
+void wl_byte_stats(struct wl_byte_stats *stats, const uint32_t hist[256], size_t len);
+
+#endif
@@ -0,0 +1,498 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <epan/conversation.h>
+
+/***
+ * @module wireshark
+ */
+
+enum {
+    WL_STREAM_RUNNING,
+    WL_STREAM_DONE,
+    WL_STREAM_FAILED,
+};
+
+/*
+ * A streaming parser. The parser function runs in its own coroutine and
+ * suspends inside need() until enough bytes have been fed. Unconsumed bytes
+ * are kept in a C buffer. The uservalue holds { fn, thread, out } where
+ * 'out' collects the values emitted during the current feed().
+ */
+struct wl_stream {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    size_t pos;
+    int status;
+    bool started;
+    lua_Integer nout;   /* values emitted in the current feed() */
+};
+
+#define STREAM_FN       1
+#define STREAM_THREAD   2
+#define STREAM_OUT      3
+
+/* Per-file flow state. The addresses of 'key' identify each direction. */
+struct wl_stream_flow {
+    address src;
+    uint32_t srcport;
+    char key[2];
+};
+
+static struct wl_stream *luaW_check_stream(lua_State *L, int arg)
+{
+    struct wl_stream *ptr = luaL_checkudata(L, arg, "wslua.Stream");
+    return ptr;
+}
+
+static void l_stream_append(struct wl_stream *s, const uint8_t *data, size_t len)
+{
+    /* Discard consumed bytes first */
+    if (s->pos > 0) {
+        memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+        s->len -= s->pos;
+        s->pos = 0;
+    }
+    if (s->len + len > s->size) {
+        size_t size = s->size ? s->size : 256;
+        while (size < s->len + len)
+            size *= 2;
+        s->buf = xrealloc(s->buf, size);
+        s->size = size;
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+}
+
+/* Pushes a new stream for 'fn' */
+static struct wl_stream *l_stream_new(lua_State *L, int fn)
+{
+    fn = lua_absindex(L, fn);
+    struct wl_stream *s = NEWUSERDATA(L, struct wl_stream, "wslua.Stream");
+    memset(s, 0, sizeof(*s));
+
+    lua_createtable(L, 3, 0);
+    lua_pushvalue(L, fn);
+    lua_rawseti(L, -2, STREAM_FN);
+    lua_State *co = lua_newthread(L);
+    lua_rawseti(L, -2, STREAM_THREAD);
+    lua_setiuservalue(L, -2, 1);
+
+    /* The thread starts with fn(stream) */
+    lua_pushvalue(L, fn);
+    lua_pushvalue(L, -2);
+    lua_xmove(L, co, 2);
+    return s;
+}
+
+/* Feeds 'len' bytes to the stream at 'arg' and pushes the emitted values */
+static int l_stream_feed(lua_State *L, int arg, const uint8_t *data, size_t len)
+{
+    struct wl_stream *s = luaW_check_stream(L, arg);
+    int nargs, nres, status;
+
+    arg = lua_absindex(L, arg);
+    if (s->status == WL_STREAM_FAILED)
+        return luaL_error(L, "stream parser has failed");
+
+    lua_newtable(L);
+    s->nout = 0;
+    if (s->status == WL_STREAM_DONE)
+        return 1;   /* Parser has returned, data is discarded */
+
+    lua_getiuservalue(L, arg, 1);
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, STREAM_OUT);
+    lua_rawgeti(L, -1, STREAM_THREAD);
+    lua_State *co = lua_tothread(L, -1);
+    lua_pop(L, 2);
+
+    l_stream_append(s, data, len);
+    nargs = s->started ? 0 : 1;
+    s->started = true;
+    luaW_budget_resume(co);
+    status = lua_resume(co, L, nargs, &nres);
+
+    lua_getiuservalue(L, arg, 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, STREAM_OUT);
+    lua_pop(L, 1);
+
+    if (status == LUA_YIELD || status == LUA_OK) {
+        lua_pop(co, nres);
+        if (status == LUA_OK)
+            s->status = WL_STREAM_DONE;
+        return 1;
+    }
+    s->status = WL_STREAM_FAILED;
+    lua_xmove(co, L, 1);
+    return lua_error(L);
+}
+
+/***
+ * Streaming parser class.
+ *
+ * The parser function is run as a coroutine with the stream as argument.
+ * Byte access methods suspend the parser until enough data has been fed.
+ * @type Stream
+ */
+
+/***
+ * Create a streaming parser
+ * @function Stream.new
+ * @tparam function fn the parser, called as fn(stream)
+ * @treturn Stream
+ */
+static int wl_stream_new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    l_stream_new(L, 1);
+    return 1;
+}
+
+/***
+ * Feed data to the parser
+ * @function feed
+ * @tparam string|TVBuff data the next bytes of the stream
+ * @treturn table array of values emitted by the parser while consuming data
+ */
+static int wl_stream_feed(lua_State *L)
+{
+    const uint8_t *data;
+    size_t len;
+
+    luaW_check_stream(L, 1);
+    if (luaW_test_handle(L, 2, WL_HANDLE_TVBUFF)) {
+        tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+        len = tvb_captured_length(tvb);
+        data = tvb_get_ptr(tvb, 0, (int)len);
+    }
+    else {
+        data = (const uint8_t *)luaL_checklstring(L, 2, &len);
+    }
+    return l_stream_feed(L, 1, data, len);
+}
+
+static int wl_stream_need_k(lua_State *L, int status _U_, lua_KContext ctx _U_);
+static int wl_stream_peek_k(lua_State *L, int status _U_, lua_KContext ctx _U_);
+static int wl_stream_skip_k(lua_State *L, int status _U_, lua_KContext ctx _U_);
+
+/* Returns the number of bytes requested by need(), peek() or skip() if they
+ * are buffered, otherwise -1 */
+static lua_Integer l_stream_check(lua_State *L, struct wl_stream *s)
+{
+    lua_Integer n = luaL_checkinteger(L, 2);
+
+    luaL_argcheck(L, n >= 0, 2, "negative length");
+    if ((size_t)n <= s->len - s->pos)
+        return n;
+    return -1;
+}
+
+/***
+ * Consume bytes, waiting for more data if needed
+ * @function need
+ * @int n the number of bytes
+ * @treturn string the next n bytes of the stream
+ */
+static int wl_stream_need(lua_State *L)
+{
+    struct wl_stream *s = luaW_check_stream(L, 1);
+    lua_Integer n = l_stream_check(L, s);
+
+    if (n < 0)
+        return lua_yieldk(L, 0, 0, wl_stream_need_k);
+    lua_pushlstring(L, (const char *)s->buf + s->pos, (size_t)n);
+    s->pos += (size_t)n;
+    return 1;
+}
+
+static int wl_stream_need_k(lua_State *L, int status _U_, lua_KContext ctx _U_)
+{
+    return wl_stream_need(L);
+}
+
+/***
+ * Get bytes without consuming them, waiting for more data if needed
+ * @function peek
+ * @int n the number of bytes
+ * @treturn string the next n bytes of the stream
+ */
+static int wl_stream_peek(lua_State *L)
+{
+    struct wl_stream *s = luaW_check_stream(L, 1);
+    lua_Integer n = l_stream_check(L, s);
+
+    if (n < 0)
+        return lua_yieldk(L, 0, 0, wl_stream_peek_k);
+    lua_pushlstring(L, (const char *)s->buf + s->pos, (size_t)n);
+    return 1;
+}
+
+static int wl_stream_peek_k(lua_State *L, int status _U_, lua_KContext ctx _U_)
+{
+    return wl_stream_peek(L);
+}
+
+/***
+ * Consume bytes without copying them, waiting for more data if needed
+ * @function skip
+ * @int n the number of bytes
+ */
+static int wl_stream_skip(lua_State *L)
+{
+    struct wl_stream *s = luaW_check_stream(L, 1);
+    lua_Integer n = l_stream_check(L, s);
+
+    if (n < 0)
+        return lua_yieldk(L, 0, 0, wl_stream_skip_k);
+    s->pos += (size_t)n;
+    return 0;
+}
+
+static int wl_stream_skip_k(lua_State *L, int status _U_, lua_KContext ctx _U_)
+{
+    return wl_stream_skip(L);
+}
+
+/***
+ * Get the number of buffered bytes
+ * @function available
+ * @treturn int the number of bytes that can be consumed without waiting
+ */
+static int wl_stream_available(lua_State *L)
+{
+    struct wl_stream *s = luaW_check_stream(L, 1);
+    lua_pushinteger(L, (lua_Integer)(s->len - s->pos));
+    return 1;
+}
+
+/***
+ * Emit a parsed value
+ *
+ * The value is returned to the caller of feed().
+ * @function emit
+ * @param value the value
+ */
+static int wl_stream_emit(lua_State *L)
+{
+    struct wl_stream *s = luaW_check_stream(L, 1);
+    luaL_checkany(L, 2);
+    lua_getiuservalue(L, 1, 1);
+    if (lua_rawgeti(L, -1, STREAM_OUT) != LUA_TTABLE)
+        return luaL_error(L, "emit() called outside of feed()");
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, ++s->nout);
+    return 0;
+}
+
+static int wl_stream_gc(lua_State *L)
+{
+    struct wl_stream *s = luaW_check_stream(L, 1);
+    free(s->buf);
+    s->buf = NULL;
+    return 0;
+}
+
+/***
+ * @section end
+ */
+
+/***
+ * Per-flow streaming parser class.
+ *
+ * Runs one Stream per conversation and direction. The values emitted for
+ * each frame are recorded, so dissecting the frame again returns them
+ * without running the parser.
+ * @type StreamParser
+ */
+
+/*
+ * Pushes the per-file state { flows, frames, visits } of the parser at
+ * 'arg'. frames[num] is the array of results of the segments of a frame,
+ * in dissection order. visits counts the segments seen in each dissection,
+ * keyed by the PacketInfo object of the dissection.
+ */
+static void l_push_file_state(lua_State *L, int arg)
+{
+    const void *key = lua_touserdata(L, arg);
+    luaW_push_file_table(L);
+    if (lua_rawgetp(L, -1, key) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 3);
+        lua_newtable(L);
+        lua_setfield(L, -2, "flows");
+        lua_newtable(L);
+        lua_setfield(L, -2, "frames");
+        lua_newtable(L);
+        lua_createtable(L, 0, 1);
+        lua_pushliteral(L, "k");
+        lua_setfield(L, -2, "__mode");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, -2, "visits");
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, -3, key);
+    }
+    lua_remove(L, -2);
+}
+
+/***
+ * Create a per-flow streaming parser
+ * @function StreamParser.new
+ * @tparam Protocol proto the protocol using the parser
+ * @tparam function fn the parser, called as fn(stream) for each flow direction
+ * @treturn StreamParser
+ */
+static int wl_stream_parser_new(lua_State *L)
+{
+    luaW_check_protocol(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    luaW_newuserdata(L, 0, "wslua.StreamParser");
+    lua_pushvalue(L, 2);
+    lua_setiuservalue(L, -2, 1);
+    return 1;
+}
+
+/***
+ * Parse a segment of the packet's conversation
+ *
+ * On the first pass the segment is fed to the Stream of its flow direction.
+ * Afterwards the values recorded for the segment are returned. Segments
+ * of a frame are told apart by the order in which they are dissected.
+ * @function dissect
+ * @tparam TVBuff tvb the segment
+ * @tparam PacketInfo pinfo a packet info
+ * @treturn table array of values emitted by the parser for this frame
+ */
+static int wl_stream_parser_dissect(lua_State *L)
+{
+    luaL_checkudata(L, 1, "wslua.StreamParser");
+    luaW_check_tvbuff(L, 2);
+    packet_info *pinfo = luaW_check_pinfo(L, 3);
+
+    lua_settop(L, 3);
+    l_push_file_state(L, 1);    /* 4 */
+    lua_getfield(L, 4, "frames");   /* 5 */
+
+    if (PINFO_FD_VISITED(pinfo)) {
+        lua_getfield(L, 4, "visits");
+        lua_pushvalue(L, 3);
+        lua_Integer seg = lua_rawget(L, -2) == LUA_TNUMBER ? lua_tointeger(L, -1) + 1 : 1;
+        lua_pop(L, 1);
+        lua_pushvalue(L, 3);
+        lua_pushinteger(L, seg);
+        lua_rawset(L, -3);
+
+        int type = LUA_TNIL;
+        if (lua_rawgeti(L, 5, pinfo->num) == LUA_TTABLE)
+            type = lua_rawgeti(L, -1, seg);
+        if (type == LUA_TSTRING)
+            return lua_error(L);
+        if (type != LUA_TTABLE)
+            lua_newtable(L);
+        return 1;
+    }
+
+    /* Keeping the flows here leaves the conversation data to the protocol */
+    conversation_t *conv = find_or_create_conversation(pinfo);
+    lua_getfield(L, 4, "flows");    /* 6 */
+    struct wl_stream_flow *flow;
+    if (lua_rawgetp(L, 6, conv) == LUA_TLIGHTUSERDATA) {
+        flow = lua_touserdata(L, -1);
+    }
+    else {
+        flow = wmem_new0(wmem_file_scope(), struct wl_stream_flow);
+        copy_address_wmem(wmem_file_scope(), &flow->src, &pinfo->src);
+        flow->srcport = pinfo->srcport;
+        lua_pushlightuserdata(L, flow);
+        lua_rawsetp(L, 6, conv);
+    }
+    lua_pop(L, 1);
+    int dir = addresses_equal(&pinfo->src, &flow->src) && pinfo->srcport == flow->srcport ? 0 : 1;
+
+    if (lua_rawgetp(L, 6, &flow->key[dir]) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        lua_getiuservalue(L, 1, 1);
+        l_stream_new(L, -1);
+        lua_remove(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, 6, &flow->key[dir]);
+    }   /* 7 */
+
+    /* A frame can carry more than one segment of the flow */
+    if (lua_rawgeti(L, 5, pinfo->num) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, 5, pinfo->num);
+    }   /* 8 */
+
+    lua_pushcfunction(L, wl_stream_feed);
+    lua_pushvalue(L, 7);
+    lua_pushvalue(L, 2);
+    int status = lua_pcall(L, 2, 1, 0);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, 8, luaL_len(L, 8) + 1);
+    if (status != LUA_OK)
+        return lua_error(L);
+    return 1;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_stream_m[] = {
+    { "feed", wl_stream_feed },
+    { "need", wl_stream_need },
+    { "peek", wl_stream_peek },
+    { "skip", wl_stream_skip },
+    { "available", wl_stream_available },
+    { "emit", wl_stream_emit },
+    { "__gc", wl_stream_gc },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_stream_f[] = {
+    { "new", wl_stream_new },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_stream_parser_m[] = {
+    { "dissect", wl_stream_parser_dissect },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_stream_parser_f[] = {
+    { "new", wl_stream_parser_new },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_stream(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.Stream", wl_stream_m);
+    luaW_newmetatable(L, "wslua.StreamParser", wl_stream_parser_m);
+    luaL_newlib(L, wl_stream_f);
+    lua_setfield(L, -2, "Stream");
+    luaL_newlib(L, wl_stream_parser_f);
+    lua_setfield(L, -2, "StreamParser");
+}
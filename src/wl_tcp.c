@@ -0,0 +1,256 @@
+/*
+ * Copyright 2017-2022, João Valverde <j@v6e.pt>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wslua-int.h"
+
+#include <epan/dissectors/packet-tcp.h>
+
+/***
+ * @module wireshark
+ */
+
+/*
+ * PDU framing for tcp_dissect_pdus(). The PDU length is read from a field
+ * described by the framing object, or computed by a Lua function if no
+ * field is given.
+ */
+struct wl_tcp_pdus {
+    lua_State *L;
+    unsigned fixed_len;
+    unsigned length_offset;
+    unsigned length_size;       /* 0 if get_len is used */
+    bool little_endian;
+    uint64_t length_mask;       /* 0 for none */
+    int length_shift;
+    lua_Integer length_adjust;
+    int get_len_ref;
+    int dissect_ref;
+};
+
+static struct wl_tcp_pdus *luaW_check_tcp_pdus(lua_State *L, int arg)
+{
+    struct wl_tcp_pdus *ptr = luaL_checkudata(L, arg, "wslua.TcpPdus");
+    return ptr;
+}
+
+static uint64_t l_get_length_field(struct wl_tcp_pdus *p, tvbuff_t *tvb, int offset)
+{
+    if (p->little_endian) {
+        switch (p->length_size) {
+            case 1: return tvb_get_uint8(tvb, offset);
+            case 2: return tvb_get_letohs(tvb, offset);
+            case 3: return tvb_get_letoh24(tvb, offset);
+            case 4: return tvb_get_letohl(tvb, offset);
+            case 8: return tvb_get_letoh64(tvb, offset);
+        }
+    }
+    else {
+        switch (p->length_size) {
+            case 1: return tvb_get_uint8(tvb, offset);
+            case 2: return tvb_get_ntohs(tvb, offset);
+            case 3: return tvb_get_ntoh24(tvb, offset);
+            case 4: return tvb_get_ntohl(tvb, offset);
+            case 8: return tvb_get_ntoh64(tvb, offset);
+        }
+    }
+    ws_assert_not_reached();
+}
+
+static unsigned l_get_pdu_len(packet_info *pinfo, tvbuff_t *tvb, int offset, void *data)
+{
+    struct wl_tcp_pdus *p = data;
+    lua_Integer len;
+
+    if (p->length_size > 0) {
+        uint64_t field = l_get_length_field(p, tvb, offset + p->length_offset);
+        if (p->length_mask != 0)
+            field = (field & p->length_mask) >> p->length_shift;
+        if (field > INT32_MAX)
+            return 0;
+        len = (lua_Integer)field + p->length_adjust;
+    }
+    else {
+        lua_State *L = p->L;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, p->get_len_ref);
+        luaW_push_tvbuff(L, tvb);
+        luaW_push_pinfo(L, pinfo);
+        lua_pushinteger(L, offset);
+        if (lua_pcall(L, 3, 1, 0) != LUA_OK)
+            luaW_throw_error(L, pinfo);
+        len = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    /* tcp_dissect_pdus() reports lengths shorter than fixed_len as bogus */
+    if (len <= 0 || len > UINT_MAX)
+        return 0;
+    return (unsigned)len;
+}
+
+static int l_dissect_pdu(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data)
+{
+    struct wl_tcp_pdus *p = data;
+    lua_State *L = p->L;
+    int len;
+
+    if (luaW_pcall_dissector_ref(L, p->dissect_ref, tvb, pinfo, tree) != LUA_OK)
+        luaW_throw_error(L, pinfo);
+    len = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return len;
+}
+
+/***
+ * TCP PDU framing class.
+ * @type TcpPdus
+ */
+
+/***
+ * Create a TCP PDU framing object
+ *
+ * The spec table has the fields:
+ *
+ *  - dissector: function(tvb, pinfo, tree, cinfo) called once per PDU
+ *  - length_offset: offset of the length field in the PDU (default 0)
+ *  - length_size: size of the length field, 1, 2, 3, 4 or 8 bytes
+ *  - little_endian: the length field is little endian (default false)
+ *  - length_mask: mask applied to the length field, the result is shifted
+ *    right by the number of trailing zero bits of the mask
+ *  - length_adjust: added to the length field to get the PDU length,
+ *    usually the size of the header when the field excludes it (default 0)
+ *  - get_len: function(tvb, pinfo, offset) returning the PDU length, used
+ *    instead of the length field
+ *  - fixed_len: bytes needed to compute the length, defaults to the end of
+ *    the length field and is required with get_len
+ *
+ * @function TcpPdus.new
+ * @tparam table spec the framing specification
+ * @treturn TcpPdus
+ */
+static int wl_tcp_pdus_new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+
+    struct wl_tcp_pdus *p = NEWUSERDATA(L, struct wl_tcp_pdus, "wslua.TcpPdus");
+    memset(p, 0, sizeof(*p));
+    p->L = L;
+    p->get_len_ref = LUA_NOREF;
+    p->dissect_ref = LUA_NOREF;
+
+    if (lua_getfield(L, 1, "dissector") != LUA_TFUNCTION)
+        return luaL_error(L, "TcpPdus: dissector must be a function");
+    p->dissect_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_getfield(L, 1, "length_size");
+    p->length_size = (unsigned)luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "length_offset");
+    p->length_offset = (unsigned)luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "little_endian");
+    p->little_endian = lua_toboolean(L, -1);
+    lua_getfield(L, 1, "length_mask");
+    p->length_mask = (uint64_t)luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "length_adjust");
+    p->length_adjust = luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "fixed_len");
+    p->fixed_len = (unsigned)luaL_optinteger(L, -1, 0);
+    lua_pop(L, 6);
+
+    if (p->length_mask != 0) {
+        while (((p->length_mask >> p->length_shift) & 1) == 0)
+            p->length_shift++;
+    }
+
+    if (lua_getfield(L, 1, "get_len") == LUA_TFUNCTION) {
+        p->get_len_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        p->length_size = 0;
+        if (p->fixed_len == 0)
+            return luaL_error(L, "TcpPdus: fixed_len is required with get_len");
+    }
+    else {
+        lua_pop(L, 1);
+        switch (p->length_size) {
+            case 1: case 2: case 3: case 4: case 8:
+                break;
+            default:
+                return luaL_error(L, "TcpPdus: length_size must be 1, 2, 3, 4 or 8");
+        }
+        if (p->fixed_len < p->length_offset + p->length_size)
+            p->fixed_len = p->length_offset + p->length_size;
+    }
+    return 1;
+}
+
+/***
+ * Dissect the PDUs in a TCP segment
+ *
+ * Complete PDUs are split off in C and the dissector is called once for each.
+ * Incomplete PDUs are reassembled by TCP if desegmentation is enabled.
+ * @function dissect
+ * @tparam TVBuff tvb the TCP payload
+ * @tparam PacketInfo pinfo a packet info
+ * @tparam[opt] ProtoTree tree a proto tree
+ * @bool[opt=true] desegment whether to reassemble PDUs across segments
+ * @treturn int the captured length of tvb
+ */
+static int wl_tcp_pdus_dissect(lua_State *L)
+{
+    struct wl_tcp_pdus *p = luaW_check_tcp_pdus(L, 1);
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 2);
+    packet_info *pinfo = luaW_check_pinfo(L, 3);
+    proto_tree *tree = luaW_opt_proto_tree(L, 4);
+    bool desegment = lua_isnoneornil(L, 5) || lua_toboolean(L, 5);
+
+    LUAW_TRY(L, tcp_dissect_pdus(tvb, pinfo, tree, desegment, p->fixed_len, l_get_pdu_len, l_dissect_pdu, p));
+    lua_pushinteger(L, tvb_captured_length(tvb));
+    return 1;
+}
+
+static int wl_tcp_pdus_gc(lua_State *L)
+{
+    struct wl_tcp_pdus *p = luaW_check_tcp_pdus(L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, p->get_len_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, p->dissect_ref);
+    return 0;
+}
+
+/***
+ * @section end
+ */
+
+static const struct luaL_Reg wl_tcp_pdus_m[] = {
+    { "dissect", wl_tcp_pdus_dissect },
+    { "__gc", wl_tcp_pdus_gc },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg wl_tcp_pdus_f[] = {
+    { "new", wl_tcp_pdus_new },
+    { NULL, NULL }
+};
+
+/* Receives module on the stack */
+void wl_open_tcp(lua_State *L)
+{
+    luaW_newmetatable(L, "wslua.TcpPdus", wl_tcp_pdus_m);
+    luaL_newlib(L, wl_tcp_pdus_f);
+    lua_setfield(L, -2, "TcpPdus");
+
+    lua_pushinteger(L, DESEGMENT_ONE_MORE_SEGMENT);
+    lua_setfield(L, -2, "DESEGMENT_ONE_MORE_SEGMENT");
+    lua_pushinteger(L, DESEGMENT_UNTIL_FIN);
+    lua_setfield(L, -2, "DESEGMENT_UNTIL_FIN");
+}
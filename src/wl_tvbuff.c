@@ -23,14 +23,12 @@
 
 tvbuff_t *luaW_check_tvbuff(lua_State *L, int arg)
 {
-    tvbuff_t **ptr = luaL_checkudata(L, arg, "wslua.TVBuff");
-    return *ptr;
+    return luaW_check_handle(L, arg, WL_HANDLE_TVBUFF);
 }
 
 void luaW_push_tvbuff(lua_State *L, tvbuff_t *tvb)
 {
-    tvbuff_t **ptr = NEWUSERDATA(L, tvbuff_t *, "wslua.TVBuff");
-    *ptr = tvb;
+    luaW_push_handle(L, WL_HANDLE_TVBUFF, tvb);
 }
 
 /***
@@ -48,7 +46,8 @@ static int wl_tvb_get_guint8(lua_State *L)
 {
     tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
     int offset = luaW_check_offset_toint(L, 2);
-    uint8_t val = tvb_get_uint8(tvb, offset);
+    uint8_t val = 0;
+    LUAW_TRY(L, val = tvb_get_uint8(tvb, offset));
     lua_pushinteger(L, val);
     return 1;
 }
@@ -57,7 +56,8 @@ static int wl_tvb_get_ntohs(lua_State *L)
 {
     tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
     int offset = luaW_check_offset_toint(L, 2);
-    uint16_t val = tvb_get_ntohs(tvb, offset);
+    uint16_t val = 0;
+    LUAW_TRY(L, val = tvb_get_ntohs(tvb, offset));
     lua_pushinteger(L, val);
     return 1;
 }
@@ -73,7 +73,8 @@ static int wl_tvb_get_bytes(lua_State *L)
     else if (length < 0) {
         luaL_error(L, "length must be positive or -1, was %d", length);
     }
-    const uint8_t *ptr = tvb_get_ptr(tvb, offset, length);
+    const uint8_t *ptr = NULL;
+    LUAW_TRY(L, ptr = tvb_get_ptr(tvb, offset, length));
     lua_pushlstring(L, (const char *)ptr, length);
     return 1;
 }
@@ -88,7 +89,8 @@ static int wl_tvb_get_ipv4(lua_State *L)
 {
     tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
     int offset = luaW_check_offset_toint(L, 2);
-    uint32_t val = tvb_get_ipv4(tvb, offset);
+    uint32_t val = 0;
+    LUAW_TRY(L, val = tvb_get_ipv4(tvb, offset));
     luaW_push_ipv4(L, val);
     return 1;
 }
@@ -104,7 +106,7 @@ static int wl_tvb_get_ipv6(lua_State *L)
     tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
     int offset = luaW_check_offset_toint(L, 2);
     struct e_in6_addr val;
-    tvb_get_ipv6(tvb, offset, &val);
+    LUAW_TRY(L, tvb_get_ipv6(tvb, offset, &val));
     luaW_push_ipv6(L, &val);
     return 1;
 }
@@ -145,11 +147,219 @@ static int wl_tvb_new_subset_remaining(lua_State *L)
 {
     tvbuff_t *backing = luaW_check_tvbuff(L, 1);
     int backing_offset = luaW_check_offset_toint(L, 2);
-    tvbuff_t *tvb = tvb_new_subset_remaining(backing, backing_offset);
+    tvbuff_t *tvb = NULL;
+    LUAW_TRY(L, tvb = tvb_new_subset_remaining(backing, backing_offset));
     luaW_push_tvbuff(L, tvb);
     return 1;
 }
 
+/* Checks the offset and length arguments at 'arg' and 'arg'+1. */
+static const uint8_t *l_tvb_check_range(lua_State *L, tvbuff_t *tvb, int arg, size_t *lenp)
+{
+    lua_Integer offset = luaW_check_offset_toint(L, arg);
+    lua_Integer length = luaL_checkinteger(L, arg + 1);
+    if (length == -1) {
+        length = tvb_captured_length_remaining(tvb, offset);
+    }
+    else if (length < 0) {
+        luaL_error(L, "length must be positive or -1, was %I", length);
+    }
+    *lenp = length;
+    const uint8_t *ptr = NULL;
+    LUAW_TRY(L, ptr = tvb_get_ptr(tvb, offset, length));
+    return ptr;
+}
+
+typedef ptrdiff_t (*l_tvb_decoder)(uint8_t *, const uint8_t *, size_t);
+
+/*
+ * Decodes the range into a new child tvbuff. If a PacketInfo is given at
+ * index 4 the result is also added as a data source, named by the optional
+ * string at index 5. Pushes nil if the input is not valid.
+ */
+static int l_tvb_decode(lua_State *L, tvbuff_t *tvb, l_tvb_decoder decode,
+                            const uint8_t *src, size_t len, size_t max_len,
+                            const char *default_name)
+{
+    packet_info *pinfo = NULL;
+    const char *name = NULL;
+
+    if (!lua_isnoneornil(L, 4)) {
+        pinfo = luaW_check_pinfo(L, 4);
+        name = luaL_optstring(L, 5, default_name);
+    }
+
+    uint8_t *buf = xmalloc(max_len + 1); /* avoid malloc(0) */
+    ptrdiff_t buf_len = decode(buf, src, len);
+    if (buf_len < 0) {
+        free(buf);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    tvbuff_t *child = tvb_new_child_real_data(tvb, buf, (unsigned)buf_len, (int)buf_len);
+    tvb_set_free_cb(child, free);
+    if (pinfo) {
+        /* The data source keeps the name pointer, copy it with packet scope. */
+        add_new_data_source(pinfo, child, wmem_strdup(pinfo->pool, name));
+    }
+    luaW_push_tvbuff(L, child);
+    return 1;
+}
+
+/***
+ * Decode a range of hexadecimal digits into a new tvbuff.
+ * Whitespace between digits is ignored.
+ * @function decode_hex
+ * @int offset the offset
+ * @int length the length or -1 for the remaining captured bytes
+ * @tparam[opt] PacketInfo pinfo add the result as a data source to pinfo
+ * @string[opt] name the data source name
+ * @treturn TVBuff the decoded tvbuff or nil if the input is not valid
+ */
+static int wl_tvb_decode_hex(lua_State *L)
+{
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
+    size_t len;
+    const uint8_t *src = l_tvb_check_range(L, tvb, 2, &len);
+    return l_tvb_decode(L, tvb, wl_hex_decode, src, len,
+                            WL_HEX_DECODED_MAX(len), "Hex-decoded data");
+}
+
+/***
+ * Decode a range of base64 text into a new tvbuff.
+ * Both the standard and the URL-safe alphabets are accepted. Padding is
+ * optional and whitespace is ignored.
+ * @function decode_base64
+ * @int offset the offset
+ * @int length the length or -1 for the remaining captured bytes
+ * @tparam[opt] PacketInfo pinfo add the result as a data source to pinfo
+ * @string[opt] name the data source name
+ * @treturn TVBuff the decoded tvbuff or nil if the input is not valid
+ */
+static int wl_tvb_decode_base64(lua_State *L)
+{
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
+    size_t len;
+    const uint8_t *src = l_tvb_check_range(L, tvb, 2, &len);
+    return l_tvb_decode(L, tvb, wl_base64_decode, src, len,
+                            WL_BASE64_DECODED_MAX(len), "Base64-decoded data");
+}
+
+/***
+ * Decode a range of base32 text into a new tvbuff.
+ * Decoding is case-insensitive. Padding is optional and whitespace is ignored.
+ * @function decode_base32
+ * @int offset the offset
+ * @int length the length or -1 for the remaining captured bytes
+ * @tparam[opt] PacketInfo pinfo add the result as a data source to pinfo
+ * @string[opt] name the data source name
+ * @treturn TVBuff the decoded tvbuff or nil if the input is not valid
+ */
+static int wl_tvb_decode_base32(lua_State *L)
+{
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
+    size_t len;
+    const uint8_t *src = l_tvb_check_range(L, tvb, 2, &len);
+    return l_tvb_decode(L, tvb, wl_base32_decode, src, len,
+                            WL_BASE32_DECODED_MAX(len), "Base32-decoded data");
+}
+
+/***
+ * Encode a range of bytes as hexadecimal digits
+ * @function encode_hex
+ * @int offset the offset
+ * @int length the length or -1 for the remaining captured bytes
+ * @bool[opt] upper use upper case digits
+ * @treturn string the encoded string
+ */
+static int wl_tvb_encode_hex(lua_State *L)
+{
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
+    size_t len;
+    const uint8_t *src = l_tvb_check_range(L, tvb, 2, &len);
+    bool upper = lua_toboolean(L, 4);
+    luaL_Buffer b;
+    char *dst = luaL_buffinitsize(L, &b, WL_HEX_ENCODED_LEN(len));
+    luaL_pushresultsize(&b, wl_hex_encode(dst, src, len, upper));
+    return 1;
+}
+
+/***
+ * Encode a range of bytes as base64 text
+ * @function encode_base64
+ * @int offset the offset
+ * @int length the length or -1 for the remaining captured bytes
+ * @treturn string the encoded string
+ */
+static int wl_tvb_encode_base64(lua_State *L)
+{
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
+    size_t len;
+    const uint8_t *src = l_tvb_check_range(L, tvb, 2, &len);
+    luaL_Buffer b;
+    char *dst = luaL_buffinitsize(L, &b, WL_BASE64_ENCODED_LEN(len));
+    luaL_pushresultsize(&b, wl_base64_encode(dst, src, len));
+    return 1;
+}
+
+/***
+ * Encode a range of bytes as base32 text
+ * @function encode_base32
+ * @int offset the offset
+ * @int length the length or -1 for the remaining captured bytes
+ * @treturn string the encoded string
+ */
+static int wl_tvb_encode_base32(lua_State *L)
+{
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
+    size_t len;
+    const uint8_t *src = l_tvb_check_range(L, tvb, 2, &len);
+    luaL_Buffer b;
+    char *dst = luaL_buffinitsize(L, &b, WL_BASE32_ENCODED_LEN(len));
+    luaL_pushresultsize(&b, wl_base32_encode(dst, src, len));
+    return 1;
+}
+
+/***
+ * Compute byte statistics of a range.
+ * @function byte_stats
+ * @int offset the offset
+ * @int length the length or -1 for the remaining captured bytes
+ * @tparam[opt] table hist if given, receives the count of each byte value
+ * at indices 0 to 255. The table is overwritten and can be reused across
+ * calls.
+ * @treturn number the Shannon entropy in bits per byte (0 to 8)
+ * @treturn number the ratio of printable ASCII bytes
+ * @treturn number the ratio of zero bytes
+ */
+static int wl_tvb_byte_stats(lua_State *L)
+{
+    tvbuff_t *tvb = luaW_check_tvbuff(L, 1);
+    size_t len;
+    const uint8_t *src = l_tvb_check_range(L, tvb, 2, &len);
+    uint32_t hist[256] = { 0 };
+    struct wl_byte_stats stats;
+
+    if (!lua_isnoneornil(L, 4))
+        luaL_checktype(L, 4, LUA_TTABLE);
+
+    wl_byte_histogram(hist, src, len);
+    wl_byte_stats(&stats, hist, len);
+
+    if (lua_istable(L, 4)) {
+        for (int i = 0; i < 256; i++) {
+            lua_pushinteger(L, hist[i]);
+            lua_rawseti(L, 4, i);
+        }
+    }
+
+    lua_pushnumber(L, stats.entropy);
+    lua_pushnumber(L, len > 0 ? (lua_Number)stats.printable / len : 0);
+    lua_pushnumber(L, len > 0 ? (lua_Number)stats.zero / len : 0);
+    return 3;
+}
+
 static int wl_tvb_new_real_data(lua_State *L)
 {
     size_t length;
@@ -176,6 +386,13 @@ static const struct luaL_Reg wl_tvbuff_m[] = {
     { "captured_length", wl_tvb_captured_length },
     { "reported_length", wl_tvb_reported_length },
     { "new_subset_remaining", wl_tvb_new_subset_remaining },
+    { "decode_hex", wl_tvb_decode_hex },
+    { "decode_base64", wl_tvb_decode_base64 },
+    { "decode_base32", wl_tvb_decode_base32 },
+    { "encode_hex", wl_tvb_encode_hex },
+    { "encode_base64", wl_tvb_encode_base64 },
+    { "encode_base32", wl_tvb_encode_base32 },
+    { "byte_stats", wl_tvb_byte_stats },
     { NULL, NULL }
 };
 
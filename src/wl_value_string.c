@@ -36,45 +36,313 @@ struct wl_value_string *luaW_opt_value_string(lua_State *L, int idx)
     return luaW_check_value_string(L, idx);
 }
 
+/*
+ * Pushes a new ValueString of the given type with a zeroed array of 'len'
+ * entries plus the terminator. The userdata owns the array from the start
+ * so that it is released by __gc if the caller raises an error while filling
+ * it in.
+ */
+static struct wl_value_string *l_value_string_new(lua_State *L, enum wl_value_string_e type,
+                                                    size_t len)
+{
+    struct wl_value_string *vs = wmem_new0(NULL, struct wl_value_string);
+    luaW_push_value_string(L, vs);
+    vs->type = type;
+    switch (type) {
+        case WL_VALS:
+            vs->data.vals = wmem_alloc0_array(NULL, value_string, len + 1);
+            break;
+        case WL_RVALS:
+            vs->data.rvals = wmem_alloc0_array(NULL, range_string, len + 1);
+            break;
+        case WL_VALS64:
+            vs->data.vals64 = wmem_alloc0_array(NULL, val64_string, len + 1);
+            break;
+        case WL_STRSTRS:
+            vs->data.strstrs = wmem_alloc0_array(NULL, string_string, len + 1);
+            break;
+        default:
+            ws_assert_not_reached();
+    }
+    return vs;
+}
+
+/* Pushes the field 'n' of the entry at index -1 */
+static int l_entry_field(lua_State *L, int entry, int n, int type)
+{
+    if (lua_geti(L, -1, n) != type) {
+        return luaL_error(L, "value string entry %d: field %d must be a %s",
+                            entry, n, lua_typename(L, type));
+    }
+    return 1;
+}
+
+static lua_Integer l_entry_integer(lua_State *L, int entry, int n)
+{
+    l_entry_field(L, entry, n, LUA_TNUMBER);
+    if (!lua_isinteger(L, -1))
+        return luaL_error(L, "value string entry %d: field %d must be an integer", entry, n);
+    lua_Integer i = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return i;
+}
+
+static char *l_entry_string(lua_State *L, int entry, int n)
+{
+    l_entry_field(L, entry, n, LUA_TSTRING);
+    char *s = xstrdup(lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return s;
+}
+
+/* Pushes entry 'i' of the table at index 1 */
+static void l_entry_get(lua_State *L, int i)
+{
+    if (lua_geti(L, 1, i) != LUA_TTABLE)
+        luaL_error(L, "value string entry %d must be a table", i);
+}
+
+static int l_vals_cmp(const void *a, const void *b)
+{
+    uint32_t va = ((const value_string *)a)->value;
+    uint32_t vb = ((const value_string *)b)->value;
+    return va < vb ? -1 : va > vb;
+}
+
+/***
+ * Create a value string from a list of {value, string} pairs.
+ * Value strings with many entries are sorted by value and converted to an
+ * extended value string with binary search or direct index lookup. For
+ * duplicate values the first entry wins.
+ * @function vals
+ * @tparam table entries list of {value, string}
+ * @treturn ValueString
+ */
+static int wl_value_string_new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int len = (int)luaL_len(L, 1);
+    bool use_ext = len >= WL_VALS_EXT_MIN;
+    struct wl_value_string *vs = l_value_string_new(L, WL_VALS, len);
+    value_string *vs_array = vs->data.vals;
+    int n = 0;
+
+    /* Set of values seen, to drop duplicates before sorting. */
+    if (use_ext)
+        lua_createtable(L, 0, len);
+
+    for (int i = 1; i <= len; i++) {
+        l_entry_get(L, i);
+        /* Check duplicates on the stored value: -1 and 0xffffffff are the same key. */
+        uint32_t value = (uint32_t)l_entry_integer(L, i, 1);
+        if (use_ext) {
+            if (lua_rawgeti(L, -2, value) != LUA_TNIL) {
+                lua_pop(L, 2);
+                continue;
+            }
+            lua_pop(L, 1);
+            lua_pushboolean(L, 1);
+            lua_rawseti(L, -3, value);
+        }
+        vs_array[n].value = value;
+        vs_array[n].strptr = l_entry_string(L, i, 2);
+        n++;
+        lua_pop(L, 1);
+    }
+
+    if (use_ext) {
+        lua_pop(L, 1);
+        qsort(vs_array, n, sizeof(value_string), l_vals_cmp);
+        vs->data.vals_ext = value_string_ext_new(vs_array, n + 1, "ValueString");
+        vs->type = WL_VALS_EXT;
+    }
+    return 1;
+}
+
+/***
+ * Create a range string from a list of {min, max, string} triples.
+ * @function rvals
+ * @tparam table entries list of {min, max, string}
+ * @treturn ValueString
+ */
+static int wl_range_string_new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int len = (int)luaL_len(L, 1);
+    struct wl_value_string *vs = l_value_string_new(L, WL_RVALS, len);
+    range_string *rs = vs->data.rvals;
+
+    for (int i = 1; i <= len; i++) {
+        l_entry_get(L, i);
+        rs[i-1].value_min = l_entry_integer(L, i, 1);
+        rs[i-1].value_max = l_entry_integer(L, i, 2);
+        if (rs[i-1].value_min > rs[i-1].value_max)
+            return luaL_error(L, "value string entry %d: min is greater than max", i);
+        rs[i-1].strptr = l_entry_string(L, i, 3);
+        lua_pop(L, 1);
+    }
+    return 1;
+}
+
+/***
+ * Create a 64 bit value string from a list of {value, string} pairs.
+ * @function vals64
+ * @tparam table entries list of {value, string}
+ * @treturn ValueString
+ */
+static int wl_val64_string_new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int len = (int)luaL_len(L, 1);
+    struct wl_value_string *vs = l_value_string_new(L, WL_VALS64, len);
+    val64_string *vs64 = vs->data.vals64;
+
+    for (int i = 1; i <= len; i++) {
+        l_entry_get(L, i);
+        vs64[i-1].value = (uint64_t)l_entry_integer(L, i, 1);
+        vs64[i-1].strptr = l_entry_string(L, i, 2);
+        lua_pop(L, 1);
+    }
+    return 1;
+}
+
+/***
+ * Create a string to string mapping from a list of {key, string} pairs.
+ * @function strstrs
+ * @tparam table entries list of {key, string}
+ * @treturn ValueString
+ */
+static int wl_string_string_new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int len = (int)luaL_len(L, 1);
+    struct wl_value_string *vs = l_value_string_new(L, WL_STRSTRS, len);
+    string_string *ss = vs->data.strstrs;
+
+    for (int i = 1; i <= len; i++) {
+        l_entry_get(L, i);
+        l_entry_field(L, i, 1, LUA_TSTRING);
+        lua_insert(L, -2);
+        l_entry_field(L, i, 2, LUA_TSTRING);
+        ss[i-1].value = xstrdup(lua_tostring(L, -3));
+        ss[i-1].strptr = xstrdup(lua_tostring(L, -1));
+        lua_pop(L, 3);
+    }
+    return 1;
+}
+
+/***
+ * Convert a value to a string.
+ * @function val_to_str
+ * @param value the value, an integer or a string for string to string mappings
+ * @tparam ValueString vs the value string
+ * @string fmt format used if the value is not found
+ * @treturn string
+ */
 static int wl_val_to_str(lua_State *L)
 {
-    lua_Integer value = luaL_checkinteger(L, 1);
     struct wl_value_string *vs = luaW_check_value_string(L, 2);
     const char *fmt = luaL_checkstring(L, 3);
-    char *str = val_to_str_wmem(NULL, value, vs->data.vals, fmt);
+    char *str;
+
+    switch (vs->type) {
+        case WL_VALS:
+            str = val_to_str_wmem(NULL, (uint32_t)luaL_checkinteger(L, 1), vs->data.vals, fmt);
+            break;
+        case WL_VALS_EXT:
+            str = val_to_str_ext_wmem(NULL, (uint32_t)luaL_checkinteger(L, 1), vs->data.vals_ext, fmt);
+            break;
+        case WL_RVALS:
+            str = rval_to_str_wmem(NULL, (uint32_t)luaL_checkinteger(L, 1), vs->data.rvals, fmt);
+            break;
+        case WL_VALS64:
+            str = val64_to_str_wmem(NULL, (uint64_t)luaL_checkinteger(L, 1), vs->data.vals64, fmt);
+            break;
+        case WL_STRSTRS:
+            str = str_to_str_wmem(NULL, luaL_checkstring(L, 1), vs->data.strstrs, fmt);
+            break;
+        default:
+            ws_assert_not_reached();
+    }
     lua_pushstring(L, str);
     wmem_free(NULL, str);
     return 1;
 }
 
-static int wl_value_string_new(lua_State *L)
+/*
+ * Builds the reverse string to value table of a value string. For range
+ * strings the value is the start of the range. If a string appears more
+ * than once the first entry wins.
+ */
+static void l_push_reverse(lua_State *L, struct wl_value_string *vs)
 {
-    value_string vs;
-    lua_Integer value;
-    const char *strptr;
+    lua_newtable(L);
 
-    luaL_checktype(L, 1, LUA_TTABLE);
-    int len = luaL_len(L, 1);
-    value_string *vs_array = wmem_alloc0_array(NULL, value_string, len + 1);
-
-    lua_pushnil(L);
-    for (int i = 0; lua_next(L, 1) != 0 && i < len; i++) {
-        luaL_checktype(L, -1, LUA_TTABLE);
-        lua_geti(L, -1, 1);
-        value = lua_tointeger(L, -1);
-        lua_geti(L, -2, 2);
-        strptr = lua_tostring(L, -1);
-
-        vs.value = value;
-        vs.strptr = xstrdup(strptr);
-        vs_array[i] = vs;
-        lua_pop(L, 3);
+#define REVERSE(p, push_value) \
+    for (; (p)->strptr != NULL; (p)++) { \
+        if (lua_getfield(L, -1, (p)->strptr) == LUA_TNIL) { \
+            push_value; \
+            lua_setfield(L, -3, (p)->strptr); \
+        } \
+        lua_pop(L, 1); \
     }
 
-    struct wl_value_string *lvalstr = wmem_new(NULL, struct wl_value_string);
-    lvalstr->type = WL_VALS;
-    lvalstr->data.vals = vs_array;
-    luaW_push_value_string(L, lvalstr);
+    switch (vs->type) {
+        case WL_VALS: {
+            const value_string *p = vs->data.vals;
+            REVERSE(p, lua_pushinteger(L, p->value));
+            break;
+        }
+        case WL_VALS_EXT: {
+            const value_string *p = VALUE_STRING_EXT_VS_P(vs->data.vals_ext);
+            REVERSE(p, lua_pushinteger(L, p->value));
+            break;
+        }
+        case WL_RVALS: {
+            const range_string *p = vs->data.rvals;
+            REVERSE(p, lua_pushinteger(L, p->value_min));
+            break;
+        }
+        case WL_VALS64: {
+            const val64_string *p = vs->data.vals64;
+            REVERSE(p, lua_pushinteger(L, (lua_Integer)p->value));
+            break;
+        }
+        case WL_STRSTRS: {
+            const string_string *p = vs->data.strstrs;
+            REVERSE(p, lua_pushstring(L, p->value));
+            break;
+        }
+        default:
+            ws_assert_not_reached();
+    }
+#undef REVERSE
+}
+
+/***
+ * Convert a string to a value. The reverse table is built on the first
+ * call and cached, so lookups take constant time.
+ * @function str_to_val
+ * @string str the string
+ * @tparam ValueString vs the value string
+ * @param[opt] default value returned if the string is not found
+ * @return the value, or default
+ */
+static int wl_str_to_val(lua_State *L)
+{
+    luaL_checkstring(L, 1);
+    struct wl_value_string *vs = luaW_check_value_string(L, 2);
+
+    if (lua_getiuservalue(L, 2, 1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        l_push_reverse(L, vs);
+        lua_pushvalue(L, -1);
+        lua_setiuservalue(L, 2, 1);
+    }
+    lua_pushvalue(L, 1);
+    if (lua_rawget(L, -2) == LUA_TNIL) {
+        lua_settop(L, 3);
+    }
     return 1;
 }
 
@@ -82,8 +350,40 @@ static int wl_value_string_gc(lua_State *L)
 {
     struct wl_value_string *ptr = luaW_check_value_string(L, 1);
 
-    for (value_string *vs = ptr->data.vals; vs->strptr != NULL; vs++)
-        wmem_free(NULL, (char *)vs->strptr);
+    switch (ptr->type) {
+        case WL_VALS:
+            for (value_string *vs = ptr->data.vals; vs->strptr != NULL; vs++)
+                free((char *)vs->strptr);
+            wmem_free(NULL, ptr->data.vals);
+            break;
+        case WL_VALS_EXT: {
+            value_string *vals = (value_string *)VALUE_STRING_EXT_VS_P(ptr->data.vals_ext);
+            for (value_string *vs = vals; vs->strptr != NULL; vs++)
+                free((char *)vs->strptr);
+            wmem_free(NULL, vals);
+            value_string_ext_free(ptr->data.vals_ext);
+            break;
+        }
+        case WL_RVALS:
+            for (range_string *rs = ptr->data.rvals; rs->strptr != NULL; rs++)
+                free((char *)rs->strptr);
+            wmem_free(NULL, ptr->data.rvals);
+            break;
+        case WL_VALS64:
+            for (val64_string *vs = ptr->data.vals64; vs->strptr != NULL; vs++)
+                free((char *)vs->strptr);
+            wmem_free(NULL, ptr->data.vals64);
+            break;
+        case WL_STRSTRS:
+            for (string_string *ss = ptr->data.strstrs; ss->strptr != NULL; ss++) {
+                free((char *)ss->value);
+                free((char *)ss->strptr);
+            }
+            wmem_free(NULL, ptr->data.strstrs);
+            break;
+        default:
+            ws_assert_not_reached();
+    }
     wmem_free(NULL, ptr);
     return 0;
 }
@@ -94,7 +394,7 @@ void luaW_push_vals(lua_State *L, const value_string *ptr)
 
     lua_pushcfunction(L, wl_value_string_new);
     lua_newtable(L);
-    for(n = 0; ptr && ptr->strptr != NULL; n++, ptr++) {
+    for(n = 1; ptr && ptr->strptr != NULL; n++, ptr++) {
         lua_newtable(L);
         lua_pushinteger(L, ptr->value);
         lua_seti(L, -2, 1);
@@ -120,7 +420,11 @@ static const struct luaL_Reg wl_value_string_m[] = {
 
 static const struct luaL_Reg wl_value_string_f[] = {
     { "vals", wl_value_string_new },
+    { "rvals", wl_range_string_new },
+    { "vals64", wl_val64_string_new },
+    { "strstrs", wl_string_string_new },
     { "val_to_str", wl_val_to_str },
+    { "str_to_val", wl_str_to_val },
     { NULL, NULL }
 };
 
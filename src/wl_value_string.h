@@ -19,15 +19,25 @@
 #ifndef _WL_VALUE_STRING_H_
 #define _WL_VALUE_STRING_H_
 
+/* Value strings with at least this many entries are converted to value_string_ext */
+#define WL_VALS_EXT_MIN     16
+
 enum wl_value_string_e {
     WL_VALS,
+    WL_VALS_EXT,
     WL_RVALS,
+    WL_VALS64,
+    WL_STRSTRS,
 };
 
 struct wl_value_string {
     enum wl_value_string_e type;
     union {
         value_string *vals;
+        value_string_ext *vals_ext;
+        range_string *rvals;
+        val64_string *vals64;
+        string_string *strstrs;
     } data;
 };
 
@@ -42,11 +42,30 @@
 
 #include "wl_util.h"
 #include "wl_addr.h"
+#include "wl_arena.h"
+#include "wl_breaker.h"
+#include "wl_budget.h"
+#include "wl_codec.h"
+#include "wl_conversation.h"
 #include "wl_expert.h"
+#include "wl_flow.h"
+#include "wl_gc.h"
+#include "wl_hash.h"
+#include "wl_memory.h"
+#include "wl_mmap.h"
 #include "wl_packet.h"
 #include "wl_pinfo.h"
+#include "wl_pool.h"
+#include "wl_prefix.h"
 #include "wl_prefs.h"
+#include "wl_profile.h"
 #include "wl_proto.h"
+#include "wl_proto_data.h"
+#include "wl_range.h"
+#include "wl_reassembly.h"
+#include "wl_stats.h"
+#include "wl_stream.h"
+#include "wl_tcp.h"
 #include "wl_tvbuff.h"
 #include "wl_value_string.h"
 #include "wl_funnel.h"
@@ -59,8 +78,14 @@
 
 extern lua_State *g_lua;
 
+unsigned luaW_file_generation(void);
+
+void luaW_push_file_table(lua_State *L);
+
 void *xmalloc(size_t size);
 
+void *xrealloc(void *ptr, size_t size);
+
 void *xstrdup(const char *str);
 
 #endif
@@ -45,6 +45,10 @@
  */
 
 lua_State *g_lua = NULL;
+#ifdef HAVE_POOL_ALLOC
+static struct wl_pool *g_pool = NULL;
+#endif
+static struct wl_memory *g_memory = NULL;
 
 static char *data_path = NULL;
 
@@ -73,6 +77,15 @@ void *xmalloc(size_t size)
     return p;
 }
 
+void *xrealloc(void *ptr, size_t size)
+{
+    void *p = realloc(ptr, size);
+    if (!p) {
+        ws_error("Out of memory");
+    }
+    return p;
+}
+
 void *xstrdup(const char *str)
 {
     if (!str)
@@ -116,6 +129,7 @@ static char *build_data_path(const char *name)
     return path;
 }
 
+#ifndef HAVE_POOL_ALLOC
 static void *l_alloc (void *ud _U_, void *ptr, size_t osize _U_, size_t nsize)
 {
     if (nsize == 0) {
@@ -129,6 +143,7 @@ static void *l_alloc (void *ud _U_, void *ptr, size_t osize _U_, size_t nsize)
     }
     return p;
 }
+#endif
 
 static int l_panic(lua_State *L)
 {
@@ -223,20 +238,50 @@ static int l_luaopen_wireshark(lua_State *L)
     wl_open_proto(L);
     wl_open_tvbuff(L);
     wl_open_pinfo(L);
+    wl_open_arena(L);
     wl_open_prefs(L);
+    wl_open_range(L);
     wl_open_addr(L);
+    wl_open_hash(L);
     wl_open_expert(L);
     wl_open_packet(L);
+    wl_open_tcp(L);
+    wl_open_reassembly(L);
+    wl_open_stream(L);
+    wl_open_conversation(L);
+    wl_open_proto_data(L);
+    wl_open_flow(L);
+    wl_open_prefix(L);
+    wl_open_mmap(L);
+    wl_open_pool(L);
+    wl_open_memory(L);
     wl_open_value_string(L);
 
     return 1;
 }
 
+static void wslua2_prefs_apply(void)
+{
+    wl_gc_prefs_apply();
+}
+
+/* The protocol of the plugin itself, for its preferences and expert infos */
+static void wslua2_register_plugin_protocol(void)
+{
+    int proto = proto_register_protocol("Lua 5.4 Plugin", "WSLUA2", "wslua2");
+    module_t *module = prefs_register_protocol(proto, wslua2_prefs_apply);
+
+    wl_gc_register_prefs(module);
+    wl_budget_register(proto, module);
+    wl_breaker_register(module);
+}
+
 void wslua2_register_all_protocols(register_cb cb, gpointer client_data)
 {
     lua_State *L = g_lua;
 
     ws_info("Registering all Lua protocols");
+    wslua2_register_plugin_protocol();
     BEGIN_STACK_DEBUG(L);
     lua_getglobal(L, MODULE_NAME);
     luaL_getsubtable(L, -1, TABLE_REGISTER_PROTOCOL);
@@ -244,7 +289,9 @@ void wslua2_register_all_protocols(register_cb cb, gpointer client_data)
     while (lua_next(L, 2)) {
         if (cb)
             cb(RA_PLUGIN_REGISTER, NULL, client_data);
+        int prev = luaW_memory_enter(L, luaW_memory_module_of(L, -1));
         lua_call(L, 0, 0);
+        luaW_memory_leave(L, prev);
     }
     lua_pop(L, 2); // pop tables
     END_STACK_DEBUG(L, 0);
@@ -262,7 +309,9 @@ void wslua2_register_all_handoffs(register_cb cb, gpointer client_data)
     while (lua_next(L, 2)) {
         if (cb)
             cb(RA_PLUGIN_HANDOFF, NULL, client_data);
+        int prev = luaW_memory_enter(L, luaW_memory_module_of(L, -1));
         lua_call(L, 0, 0);
+        luaW_memory_leave(L, prev);
     }
     lua_pop(L, 2); // pop tables
     END_STACK_DEBUG(L, 0);
@@ -360,6 +409,7 @@ static void load_lua_module(lua_State *L, const char *name)
     BEGIN_STACK_DEBUG(L);
     file_path = build_data_path(name);
     ws_debug("Load module \%s\"", file_path);
+    int prev = luaW_memory_enter(L, luaW_memory_add_module(L, name, file_path));
     l_dofile(L, file_path, false); /* pushes module on stack */
     luaL_checktype(L, -1, LUA_TTABLE);
     type = lua_getfield(L, -1, "register_protocol");
@@ -374,10 +424,58 @@ static void load_lua_module(lua_State *L, const char *name)
         lua_pop(L, 1);
     get_scrip_info(L, name, file_path);
     lua_pop(L, 1); // pop module
+    luaW_memory_leave(L, prev);
     free(file_path);
     END_STACK_DEBUG(L, 0);
 }
 
+#define FILE_TABLE "wslua2.file"
+
+/* Incremented when a capture file is closed */
+static unsigned file_generation = 1;
+static bool file_cb_registered = false;
+
+static bool l_file_cb(wmem_allocator_t *allocator _U_, wmem_cb_event_t event, void *data _U_)
+{
+    file_generation++;
+    if (g_lua != NULL) {
+        lua_pushnil(g_lua);
+        lua_setfield(g_lua, LUA_REGISTRYINDEX, FILE_TABLE);
+        luaW_gc_file_closed(g_lua);
+    }
+    file_cb_registered = (event == WMEM_CB_FREE_EVENT);
+    return file_cb_registered;
+}
+
+/*
+ * Returns a counter that changes each time the capture file scope is freed.
+ * State tied to a capture file compares it to the value saved when the
+ * state was created.
+ */
+unsigned luaW_file_generation(void)
+{
+    if (!file_cb_registered) {
+        wmem_register_callback(wmem_file_scope(), l_file_cb, NULL);
+        file_cb_registered = true;
+    }
+    return file_generation;
+}
+
+/*
+ * Pushes a table for state that lives as long as the capture file. The table
+ * is dropped when the file scope is freed.
+ */
+void luaW_push_file_table(lua_State *L)
+{
+    luaW_file_generation();
+    if (lua_getfield(L, LUA_REGISTRYINDEX, FILE_TABLE) == LUA_TTABLE)
+        return;
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, FILE_TABLE);
+}
+
 void wslua2_init(void)
 {
     lua_State *L;
@@ -386,8 +484,15 @@ void wslua2_init(void)
     const char *name;
     char *init_path;
 
-    L = g_lua = lua_newstate(l_alloc, NULL);
+#ifdef HAVE_POOL_ALLOC
+    g_pool = wl_pool_new();
+    g_memory = wl_memory_new(wl_pool_alloc, g_pool);
+#else
+    g_memory = wl_memory_new(l_alloc, NULL);
+#endif
+    L = g_lua = lua_newstate(wl_memory_alloc, g_memory);
     lua_atpanic(L, l_panic);
+    luaW_gc_init(L);
     luaL_openlibs(L);
 
     luaL_requiref(L, MODULE_NAME, l_luaopen_wireshark, true);
@@ -423,8 +528,12 @@ void wslua2_post_init(void)
     lua_State *L = g_lua;
     const char *opt;
 
+    if ((opt = ex_opt_get_next("wslua2.profile")) != NULL)
+        luaW_profile_start(L, opt);
     while ((opt = ex_opt_get_next("wslua2")) != NULL) {
+        int prev = luaW_memory_enter(L, luaW_memory_add_module(L, opt, opt));
         l_dofile(L, opt, false);
+        luaW_memory_leave(L, prev);
     }
 }
 
@@ -437,6 +546,9 @@ void wslua2_dissect_init(epan_dissect_t *edt)
     packet_info **ptr = NEWUSERDATA(L, packet_info *, "wslua.PacketInfo"); /* value */
     *ptr = pinfo;
     lua_rawset(L, LUA_REGISTRYINDEX);
+
+    luaW_arena_packet_begin(L);
+    luaW_gc_packet_begin(L);
 }
 
 void wslua2_dissect_cleanup(epan_dissect_t *edt)
@@ -444,16 +556,32 @@ void wslua2_dissect_cleanup(epan_dissect_t *edt)
     lua_State *L = g_lua;
     packet_info *pinfo = &edt->pi;
 
+    lua_pushlightuserdata(L, pinfo); /* key */
+    if (lua_rawget(L, LUA_REGISTRYINDEX) == LUA_TUSERDATA)
+        luaW_pinfo_release_scratch(L, -1);
+    lua_pop(L, 1);
+
     lua_pushlightuserdata(L, pinfo); /* key */
     lua_pushnil(L); /* value */
     lua_rawset(L, LUA_REGISTRYINDEX);
+
+    luaW_arena_packet_end(L);
+    luaW_gc_packet_end(L);
 }
 
 void wslua2_cleanup(void)
 {
-    if (g_lua)
+    if (g_lua) {
+        luaW_profile_stop(g_lua);
         lua_close(g_lua);
+    }
     g_lua = NULL;
+    wl_memory_destroy(g_memory);
+    g_memory = NULL;
+#ifdef HAVE_POOL_ALLOC
+    wl_pool_destroy(g_pool);
+    g_pool = NULL;
+#endif
     if (data_path)
         wmem_free(NULL, data_path);
     data_path = NULL;
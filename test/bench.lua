@@ -0,0 +1,476 @@
+-- Micro-benchmarks comparing native bindings with plain Lua implementations.
+-- Run with "tshark -Xwslua2:bench.lua -r empty.pcap" (or "make bench").
+
+ws = require('wireshark')
+
+local function bench(name, n, fn)
+    fn() -- warm up
+    local t0 = os.clock()
+    for _ = 1, n do
+        fn()
+    end
+    local dt = os.clock() - t0
+    print(string.format("%-36s %10.3f us/op", name, dt * 1e6 / n))
+end
+
+local function random_bytes(n)
+    local t = {}
+    for i = 1, n do
+        t[i] = string.char(math.random(0, 255))
+    end
+    return table.concat(t)
+end
+
+--
+-- Codecs
+--
+
+local B64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+local b64_dec = {}
+for i = 1, #B64 do
+    b64_dec[B64:byte(i)] = i - 1
+end
+
+local function lua_base64_encode(s)
+    local out = {}
+    for i = 1, #s, 3 do
+        local a, b, c = s:byte(i, i + 2)
+        local q = (a << 16) | ((b or 0) << 8) | (c or 0)
+        out[#out + 1] = string.char(
+            B64:byte((q >> 18) + 1),
+            B64:byte(((q >> 12) & 0x3f) + 1),
+            b and B64:byte(((q >> 6) & 0x3f) + 1) or 61,
+            c and B64:byte((q & 0x3f) + 1) or 61)
+    end
+    return table.concat(out)
+end
+
+local function lua_base64_decode(s)
+    local out = {}
+    local acc, n = 0, 0
+    for i = 1, #s do
+        local v = b64_dec[s:byte(i)]
+        if v then
+            acc = (acc << 6) | v
+            n = n + 6
+            if n >= 8 then
+                n = n - 8
+                out[#out + 1] = string.char((acc >> n) & 0xff)
+            end
+        end
+    end
+    return table.concat(out)
+end
+
+local function lua_hex_encode(s)
+    return (s:gsub(".", function(c) return string.format("%02x", c:byte()) end))
+end
+
+local function lua_hex_decode(s)
+    return (s:gsub("%x%x", function(h) return string.char(tonumber(h, 16)) end))
+end
+
+local function bench_codecs(size, n)
+    local raw = random_bytes(size)
+    local b64 = lua_base64_encode(raw)
+    local hex = lua_hex_encode(raw)
+    local raw_tvb = ws.tvb_new_from_data(raw, #raw)
+    local b64_tvb = ws.tvb_new_from_data(b64, #b64)
+    local hex_tvb = ws.tvb_new_from_data(hex, #hex)
+
+    print(string.format("## codecs, %d bytes", size))
+    bench("lua base64 decode", n, function()
+        return lua_base64_decode(b64_tvb:get_bytes(0, -1))
+    end)
+    bench("tvb:decode_base64", n, function()
+        return b64_tvb:decode_base64(0, -1)
+    end)
+    bench("lua base64 encode", n, function()
+        return lua_base64_encode(raw_tvb:get_bytes(0, -1))
+    end)
+    bench("tvb:encode_base64", n, function()
+        return raw_tvb:encode_base64(0, -1)
+    end)
+    bench("lua hex decode", n, function()
+        return lua_hex_decode(hex_tvb:get_bytes(0, -1))
+    end)
+    bench("tvb:decode_hex", n, function()
+        return hex_tvb:decode_hex(0, -1)
+    end)
+    bench("lua hex encode", n, function()
+        return lua_hex_encode(raw_tvb:get_bytes(0, -1))
+    end)
+    bench("tvb:encode_hex", n, function()
+        return raw_tvb:encode_hex(0, -1)
+    end)
+end
+
+local function bench_hash(n)
+    local b = random_bytes(1500)
+    local tvb = ws.tvb_new_from_data(b, #b)
+    local src = ws.Address.ipv4("192.168.1.2")
+    local dst = ws.Address.ipv4("10.0.0.1")
+    local flows = {}
+
+    print("## hash, flow key lookup")
+    bench("string key", n, function()
+        local k = tostring(src) .. ":" .. 1234 .. "-" .. tostring(dst) .. ":" .. 80
+        flows[k] = true
+    end)
+    bench("ws.hash.xxh3 key", n, function()
+        flows[ws.hash.xxh3(src, 1234, dst, 80)] = true
+    end)
+    print("## hash, 1500 bytes payload")
+    bench("tvb:get_bytes key", n, function()
+        flows[tvb:get_bytes(0, -1)] = true
+    end)
+    bench("ws.hash.xxh3", n, function()
+        return ws.hash.xxh3(tvb, 0, -1)
+    end)
+    local key = random_bytes(16)
+    bench("ws.hash.siphash", n, function()
+        return ws.hash.siphash(key, tvb, 0, -1)
+    end)
+end
+
+local function lua_byte_stats(tvb)
+    local hist = {}
+    local len = tvb:captured_length()
+    local printable, zero = 0, 0
+    for i = 0, 255 do
+        hist[i] = 0
+    end
+    for i = 0, len - 1 do
+        local c = tvb:uint8(i)
+        hist[c] = hist[c] + 1
+        if c == 0 then
+            zero = zero + 1
+        elseif c >= 0x20 and c < 0x7f then
+            printable = printable + 1
+        end
+    end
+    local entropy = 0
+    for i = 0, 255 do
+        if hist[i] > 0 then
+            local p = hist[i] / len
+            entropy = entropy - p * math.log(p, 2)
+        end
+    end
+    return entropy, printable / len, zero / len
+end
+
+local function bench_byte_stats(size, n)
+    local b = random_bytes(size)
+    local tvb = ws.tvb_new_from_data(b, #b)
+    local hist = {}
+
+    print(string.format("## byte stats, %d bytes", size))
+    bench("lua byte stats", n, function()
+        return lua_byte_stats(tvb)
+    end)
+    bench("tvb:byte_stats", n, function()
+        return tvb:byte_stats(0, -1)
+    end)
+    bench("tvb:byte_stats with histogram", n, function()
+        return tvb:byte_stats(0, -1, hist)
+    end)
+end
+
+local function bench_vals(size, n)
+    local entries = {}
+    for i = 1, size do
+        entries[i] = {i * 3, "value " .. i}
+    end
+    local vals = ws.vals(entries)
+    local v = (size // 2) * 3
+
+    print(string.format("## value strings, %d entries", size))
+    bench("lua linear scan", n, function()
+        for _, e in ipairs(entries) do
+            if e[1] == v then
+                return e[2]
+            end
+        end
+    end)
+    bench("ws.val_to_str", n, function()
+        return ws.val_to_str(v, vals, "Unknown (%d)")
+    end)
+    bench("ws.str_to_val", n, function()
+        return ws.str_to_val("value 1", vals)
+    end)
+end
+
+local function bench_prefs(n)
+    local proto = ws.proto_register_protocol("Wslua2 Benchmark", "Wslua2 Bench", "wslua2bench")
+    local prefs = ws.prefs.register_protocol(proto)
+    ws.prefs.register_uint_preference(prefs, "port", "Port", "Port", 8080)
+    local values = ws.prefs.bind(prefs)
+
+    print("## preference read")
+    bench("prefs.port()", n, function()
+        return prefs.port()
+    end)
+    bench("bound table", n, function()
+        return values.port
+    end)
+end
+
+local function bench_range(n)
+    local ports = {}
+    for p = 10000, 12000 do
+        ports[#ports + 1] = tostring(p)
+    end
+    local str = table.concat(ports, ",")
+    local r = ws.Range.new(str, 65535)
+    local set = {}
+    for p = 10000, 12000 do
+        set[p] = true
+    end
+
+    print("## port range membership")
+    bench("lua set", n, function()
+        return set[11000]
+    end)
+    bench("range[port]", n, function()
+        return r[11000]
+    end)
+    bench("range:contains(port)", n, function()
+        return r:contains(11000)
+    end)
+end
+
+-- Length-prefixed messages: 2 bytes big endian length followed by the body
+local function stream_parser(s)
+    while true do
+        local len = string.unpack(">I2", s:need(2))
+        s:emit(s:need(len))
+    end
+end
+
+local function lua_stream_parser()
+    local state = { buf = "", len = nil }
+    return function(data)
+        local out = {}
+        local buf = state.buf .. data
+        local pos = 1
+        while true do
+            if state.len == nil then
+                if #buf - pos + 1 < 2 then break end
+                state.len = string.unpack(">I2", buf, pos)
+                pos = pos + 2
+            end
+            if #buf - pos + 1 < state.len then break end
+            out[#out + 1] = buf:sub(pos, pos + state.len - 1)
+            pos = pos + state.len
+            state.len = nil
+        end
+        state.buf = buf:sub(pos)
+        return out
+    end
+end
+
+local function bench_stream(seg_size, n)
+    local msgs = {}
+    for i = 1, 200 do
+        msgs[i] = string.pack(">s2", random_bytes(math.random(0, 200)))
+    end
+    local data = table.concat(msgs)
+    local segments = {}
+    for i = 1, #data, seg_size do
+        segments[#segments + 1] = data:sub(i, i + seg_size - 1)
+    end
+
+    print(string.format("## stream parser, %d messages in %d byte segments", #msgs, seg_size))
+    bench("lua state machine", n, function()
+        local feed = lua_stream_parser()
+        for i = 1, #segments do
+            feed(segments[i])
+        end
+    end)
+    bench("Stream coroutine", n, function()
+        local st = ws.Stream.new(stream_parser)
+        for i = 1, #segments do
+            st:feed(segments[i])
+        end
+    end)
+end
+
+local function bench_flow(nflows, n)
+    local pinfos = {}
+    local dst = ws.Address.new(ws.Address.ipv4("192.168.0.1"))
+    for i = 1, nflows do
+        local pinfo = ws.pinfo.new()
+        pinfo.src = ws.Address.new(ws.Address.ipv4(string.format("10.0.%d.%d", i // 256, i % 256)))
+        pinfo.dst = dst
+        pinfos[i] = pinfo
+    end
+
+    local flows = {}
+    local ft = ws.FlowTable.new{ capacity = nflows, fields = { packets = "integer", bytes = "integer" } }
+    local i = 0
+
+    print(string.format("## flow table update, %d flows", nflows))
+    bench("lua table, string key", n, function()
+        i = i % nflows + 1
+        local pinfo = pinfos[i]
+        local key = tostring(pinfo.src) .. ":" .. pinfo.src_port .. "-" ..
+                    tostring(pinfo.dst) .. ":" .. pinfo.dst_port
+        local flow = flows[key]
+        if flow == nil then
+            flow = { packets = 0, bytes = 0 }
+            flows[key] = flow
+        end
+        flow.packets = flow.packets + 1
+        flow.bytes = flow.bytes + 100
+    end)
+    bench("FlowTable", n, function()
+        i = i % nflows + 1
+        local slot = ft:insert(pinfos[i])
+        ft:add(slot, "packets", 1, "bytes", 100)
+    end)
+end
+
+local function bench_prefix(nprefixes, n)
+    local pt = ws.PrefixTable.new()
+    local by_len = {}
+    for len = 0, 32 do
+        by_len[len] = {}
+    end
+    for i = 1, nprefixes do
+        local len = math.random(8, 24)
+        local net = math.random(0, 0xffffffff) & (0xffffffff << (32 - len)) & 0xffffffff
+        pt:add(string.format("%d.%d.%d.%d/%d", net >> 24, net >> 16 & 255, net >> 8 & 255, net & 255, len), i)
+        by_len[len][net] = i
+    end
+
+    local ints, addrs = {}, {}
+    for i = 1, 1000 do
+        local a = math.random(0, 0xffffffff)
+        ints[i] = a
+        addrs[i] = ws.Address.ipv4(string.format("%d.%d.%d.%d", a >> 24, a >> 16 & 255, a >> 8 & 255, a & 255))
+    end
+    local i = 0
+
+    print(string.format("## longest prefix match, %d prefixes", nprefixes))
+    bench("lua tables by prefix length", n, function()
+        i = i % 1000 + 1
+        local a = ints[i]
+        for len = 32, 0, -1 do
+            local v = by_len[len][a & (0xffffffff << (32 - len)) & 0xffffffff]
+            if v ~= nil then
+                return v
+            end
+        end
+    end)
+    bench("PrefixTable", n, function()
+        i = i % 1000 + 1
+        return pt:lookup(addrs[i])
+    end)
+    print(string.format("PrefixTable memory: %d bytes", (pt:memory())))
+end
+
+local function bench_mmap(nkeys, n)
+    local csv, path = os.tmpname(), os.tmpname()
+    local f = io.open(csv, "w")
+    for i = 1, nkeys do
+        f:write(string.format("device-%d,Device name %d\n", i, i))
+    end
+    f:close()
+    ws.util.mmap_table_build(csv, path)
+
+    local keys = {}
+    for i = 1, 1000 do
+        keys[i] = "device-" .. math.random(nkeys)
+    end
+    local t, mt
+    local i = 0
+
+    print(string.format("## enrichment table, %d keys", nkeys))
+    bench("load csv into lua table", 1, function()
+        t = {}
+        for line in io.lines(csv) do
+            local k, v = line:match("([^,]*),(.*)")
+            t[k] = v
+        end
+    end)
+    bench("mmap_table open", 1, function()
+        mt = ws.util.mmap_table(path)
+    end)
+    bench("lua table lookup", n, function()
+        i = i % 1000 + 1
+        return t[keys[i]]
+    end)
+    bench("MmapTable lookup", n, function()
+        i = i % 1000 + 1
+        return mt:get(keys[i])
+    end)
+    mt:close()
+    os.remove(csv)
+    os.remove(path)
+end
+
+local function bench_alloc(n)
+    local i = 0
+
+    -- Run once with each value of ENABLE_POOL_ALLOC to compare the allocators
+    print(string.format("## allocation-heavy dissector path, %s allocator", ws.util.alloc_stats().allocator))
+    bench("tables, strings and closures", n, function()
+        i = i + 1
+        local fields = { src = "10.0.0." .. (i % 256), dst = "10.0.0.1", port = i % 65536 }
+        local info = string.format("%s -> %s:%d", fields.src, fields.dst, fields.port)
+        local items = {}
+        for j = 1, 8 do
+            items[j] = { name = "f" .. j, value = j * i }
+        end
+        return function() return info, items end
+    end)
+    bench("Address objects", n, function()
+        i = i + 1
+        return ws.Address.new(ws.AT_IPv4, "10.0." .. (i >> 8 & 255) .. "." .. (i & 255))
+    end)
+    local stats = ws.util.alloc_stats()
+    if stats.peak then
+        print(string.format("live %d bytes, peak %d bytes, %d pages", stats.live, stats.peak, stats.pages))
+    end
+end
+
+local function bench_budget(size, n)
+    local tvb = ws.tvb_new_from_data(random_bytes(size), size)
+
+    -- A TLV walk, the kind of loop the budget is for
+    local function walk()
+        local offset, count = 0, 0
+        while offset + 2 <= size do
+            local len = tvb:uint8(offset + 1) & 7
+            offset = offset + 2 + len
+            count = count + 1
+        end
+        return count
+    end
+
+    -- The CPU budget uses the same count hook as debug.sethook()
+    print(string.format("## CPU budget hook, %d bytes", size))
+    bench("without hook", n, walk)
+    debug.sethook(function() end, "", 1000000)
+    bench("with count hook", n, walk)
+    debug.sethook()
+end
+
+math.randomseed(0)
+bench_codecs(64, 20000)
+bench_codecs(1500, 2000)
+bench_hash(20000)
+bench_byte_stats(64, 20000)
+bench_byte_stats(1500, 2000)
+bench_vals(8, 20000)
+bench_vals(2000, 20000)
+bench_prefs(100000)
+bench_range(100000)
+bench_stream(64, 500)
+bench_stream(1460, 500)
+bench_flow(1000, 100000)
+bench_prefix(1000, 100000)
+bench_prefix(100000, 100000)
+bench_mmap(1000000, 100000)
+bench_alloc(100000)
+bench_budget(1500, 20000)
@@ -2,6 +2,16 @@
 lu = require('luaunit')
 ws = require('wireshark')
 
+-- Checks that need an open capture file run on the packets of udp.pcap,
+-- which tshark dissects in two passes (-2). Each check is called with
+-- tvb, pinfo and tree for every packet of both passes. A failure exits
+-- tshark with an error.
+local packet_checks = {}
+
+local function add_packet_check(name, check)
+    packet_checks[#packet_checks + 1] = { name = name, check = check }
+end
+
 function testVals()
     local vals = ws.vals{
         {1, "first value"},
@@ -24,6 +34,120 @@ function testTvb()
     lu.assertEquals(tvb:reported_length(), l)
 end
 
+function testValsExt()
+    local entries = {}
+    for i = 100, 1, -1 do
+        table.insert(entries, {i * 2, "value " .. i * 2})
+    end
+    table.insert(entries, {2, "duplicate"})
+    table.insert(entries, {0x100000004, "truncated duplicate"})
+    local vals = ws.vals(entries)
+    lu.assertEquals(ws.val_to_str(2, vals, "Unknown (%d)"), "value 2")
+    lu.assertEquals(ws.val_to_str(4, vals, "Unknown (%d)"), "value 4")
+    lu.assertNil(ws.str_to_val("truncated duplicate", vals))
+    lu.assertEquals(ws.val_to_str(200, vals, "Unknown (%d)"), "value 200")
+    lu.assertEquals(ws.val_to_str(3, vals, "Unknown (%d)"), "Unknown (3)")
+    lu.assertEquals(ws.str_to_val("value 64", vals), 64)
+    lu.assertNil(ws.str_to_val("duplicate", vals))
+    lu.assertEquals(ws.str_to_val("duplicate", vals, -1), -1)
+end
+
+function testRangeStrings()
+    local rvals = ws.rvals{
+        {0, 9, "low"},
+        {10, 99, "medium"},
+    }
+    lu.assertEquals(ws.val_to_str(5, rvals, "Unknown (%d)"), "low")
+    lu.assertEquals(ws.val_to_str(10, rvals, "Unknown (%d)"), "medium")
+    lu.assertEquals(ws.val_to_str(100, rvals, "Unknown (%d)"), "Unknown (100)")
+    lu.assertEquals(ws.str_to_val("medium", rvals), 10)
+    lu.assertError(ws.rvals, {{9, 0, "bad"}})
+
+    local vals64 = ws.vals64{
+        {0x100000000, "big"},
+    }
+    lu.assertEquals(ws.val_to_str(0x100000000, vals64, "Unknown"), "big")
+    lu.assertEquals(ws.val_to_str(0, vals64, "Unknown"), "Unknown")
+
+    local strstrs = ws.strstrs{
+        {"GET", "Retrieve"},
+        {"PUT", "Store"},
+    }
+    lu.assertEquals(ws.val_to_str("PUT", strstrs, "Unknown"), "Store")
+    lu.assertEquals(ws.val_to_str("POST", strstrs, "Unknown"), "Unknown")
+    lu.assertEquals(ws.str_to_val("Retrieve", strstrs), "GET")
+end
+
+function testCodecs()
+    local b = "hello, world"
+    local tvb = ws.tvb_new_from_data(b, #b)
+
+    lu.assertEquals(tvb:encode_hex(0, 5), "68656c6c6f")
+    lu.assertEquals(tvb:encode_hex(0, 1, true), "68")
+    lu.assertEquals(tvb:encode_base64(0, -1), "aGVsbG8sIHdvcmxk")
+    lu.assertEquals(tvb:encode_base64(0, 4), "aGVsbA==")
+    lu.assertEquals(tvb:encode_base32(0, 5), "NBSWY3DP")
+
+    local enc = "aGVsbG8s\r\nIHdvcmxk"
+    local child = ws.tvb_new_from_data(enc, #enc):decode_base64(0, -1)
+    lu.assertEquals(child:get_bytes(0, -1), b)
+    enc = "68 65 6C 6C 6F"
+    child = ws.tvb_new_from_data(enc, #enc):decode_hex(0, -1)
+    lu.assertEquals(child:get_bytes(0, -1), "hello")
+    enc = "nbswy3dp"
+    child = ws.tvb_new_from_data(enc, #enc):decode_base32(0, -1)
+    lu.assertEquals(child:get_bytes(0, -1), "hello")
+
+    enc = "not base64!"
+    lu.assertNil(ws.tvb_new_from_data(enc, #enc):decode_base64(0, -1))
+end
+
+function testHash()
+    local b = "hello, world"
+    local tvb = ws.tvb_new_from_data(b, #b)
+
+    lu.assertEquals(ws.hash.xxh3(b), 0x302cd5fba73d006c)
+    lu.assertEquals(ws.hash.xxh3(tvb, 0, -1), 0x302cd5fba73d006c)
+    lu.assertEquals(ws.hash.xxh3("hello, ", "world"), 0x4c27a79422515e2b)
+    lu.assertEquals(ws.hash.xxh3_seed(ws.hash.xxh3("hello, "), tvb, 7, 5), 0x4c27a79422515e2b)
+    local lo, hi = ws.hash.xxh3_128(b)
+    lu.assertEquals(lo, 0x4c0abe17b55db69c)
+    lu.assertEquals(hi, 0x11c83d9c1ee36816)
+
+    local ipv4 = ws.Address.ipv4("192.168.1.2")
+    lu.assertEquals(ws.hash.xxh3(ws.Address.new(ipv4), 80), ws.hash.xxh3(ipv4, 80))
+    lu.assertNotEquals(ws.hash.xxh3(ipv4, 80), ws.hash.xxh3(ipv4, 81))
+    -- the address type is part of the key, not just the address bytes
+    lu.assertNotEquals(ws.hash.xxh3(ipv4), ws.hash.xxh3(ws.Address.new(ipv4):pack()))
+
+    local key = "\0\1\2\3\4\5\6\7\8\9\10\11\12\13\14\15"
+    local msg = key:sub(1, 15)
+    lu.assertEquals(ws.hash.siphash(key), 0x726fdb47dd0e0e31)
+    lu.assertEquals(ws.hash.siphash(key, msg), 0xa129ca6149be45e5)
+    local msg_tvb = ws.tvb_new_from_data(msg, #msg)
+    lu.assertEquals(ws.hash.siphash(key, msg_tvb, 0, 3, msg:sub(4)), 0xa129ca6149be45e5)
+    lu.assertError(ws.hash.siphash, "short key", msg)
+end
+
+function testByteStats()
+    local b = "abcd\0\0\0\0"
+    local tvb = ws.tvb_new_from_data(b, #b)
+    local hist = {}
+
+    local entropy, printable, zero = tvb:byte_stats(0, -1, hist)
+    lu.assertAlmostEquals(entropy, 2.0, 1e-9)
+    lu.assertEquals(printable, 0.5)
+    lu.assertEquals(zero, 0.5)
+    lu.assertEquals(hist[0], 4)
+    lu.assertEquals(hist[string.byte("a")], 1)
+    lu.assertEquals(hist[255], 0)
+
+    entropy, printable, zero = tvb:byte_stats(4, 4, hist)
+    lu.assertEquals(entropy, 0)
+    lu.assertEquals(zero, 1)
+    lu.assertEquals(hist[string.byte("a")], 0)
+end
+
 function testAddr()
     local ipv4 = ws.Address.ipv4("192.168.1.2")
     local ipv6 = ws.Address.ipv6("2001::2")
@@ -35,14 +159,176 @@ function testAddr()
     lu.assertEquals(tostring(addr), "2001::2")
     addr = ws.Address.new(ws.AT_IPv4, "1.1.1.1")
     lu.assertEquals(tostring(addr), "1.1.1.1")
+
+    local a = ws.Address.new(ws.AT_IPv4, "10.0.0.1")
+    local b = ws.Address.new(ws.AT_IPv4, "10.0.0.2")
+    lu.assertIs(ws.Address.new(ws.AT_IPv4, "10.0.0.1"), a)
+    lu.assertTrue(a == ws.Address.new(ws.AT_IPv4, "10.0.0.1"))
+    lu.assertTrue(a ~= b)
+    lu.assertFalse(a == ws.Address.ipv4("10.0.0.1"))
+    lu.assertFalse(ws.Address.ipv4("10.0.0.1") == a)
+    lu.assertTrue(a < b)
+    lu.assertTrue(a <= a)
+    local seen = { [a] = true }
+    lu.assertTrue(seen[ws.Address.new(ws.AT_IPv4, "10.0.0.1")])
+
+    local pinfo = ws.pinfo.new()
+    pinfo.src = b
+    lu.assertIs(pinfo.src, pinfo.src)
+    lu.assertEquals(pinfo.src, b)
+end
+
+function testRange()
+    local r = ws.Range.new("80,443,8000-8080")
+    lu.assertTrue(r[80])
+    lu.assertTrue(r[8040])
+    lu.assertFalse(r[81])
+    lu.assertFalse(r[-1])
+    lu.assertTrue(r:contains(443))
+    lu.assertEquals(tostring(r), "80,443,8000-8080")
+    lu.assertEquals(r, ws.Range.new("80,443,8000-8080"))
+
+    local wide = ws.Range.new("1,4000000000")
+    lu.assertTrue(wide[4000000000])
+    lu.assertFalse(wide[2])
+    lu.assertError(ws.Range.new, "1-x")
+    lu.assertError(ws.Range.new, "70000", 65535)
 end
 
 function testPreference()
-    local proto = ws.proto_register_protocol("Wslua2 Test Preference", "Wslua2 Pref", "wslua2")
+    local proto = ws.proto_register_protocol("Wslua2 Test Preference", "Wslua2 Pref", "wslua2pref")
     local prefs = ws.prefs.register_protocol(proto)
     ws.prefs.register_bool_preference(prefs, "test_wslua", "title", "Wslua2 test suite", true)
 
     lu.assertTrue(prefs.test_wslua())
+
+    ws.prefs.register_uint_preference(prefs, "port", "Port", "TCP port", 8080)
+    ws.prefs.register_enum_preference(prefs, "mode", "Mode", "Decode mode", 2, {
+        {"fast", "Fast", 1},
+        {"full", "Full", 2},
+    })
+    ws.prefs.register_string_preference(prefs, "key", "Key", "Decryption key", "secret")
+    ws.prefs.register_range_preference(prefs, "ports", "Ports", "UDP ports", "53,5353-5355", 65535)
+    lu.assertEquals(prefs.port(), 8080)
+    lu.assertEquals(prefs.mode(), 2)
+    lu.assertEquals(prefs.key(), "secret")
+    lu.assertEquals(tostring(prefs.ports()), "53,5353-5355")
+    lu.assertTrue(prefs.ports()[5354])
+    lu.assertEquals(tostring(prefs.port), "wslua.Preference: 8080")
+    lu.assertError(ws.prefs.register_range_preference, prefs, "bad", "Bad", "Bad range", "1-x", 100)
+
+    local values = ws.prefs.bind(prefs)
+    lu.assertEquals(values.port, 8080)
+    lu.assertEquals(values.test_wslua, true)
+    local t = {}
+    lu.assertIs(ws.prefs.bind(prefs, t), t)
+    lu.assertEquals(t.key, "secret")
+
+    local changed = {}
+    ws.prefs.on_change(prefs, function(name, value) changed[name] = value end)
+    local data = ws.find_dissector("data")
+    local udp_port = ws.DissectorTable.get("udp.port")
+    ws.dissector_add_uint_range("udp.port", prefs.ports, data)
+
+    -- a non-range preference leaves the dissector ranges alone
+    ws.prefs.set("wslua2pref.port", 9090)
+    lu.assertEquals(prefs.port(), 9090)
+    lu.assertEquals(values.port, 9090)
+    lu.assertEquals(changed.port, 9090)
+    ws.prefs.set("wslua2pref.key", "other")
+    lu.assertEquals(t.key, "other")
+    lu.assertEquals(udp_port:get_handle(5354), data)
+
+    ws.prefs.set("wslua2pref.ports", "7000-7001")
+    lu.assertEquals(tostring(values.ports), "7000-7001")
+    lu.assertEquals(udp_port:get_handle(7001), data)
+    lu.assertNotEquals(udp_port:get_handle(5354), data)
+    ws.dissector_delete_uint_range("udp.port", prefs.ports, data)
+    lu.assertError(ws.prefs.set, "wslua2pref.no_such_pref", 1)
+end
+
+function testDissectorTable()
+    local ip_proto = ws.DissectorTable.get("ip.proto")
+    lu.assertNotNil(ip_proto)
+    lu.assertEquals(tostring(ip_proto), "DissectorTable: ip.proto")
+    lu.assertIs(ws.DissectorTable.get("ip.proto"), ip_proto)
+    lu.assertNil(ws.DissectorTable.get("wslua2.no_such_table"))
+
+    local data = ws.find_dissector("data")
+    lu.assertNotNil(data)
+    lu.assertEquals(data, ws.find_dissector("data"))
+    lu.assertNil(ws.find_dissector("wslua2_no_such_dissector"))
+    lu.assertNotNil(ip_proto:get_handle(6))
+    lu.assertNil(ip_proto:get_handle(255))
+    lu.assertNil(data:stats())
+end
+
+function testHeuristic()
+    local proto = ws.proto_register_protocol("Wslua2 Test Heuristic", "Wslua2 Heur", "wslua2heur")
+    local function dissect(tvb, pinfo, tree, cinfo)
+        return false
+    end
+    local heur = ws.heur_dissector_add("udp", dissect, "Wslua2 heuristic", "wslua2_udp", proto, {
+        min_length = 8,
+        magic = "\x12\x30",
+        mask = "\xff\xf0",
+        offset = 2,
+        ports = "5000-5010",
+    })
+    local stats = heur:stats()
+    lu.assertEquals(stats.calls, 0)
+    lu.assertEquals(stats.rejected, 0)
+    lu.assertEquals(stats.timeouts, 0)
+    lu.assertEquals(stats.skipped, 0)
+    lu.assertFalse(stats.disabled)
+    lu.assertError(ws.heur_dissector_add, "wslua2_no_such_list", dissect, "x", "x", proto)
+    -- One heuristic per protocol and list
+    lu.assertError(ws.heur_dissector_add, "udp", dissect, "x", "wslua2_udp2", proto)
+    ws.DissectorTable.new_heuristic("wslua2heur", "Wslua2 heuristic test", proto)
+    lu.assertError(ws.heur_dissector_add, "wslua2heur", dissect, "x", "wslua2_bad", proto, {
+        magic = "\x12\x30",
+        mask = "\xff",
+    })
+    lu.assertError(ws.heur_dissector_add, "wslua2heur", dissect, "x", "wslua2_bad", proto, { min_length = -1 })
+    lu.assertError(ws.heur_dissector_add, "wslua2heur", dissect, "x", "wslua2_bad", proto, { offset = -1 })
+    lu.assertError(ws.heur_dissector_add, "wslua2heur", dissect, "x", "wslua2_bad", proto, {
+        offset = 0x7fffffff,
+        magic = "\x12",
+    })
+end
+
+function testHeuristicPrefilter()
+    local proto = ws.proto_register_protocol("Wslua2 Test Prefilter", "Wslua2 Prefilter", "wslua2prefilter")
+    local list = ws.DissectorTable.new_heuristic("wslua2prefilter", "Wslua2 prefilter test", proto)
+    local entered = 0
+    local heur = ws.heur_dissector_add("wslua2prefilter", function(tvb, pinfo, tree, cinfo)
+        entered = entered + 1
+        return tvb:uint8(2) == 1
+    end, "Wslua2 prefilter", "wslua2_prefilter", proto, {
+        min_length = 4,
+        magic = "\xca\xf0",
+        mask = "\xff\xf0",
+        ports = "5000",
+    })
+    local pinfo = ws.pinfo.new()
+    pinfo.dst_port = 5000
+
+    lu.assertFalse(list:try_heuristic(ws.tvb_new_from_data("\xca\xfe\x01", 3), pinfo))
+    lu.assertFalse(list:try_heuristic(ws.tvb_new_from_data("\xbe\xef\x01\x00", 4), pinfo))
+    pinfo.dst_port = 6000
+    lu.assertFalse(list:try_heuristic(ws.tvb_new_from_data("\xca\xfe\x01\x00", 4), pinfo))
+    lu.assertEquals(entered, 0)
+
+    pinfo.dst_port = 5000
+    lu.assertTrue(list:try_heuristic(ws.tvb_new_from_data("\xca\xfe\x01\x00", 4), pinfo))
+    lu.assertFalse(list:try_heuristic(ws.tvb_new_from_data("\xca\xf1\x02\x00", 4), pinfo))
+    lu.assertEquals(entered, 2)
+
+    local stats = heur:stats()
+    lu.assertEquals(stats.calls, 5)
+    lu.assertEquals(stats.rejected, 3)
+    lu.assertEquals(stats.accepted, 1)
+    lu.assertEquals(stats.errors, 0)
 end
 
 function testPinfo()
@@ -50,11 +336,434 @@ function testPinfo()
 
     pinfo.fragmented = true
     lu.assertEquals(pinfo.fragmented, true)
+    lu.assertEquals(pinfo.visited, false)
+
+    local scratch = pinfo.scratch
+    scratch.key = "value"
+    lu.assertIs(pinfo.scratch, scratch)
+    lu.assertEquals(pinfo.scratch.key, "value")
+
+    local last_scratch = nil
+    add_packet_check("testPinfoScratch", function(tvb, pinfo, tree)
+        local scratch = pinfo.scratch
+        lu.assertNil(next(scratch))
+        if last_scratch ~= nil then
+            -- the table of the previous packet was emptied and reused
+            lu.assertIs(scratch, last_scratch)
+        end
+        scratch.length = tvb:captured_length()
+        last_scratch = scratch
+    end)
+
+    pinfo.desegment_offset = 4
+    pinfo.desegment_len = ws.DESEGMENT_ONE_MORE_SEGMENT
+    lu.assertEquals(pinfo.desegment_offset, 4)
+    lu.assertEquals(pinfo.desegment_len, ws.DESEGMENT_ONE_MORE_SEGMENT)
+end
+
+function testTcpPdus()
+    local function dissect(tvb, pinfo, tree, cinfo)
+        return tvb:captured_length()
+    end
+
+    lu.assertNotNil(ws.TcpPdus.new{ dissector = dissect, length_size = 2 })
+    lu.assertNotNil(ws.TcpPdus.new{
+        dissector = dissect,
+        length_offset = 1,
+        length_size = 4,
+        little_endian = true,
+        length_mask = 0x00fffff0,
+        length_adjust = 8,
+    })
+    lu.assertNotNil(ws.TcpPdus.new{
+        dissector = dissect,
+        fixed_len = 4,
+        get_len = function(tvb, pinfo, offset) return 4 + tvb:uint8(offset) end,
+    })
+    lu.assertError(ws.TcpPdus.new, { length_size = 2 })
+    lu.assertError(ws.TcpPdus.new, { dissector = dissect, length_size = 5 })
+    lu.assertError(ws.TcpPdus.new, { dissector = dissect, get_len = dissect })
+
+    -- one dissector call per PDU, framed in C from a 2-byte length field
+    local proto = ws.proto_register_protocol("Wslua2 Test PDUs", "Wslua2 PDUs", "wslua2pdus")
+    local pdus = {}
+    local framing = ws.TcpPdus.new{
+        dissector = function(tvb, pinfo, tree, cinfo)
+            pdus[#pdus + 1] = tvb:get_bytes(2, -1)
+            return tvb:captured_length()
+        end,
+        length_size = 2,
+        length_adjust = 2,
+    }
+    local handle = ws.register_dissector(proto, "wslua2pdus", function(tvb, pinfo, tree, cinfo)
+        return framing:dissect(tvb, pinfo, tree, false)
+    end)
+    local data = string.pack(">s2>s2>s2", "one", "", "three")
+    lu.assertEquals(handle:call(ws.tvb_new_from_data(data, #data), ws.pinfo.new(1)), #data)
+    lu.assertEquals(pdus, { "one", "", "three" })
+end
+
+function testReassemblyTable()
+    local proto = ws.proto_register_protocol("Wslua2 Test Reassembly", "Wslua2 Reas", "wslua2reas")
+
+    local reas = ws.ReassemblyTable.new(proto, "Message fragments")
+    lu.assertNotNil(reas)
+    lu.assertNotNil(ws.ReassemblyTable.new(proto, "Segment fragments", true))
+    lu.assertError(ws.ReassemblyTable.new, proto)
+
+    local tvb1 = ws.tvb_new_from_data("hello, ", 7)
+    local tvb2 = ws.tvb_new_from_data("world", 5)
+    local pinfo1, pinfo2 = ws.pinfo.new(1), ws.pinfo.new(2)
+    lu.assertNil(reas:add_seq(tvb1, 0, pinfo1, 42, 0, 7, true))
+    local fh = reas:add_seq(tvb2, 0, pinfo2, 42, 1, 5, false)
+    lu.assertNotNil(fh)
+    local msg = reas:process(tvb2, 0, pinfo2, "Reassembled message", fh)
+    lu.assertEquals(msg:get_bytes(0, -1), "hello, world")
+    lu.assertNil(reas:process(tvb1, 0, pinfo1, "Reassembled message", nil))
+end
+
+function testStream()
+    local function parser(s)
+        while true do
+            local len = string.unpack(">I2", s:need(2))
+            s:emit(s:need(len))
+        end
+    end
+
+    local data = string.pack(">s2>s2>s2", "hello", "", string.rep("x", 1000))
+    local st = ws.Stream.new(parser)
+    local msgs = {}
+    for i = 1, #data, 7 do
+        for _, msg in ipairs(st:feed(data:sub(i, i + 6))) do
+            msgs[#msgs + 1] = msg
+        end
+    end
+    lu.assertEquals(#msgs, 3)
+    lu.assertEquals(msgs[1], "hello")
+    lu.assertEquals(msgs[2], "")
+    lu.assertEquals(msgs[3], string.rep("x", 1000))
+
+    st = ws.Stream.new(function(s)
+        s:skip(1)
+        s:emit(s:peek(2))
+        s:emit(s:available())
+        error("bad message")
+    end)
+    lu.assertEquals(st:feed("a"), {})
+    lu.assertErrorMsgContains("bad message", st.feed, st, "bcd")
+    lu.assertError(st.feed, st, "e")
+
+    st = ws.Stream.new(function(s) s:emit(s:need(1)) end)
+    lu.assertEquals(st:feed("ab"), { "a" })
+    lu.assertEquals(st:feed("cd"), {})
+end
+
+function testConversation()
+    lu.assertError(ws.Conversation.find, nil)
+    lu.assertError(ws.Conversation.get, {})
+
+    local proto = ws.proto_register_protocol("Wslua2 Test Conversation", "Wslua2 Conv", "wslua2conv")
+    add_packet_check("testConversation", function(tvb, pinfo, tree)
+        local conv = ws.Conversation.get(pinfo)
+        lu.assertEquals(ws.Conversation.find(pinfo), conv)
+        lu.assertEquals(tostring(conv), "Conversation: " .. conv:id())
+        lu.assertNil(conv:get_data(proto))
+        conv:set_data(proto, { packets = 1 })
+        lu.assertEquals(ws.Conversation.get(pinfo):get_data(proto).packets, 1)
+        conv:set_data(proto, nil)
+        lu.assertNil(conv:get_data(proto))
+    end)
+end
+
+function testMemo()
+    local pinfo = ws.pinfo.new()
+
+    lu.assertError(ws.memo, pinfo, 1.5, function() end)
+    lu.assertError(ws.memo, pinfo, "key", nil)
+    lu.assertError(ws.p_get_proto_data, pinfo, nil, 0)
+
+    local proto = ws.proto_register_protocol("Wslua2 Test Memo", "Wslua2 Memo", "wslua2memo")
+    local calls = {}
+    add_packet_check("testMemo", function(tvb, pinfo, tree)
+        -- the packets of udp.pcap have different lengths
+        local len = tvb:captured_length()
+        local function compute(n)
+            calls[len] = (calls[len] or 0) + 1
+            -- memoized while the outer value is computed, must not be lost
+            lu.assertEquals(ws.memo(pinfo, "inner", function() return n * 2 end), n * 2)
+            return { length = n }
+        end
+        local value = ws.memo(pinfo, "length", compute, len)
+        lu.assertEquals(value.length, len)
+        lu.assertEquals(ws.memo(pinfo, "inner", error), len * 2)
+        lu.assertEquals(calls[len], 1)
+
+        if pinfo.visited then
+            lu.assertEquals(ws.p_get_proto_data(pinfo, proto, 1), len)
+            lu.assertIs(ws.p_get_proto_data(pinfo, proto, 2), value)
+        else
+            lu.assertNil(ws.p_get_proto_data(pinfo, proto, 1))
+            ws.p_add_proto_data(pinfo, proto, 1, len)
+            ws.p_add_proto_data(pinfo, proto, 2, value)
+        end
+    end)
+end
+
+function testFlowTable()
+    local ft = ws.FlowTable.new{ capacity = 2, fields = { packets = "integer", last = "number" } }
+    local pinfos = {}
+    for i = 1, 3 do
+        pinfos[i] = ws.pinfo.new()
+        pinfos[i].src = ws.Address.new(ws.Address.ipv4("10.0.0." .. i))
+        pinfos[i].dst = ws.Address.new(ws.Address.ipv4("10.0.0.100"))
+    end
+    local reply = ws.pinfo.new()
+    reply.src = pinfos[1].dst
+    reply.dst = pinfos[1].src
+
+    local slot, created, dir = ft:insert(pinfos[1])
+    lu.assertTrue(created)
+    lu.assertEquals(ft:add(slot, "packets", 1, "last", 1.5), 1)
+    ft:set_value(slot, { name = "first" })
+
+    local slot2, created2, dir2 = ft:insert(reply)
+    lu.assertEquals(slot2, slot)
+    lu.assertFalse(created2)
+    lu.assertNotEquals(dir2, dir)
+    lu.assertEquals(ft:add(slot, "packets", 1), 2)
+    lu.assertEquals(ft:get(slot, "last"), 1.5)
+    lu.assertEquals(ft:get_value(slot).name, "first")
+    lu.assertEquals(tostring((ft:key(slot))), "10.0.0.1")
+
+    ft:insert(pinfos[2])
+    ft:insert(pinfos[3])
+    lu.assertNil(ft:find(pinfos[1]))
+    lu.assertEquals(#ft, 2)
+    local stats = ft:stats()
+    lu.assertEquals(stats.evictions, 1)
+    lu.assertEquals(stats.occupancy, 1.0)
+
+    lu.assertError(ft.get, ft, slot, "no_such_field")
+    lu.assertError(ws.FlowTable.new, { capacity = 0 })
+    lu.assertError(ws.FlowTable.new, { capacity = 1, fields = { x = "string" } })
+end
+
+function testPrefixTable()
+    local pt = ws.PrefixTable.new()
+    pt:add("10.0.0.0/8", 1)
+    pt:add("10.1.2.0/24", "lan")
+    pt:add("10.1.2.3", 3)
+    pt:add("2001:db8::/32", 6)
+    lu.assertEquals(pt:lookup(ws.Address.ipv4("10.200.0.1")), 1)
+    lu.assertEquals(pt:lookup(ws.Address.ipv4("10.1.2.4")), "lan")
+    lu.assertEquals(pt:lookup(ws.Address.new(ws.AT_IPv4, "10.1.2.3")), 3)
+    lu.assertNil(pt:lookup(ws.Address.ipv4("192.168.0.1")))
+    lu.assertEquals(pt:lookup(ws.Address.ipv6("2001:db8:1::1")), 6)
+    lu.assertNil(pt:lookup(ws.Address.ipv6("2001:db9::1")))
+    local b = "\x00\x0a\x01\x02\x03"
+    lu.assertEquals(pt:lookup_tvb(ws.tvb_new_from_data(b, #b), 1), 3)
+
+    local path = os.tmpname()
+    local f = io.open(path, "w")
+    f:write("# comment\n192.168.0.0/16 -5\n192.168.1.0/24\thome\n")
+    f:close()
+    lu.assertEquals(pt:load(path), 2)
+    os.remove(path)
+    lu.assertEquals(pt:lookup(ws.Address.ipv4("192.168.2.1")), -5)
+    lu.assertEquals(pt:lookup(ws.Address.ipv4("192.168.1.1")), "home")
+    lu.assertEquals(#pt, 6)
+    local total, mem = pt:memory()
+    lu.assertTrue(total > 0)
+    lu.assertEquals(mem.prefixes, 6)
+
+    lu.assertError(pt.add, pt, "10.0.0.0/33", 1)
+    lu.assertError(pt.add, pt, "not a prefix", 1)
+end
+
+function testMmapTable()
+    local csv, path = os.tmpname(), os.tmpname()
+    local f = io.open(csv, "w")
+    f:write('id,name\n1,one\n2,"two, ""2"""\n1,uno\n')
+    f:close()
+    lu.assertEquals(ws.util.mmap_table_build(csv, path, { header = true }), 2)
+    local mt = ws.util.mmap_table(path)
+    lu.assertEquals(#mt, 2)
+    lu.assertEquals(mt:get("1"), "uno")
+    lu.assertEquals(mt:get("2"), 'two, "2"')
+    lu.assertNil(mt:get("id"))
+    lu.assertEquals(mt:get_tvb(ws.tvb_new_from_data("x2", 2), 1, 1), 'two, "2"')
+
+    -- rebuilding replaces the file, the open table keeps reading the old one
+    f = io.open(csv, "w")
+    f:write('1,one\n')
+    f:close()
+    lu.assertEquals(ws.util.mmap_table_build(csv, path), 1)
+    lu.assertEquals(mt:get("2"), 'two, "2"')
+    local mt2 = ws.util.mmap_table(path)
+    lu.assertEquals(#mt2, 1)
+    lu.assertEquals(mt2:get("1"), "one")
+    mt2:close()
+    mt:close()
+    lu.assertError(mt.get, mt, "1")
+    lu.assertError(ws.util.mmap_table, csv)
+    lu.assertError(ws.util.mmap_table_build, csv, path, { key = 3 })
+
+    -- a corrupt file without an empty slot
+    f = io.open(path, "wb")
+    f:write(string.pack("=c8I4I4I8I8I8I8I8", "WSL2MAP", 1, 0x01020304, 0, 4, 56, 152, 0))
+    for i = 1, 4 do
+        f:write(string.pack("=I8I8I4I4", 1, 0, 1, 0))
+    end
+    f:close()
+    mt = ws.util.mmap_table(path)
+    lu.assertNil(mt:get("x"))
+    mt:close()
+    os.remove(csv)
+    os.remove(path)
+end
+
+function testAllocStats()
+    local stats = ws.util.alloc_stats()
+    lu.assertTrue(stats.allocator == "pool" or stats.allocator == "system")
+    lu.assertTrue(stats.live > 0)
+    if stats.allocator == "pool" then
+        lu.assertTrue(stats.peak >= stats.live)
+        lu.assertEquals(#stats.classes, 16)
+        lu.assertEquals(stats.classes[1].size, 16)
+    end
+end
+
+function testMemory()
+    local mem = ws.util.memory()
+    lu.assertTrue(mem.live > 0)
+    lu.assertTrue(mem.peak >= mem.live)
+    lu.assertNotNil(mem.modules.core)
+    local module = mem.modules["test.lua"]
+    lu.assertNotNil(module)
+    lu.assertTrue(module.live > 0)
+
+    ws.util.set_memory_limits{ module = "test.lua", hard = module.live + 100000 }
+    local ok, err = pcall(function()
+        local t = {}
+        for i = 1, 1000000 do
+            t[i] = i
+        end
+    end)
+    ws.util.set_memory_limits{ module = "test.lua", hard = 0 }
+    lu.assertFalse(ok)
+    lu.assertStrContains(err, "not enough memory")
+    lu.assertTrue(ws.util.memory().modules["test.lua"].limit_errors > 0)
+    lu.assertError(ws.util.set_memory_limits, { module = "no_such_module.lua" })
+
+    local gc = ws.util.memory().gc
+    lu.assertEquals(gc.mode, "generational")
+    lu.assertTrue(gc.packet_steps)
+    ws.prefs.set("wslua2.gc_mode", "incremental")
+    lu.assertEquals(ws.util.memory().gc.mode, "incremental")
+    ws.prefs.set("wslua2.gc_mode", "generational")
+    lu.assertEquals(ws.util.memory().gc.mode, "generational")
+end
+
+function testCpuBudget()
+    local proto = ws.proto_register_protocol("Wslua2 Test Budget", "Wslua2 Budget", "wslua2budget")
+    local bounds = ws.register_dissector(proto, "wslua2budget_bounds", function(tvb, pinfo, tree, cinfo)
+        return tvb:uint8(tvb:captured_length())
+    end)
+    local loop = ws.register_dissector(proto, "wslua2budget_loop", function(tvb, pinfo, tree, cinfo)
+        while true do end
+    end)
+    local tvb = ws.tvb_new_from_data("abc", 3)
+    ws.prefs.set("wslua2.cpu_budget", 100)
+    ws.prefs.set("wslua2.cpu_budget_disable_after", 2)
+
+    -- a bounds error restores the hook
+    lu.assertFalse(pcall(bounds.call, bounds, tvb, ws.pinfo.new(1)))
+    lu.assertNil(debug.gethook())
+
+    local ok, err = pcall(loop.call, loop, tvb, ws.pinfo.new(1))
+    lu.assertFalse(ok)
+    lu.assertStrContains(err, "CPU budget of 100000 instructions exceeded")
+    lu.assertFalse(pcall(loop.call, loop, tvb, ws.pinfo.new(2)))
+    lu.assertTrue(loop:stats().disabled)
+    -- frames after the one that disabled the dissector are skipped
+    local calls = loop:stats().calls
+    loop:call(tvb, ws.pinfo.new(3))
+    lu.assertEquals(loop:stats().calls, calls)
+    lu.assertEquals(loop:stats().timeouts, 2)
+    lu.assertNil(debug.gethook())
+
+    ws.prefs.set("wslua2.cpu_budget", 0)
+    ws.prefs.set("wslua2.cpu_budget_disable_after", 10)
+end
+
+function testErrorThreshold()
+    local proto = ws.proto_register_protocol("Wslua2 Test Breaker", "Wslua2 Breaker", "wslua2breaker")
+    local handle = ws.register_dissector(proto, "wslua2breaker", function(tvb, pinfo, tree, cinfo)
+        return tvb:uint8(tvb:captured_length())
+    end)
+    local tvb = ws.tvb_new_from_data("abc", 3)
+    ws.prefs.set("wslua2.error_threshold", 2)
+
+    lu.assertFalse(pcall(handle.call, handle, tvb, ws.pinfo.new(1)))
+    lu.assertFalse(pcall(handle.call, handle, tvb, ws.pinfo.new(2)))
+    -- the packet goes to the data dissector
+    lu.assertEquals(handle:call(tvb, ws.pinfo.new(3)), 3)
+    local stats = handle:stats()
+    lu.assertEquals(stats.calls, 2)
+    lu.assertEquals(stats.errors, 2)
+    lu.assertEquals(stats.skipped, 1)
+
+    ws.prefs.set("wslua2.error_threshold", 0)
+end
+
+function testHandles()
+    -- Objects created outside of a packet are not tied to one
+    local tvb = ws.tvb_new_from_data("hello", 5)
+    lu.assertEquals(type(tvb), "userdata")
+    lu.assertEquals(tvb:get_bytes(0, -1), "hello")
+    lu.assertEquals(ws.hash.xxh3(tvb, 0, -1), ws.hash.xxh3("hello"))
+    lu.assertError(ws.hash.xxh3, io.stdout)
 end
 
 print("Starting tests...")
 local failures = lu.LuaUnit.run("--verbose")
 
+-- Limits to restore before the checks of the next packet run
+local restore_memory_limits = nil
+
+-- Registered last. On the first packet of the second pass it sets a global
+-- hard limit equal to the memory in use, so the plugin's own allocations
+-- for the next packet, made before any Lua dissector runs, go over it.
+local packets_seen = 0
+add_packet_check("testMemoryHardLimit", function(tvb, pinfo, tree)
+    packets_seen = packets_seen + 1
+    if pinfo.visited and packets_seen == 3 then
+        local mem = ws.util.memory()
+        restore_memory_limits = { soft = mem.soft_limit }
+        ws.util.set_memory_limits{ soft = mem.soft_limit, hard = mem.live }
+    elseif packets_seen == 4 then
+        lu.assertEquals(ws.util.memory().hard_limit, 0)
+        lu.assertEquals(ws.util.memory().modules.core.limit_errors, 0)
+    end
+end)
+
+local packet_proto = ws.proto_register_protocol("Wslua2 Test Packets", "Wslua2 Packets", "wslua2packets")
+local packet_handle = ws.register_dissector(packet_proto, "wslua2packets", function(tvb, pinfo, tree, cinfo)
+    if restore_memory_limits then
+        ws.util.set_memory_limits(restore_memory_limits)
+        restore_memory_limits = nil
+    end
+    for _, c in ipairs(packet_checks) do
+        local ok, err = pcall(c.check, tvb, pinfo, tree)
+        if not ok then
+            print(c.name .. ": " .. tostring(err))
+            os.exit(1)
+        end
+    end
+    return tvb:captured_length()
+end)
+ws.dissector_add_uint("udp.port", 5599, packet_handle)
+
 -- os.exit() will terminate the tshark process. We should do this cleanly
 -- but there is no obvious way to make tshark exit cleanly with an
 -- error code from an extension option.